@@ -0,0 +1,202 @@
+// Block-compressed books - see bookcodec.h
+
+#include "bookcodec.h"
+
+#include <string.h>
+#include <algorithm>
+
+using std::min;
+
+#define LZ4_MIN_MATCH     4
+#define LZ4_LAST_LITERALS 5    // The block always ends in at least this many literals...
+#define LZ4_MATCH_LIMIT   12   // ...and no match starts this close to the end
+#define LZ4_MAX_OFFSET    65535
+#define LZ4_HASH_BITS     12
+
+bool bookHeaderValid(const BookHeader& header) {
+    if (header.magic != BOOK_MAGIC || header.version != BOOK_VERSION || header.blockShift < 10 ||
+        header.blockShift > BOOK_MAX_BLOCK_SHIFT) {
+        return false;
+    }
+    uint32_t blockSize = 1UL << header.blockShift;
+    return header.blockCount == (uint32_t)(((uint64_t)header.textSize + blockSize - 1) >> header.blockShift);
+}
+
+// ============================================================================
+// DECODER
+// ============================================================================
+
+// A 15 in a token nibble continues in 255-terminated bytes
+static bool readLength(const uint8_t*& ip, const uint8_t* end, size_t& length) {
+    uint8_t b;
+    do {
+        if (ip >= end) {
+            return false;
+        }
+        b = *ip++;
+        length += b;
+    } while (b == 255);
+    return true;
+}
+
+bool lz4DecompressBlock(const uint8_t* in, size_t inLen, uint8_t* out, size_t outLen) {
+    const uint8_t* ip = in;
+    const uint8_t* end = in + inLen;
+    size_t op = 0;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+
+        size_t literals = token >> 4;
+        if (literals == 15 && !readLength(ip, end, literals)) {
+            return false;
+        }
+        if (literals > (size_t)(end - ip) || literals > outLen - op) {
+            return false;
+        }
+        memcpy(out + op, ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == end) {
+            break;  // The last sequence has no match
+        }
+
+        if (end - ip < 2) {
+            return false;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        size_t length = (token & 0x0F);
+        if (length == 15 && !readLength(ip, end, length)) {
+            return false;
+        }
+        length += LZ4_MIN_MATCH;
+        if (offset == 0 || offset > op || length > outLen - op) {
+            return false;
+        }
+
+        // Runs shorter than the match repeat - copy a period at a time
+        uint8_t* dst = out + op;
+        op += length;
+        while (length > 0) {
+            size_t n = min(length, offset);
+            memcpy(dst, dst - offset, n);
+            dst += n;
+            length -= n;
+        }
+    }
+    return op == outLen;
+}
+
+// ============================================================================
+// ENCODER
+// ============================================================================
+
+static uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static void appendLength(std::vector<uint8_t>& out, size_t length) {
+    while (length >= 255) {
+        out.push_back(255);
+        length -= 255;
+    }
+    out.push_back((uint8_t)length);
+}
+
+// Literals, then a match unless matchLength is 0 (the last sequence)
+static void appendSequence(std::vector<uint8_t>& out, const uint8_t* literals, size_t literalLength,
+                           size_t offset, size_t matchLength) {
+    size_t matchCode = matchLength > 0 ? matchLength - LZ4_MIN_MATCH : 0;
+    out.push_back((uint8_t)((min(literalLength, (size_t)15) << 4) | min(matchCode, (size_t)15)));
+    if (literalLength >= 15) {
+        appendLength(out, literalLength - 15);
+    }
+    out.insert(out.end(), literals, literals + literalLength);
+    if (matchLength == 0) {
+        return;
+    }
+    out.push_back(offset & 0xFF);
+    out.push_back(offset >> 8);
+    if (matchCode >= 15) {
+        appendLength(out, matchCode - 15);
+    }
+}
+
+void lz4CompressBlock(const uint8_t* in, size_t inLen, std::vector<uint8_t>& out) {
+    std::vector<int32_t> table(1 << LZ4_HASH_BITS, -1);  // Last position of each 4-byte hash
+    size_t anchor = 0;
+    size_t ip = 0;
+
+    if (inLen > LZ4_MATCH_LIMIT) {
+        size_t matchStartLimit = inLen - LZ4_MATCH_LIMIT;
+        size_t matchEndLimit = inLen - LZ4_LAST_LITERALS;
+        while (ip < matchStartLimit) {
+            uint32_t sequence = read32(in + ip);
+            uint32_t hash = (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+            int32_t ref = table[hash];
+            table[hash] = (int32_t)ip;
+            if (ref < 0 || ip - ref > LZ4_MAX_OFFSET || read32(in + ref) != sequence) {
+                ip++;
+                continue;
+            }
+
+            size_t matchEnd = ip + LZ4_MIN_MATCH;
+            while (matchEnd < matchEndLimit && in[matchEnd] == in[ref + (matchEnd - ip)]) {
+                matchEnd++;
+            }
+            size_t start = ip;
+            while (start > anchor && ref > 0 && in[start - 1] == in[ref - 1]) {
+                start--;
+                ref--;
+            }
+
+            appendSequence(out, in + anchor, start - anchor, start - ref, matchEnd - start);
+            ip = matchEnd;
+            anchor = ip;
+        }
+    }
+    appendSequence(out, in + anchor, inLen - anchor, 0, 0);
+}
+
+// ============================================================================
+// CONTAINER
+// ============================================================================
+
+static void put32(uint8_t* p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+void packBook(const uint8_t* text, size_t textSize, std::vector<uint8_t>& out, int blockShift) {
+    size_t blockSize = (size_t)1 << blockShift;
+    uint32_t blockCount = (uint32_t)((textSize + blockSize - 1) >> blockShift);
+    size_t tableStart = sizeof(BookHeader);
+
+    out.assign(tableStart + (blockCount + 1) * sizeof(uint32_t), 0);
+    std::vector<uint8_t> compressed;
+    for (uint32_t b = 0; b < blockCount; b++) {
+        const uint8_t* block = text + (size_t)b * blockSize;
+        size_t length = min(blockSize, textSize - (size_t)b * blockSize);
+        put32(&out[tableStart + b * sizeof(uint32_t)], out.size());
+
+        compressed.clear();
+        lz4CompressBlock(block, length, compressed);
+        if (compressed.size() < length) {
+            out.insert(out.end(), compressed.begin(), compressed.end());
+        } else {
+            out.insert(out.end(), block, block + length);  // Readers take a full-length block as stored
+        }
+    }
+    put32(&out[tableStart + blockCount * sizeof(uint32_t)], out.size());
+
+    put32(&out[0], BOOK_MAGIC);
+    out[4] = BOOK_VERSION;
+    out[5] = blockShift;
+    put32(&out[8], textSize);
+    put32(&out[12], blockCount);
+}
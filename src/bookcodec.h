@@ -0,0 +1,46 @@
+// Block-compressed books (.txtz) - the container format and its LZ4 block
+// codec. The text is cut into blocks of 2^blockShift bytes, each compressed
+// on its own, so any offset can be read by decompressing one block. Plain
+// C++ with no Arduino dependencies: tools/packbook.cpp builds it on a PC to
+// pack books for the card.
+//
+// Layout, little endian:
+//   BookHeader
+//   uint32_t blockOffsets[blockCount + 1]   File offset of each block, then of the end
+//   blocks                                  LZ4 block format, or stored as-is when
+//                                           that is no smaller
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#define BOOK_COMPRESSED_EXT ".txtz"
+#define BOOK_MAGIC          0x5A545854  // "TXTZ"
+#define BOOK_VERSION        1
+#define BOOK_BLOCK_SHIFT    15          // 32 KB blocks
+#define BOOK_MAX_BLOCK_SHIFT 16
+
+struct BookHeader {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t blockShift;
+    uint16_t reserved;
+    uint32_t textSize;    // Bytes of text once decompressed
+    uint32_t blockCount;
+};
+static_assert(sizeof(BookHeader) == 16, "BookHeader is read straight off the card");
+
+// Whether a header read off the card describes a book we can read
+bool bookHeaderValid(const BookHeader& header);
+
+// Decompress one LZ4 block into exactly outLen bytes. False if the data is
+// corrupt or doesn't decompress to outLen - never writes past out.
+bool lz4DecompressBlock(const uint8_t* in, size_t inLen, uint8_t* out, size_t outLen);
+
+// Compress one block, appending to out. Greedy with a small hash table -
+// packing speed matters little next to the decoder.
+void lz4CompressBlock(const uint8_t* in, size_t inLen, std::vector<uint8_t>& out);
+
+// Whole container for the text
+void packBook(const uint8_t* text, size_t textSize, std::vector<uint8_t>& out, int blockShift = BOOK_BLOCK_SHIFT);
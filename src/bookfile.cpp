@@ -0,0 +1,214 @@
+// Books on the SD card - see bookfile.h
+
+#include "bookfile.h"
+
+#include <esp_heap_caps.h>
+#include <strings.h>
+#include <vector>
+
+#include "perf.h"
+
+struct BookBlockSlot {
+    int32_t block;      // -1 = empty
+    uint32_t lastUse;
+    size_t length;
+    uint8_t* data;
+};
+
+struct BookBlockCache {
+    BookHeader header;
+    std::vector<uint32_t> offsets;  // Of each block on the card, then of the end
+    uint8_t* staging;               // One block as stored
+    BookBlockSlot slots[BOOK_CACHE_BLOCKS];
+    int slotCount;
+    uint32_t useCount;
+
+    ~BookBlockCache() {
+        free(staging);
+        for (int i = 0; i < slotCount; i++) {
+            free(slots[i].data);
+        }
+    }
+};
+
+// Blocks go in PSRAM when the board has it, otherwise one fits in the heap
+static uint8_t* allocBlock(size_t bytes) {
+#ifdef BOARD_HAS_PSRAM
+    if (psramFound()) {
+        return (uint8_t*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    }
+#endif
+    return (uint8_t*)malloc(bytes);
+}
+
+static bool hasExtension(const char* filename, const char* ext) {
+    size_t length = strlen(filename);
+    size_t extLength = strlen(ext);
+    return length >= extLength && strcasecmp(filename + length - extLength, ext) == 0;
+}
+
+bool isBookFilename(const char* filename) {
+    return hasExtension(filename, ".txt") || hasExtension(filename, BOOK_COMPRESSED_EXT);
+}
+
+bool BookFile::open(fs::FS& fs, const char* path) {
+    close();
+    file = fs.open(path, FILE_READ);
+    if (!file) {
+        return false;
+    }
+    if (!hasExtension(path, BOOK_COMPRESSED_EXT)) {
+        return true;
+    }
+
+    std::shared_ptr<BookBlockCache> cache = std::make_shared<BookBlockCache>();
+    BookBlockCache& c = *cache;
+    c.staging = nullptr;
+    c.slotCount = 0;
+    c.useCount = 0;
+    bool ok = file.read((uint8_t*)&c.header, sizeof(c.header)) == sizeof(c.header) && bookHeaderValid(c.header);
+    if (ok) {
+        size_t tableBytes = (c.header.blockCount + 1) * sizeof(uint32_t);
+        c.offsets.resize(c.header.blockCount + 1);
+        ok = file.read((uint8_t*)c.offsets.data(), tableBytes) == tableBytes &&
+             c.offsets[c.header.blockCount] <= file.size();
+        PERF_COUNT(PERF_SD_BYTES, sizeof(c.header) + tableBytes);
+    }
+    if (ok) {
+        size_t blockSize = 1UL << c.header.blockShift;
+        int wanted = 1;
+#ifdef BOARD_HAS_PSRAM
+        wanted = psramFound() ? BOOK_CACHE_BLOCKS : 1;
+#endif
+        c.staging = allocBlock(blockSize);
+        for (int i = 0; i < wanted && c.staging != nullptr; i++) {
+            uint8_t* data = allocBlock(blockSize);
+            if (data == nullptr) {
+                break;
+            }
+            c.slots[c.slotCount++] = {-1, 0, 0, data};
+        }
+        ok = c.slotCount > 0;
+    }
+    if (!ok) {
+        Serial.printf("  %s: not a readable compressed book\n", path);
+        file.close();
+        return false;
+    }
+
+    blocks = cache;
+    pos = 0;
+    return true;
+}
+
+void BookFile::close() {
+    if (file) {
+        file.close();
+    }
+    blocks.reset();
+    pos = 0;
+}
+
+bool BookFile::seek(long offset) {
+    if (!blocks) {
+        return file.seek(offset);
+    }
+    if (offset < 0 || (size_t)offset > blocks->header.textSize) {
+        return false;
+    }
+    pos = offset;
+    return true;
+}
+
+int BookFile::read(uint8_t* buffer, size_t len) {
+    if (!blocks) {
+        int got = file.read(buffer, len);
+        PERF_COUNT(PERF_SD_BYTES, max(got, 0));
+        return got;
+    }
+
+    const uint32_t shift = blocks->header.blockShift;
+    size_t done = 0;
+    while (done < len && pos < blocks->header.textSize) {
+        uint32_t block = pos >> shift;
+        const uint8_t* data;
+        size_t length;
+        if (!loadBlock(block, data, length)) {
+            break;
+        }
+        size_t within = pos - ((size_t)block << shift);
+        size_t n = min(len - done, length - within);
+        memcpy(buffer + done, data + within, n);
+        done += n;
+        pos += n;
+    }
+    return done;
+}
+
+size_t BookFile::readBytes(char* buffer, size_t len) {
+    if (!blocks) {
+        size_t got = file.readBytes(buffer, len);
+        PERF_COUNT(PERF_SD_BYTES, got);
+        return got;
+    }
+    return read((uint8_t*)buffer, len);
+}
+
+size_t BookFile::size() {
+    return blocks ? blocks->header.textSize : file.size();
+}
+
+size_t BookFile::storedSize() {
+    return file.size();
+}
+
+size_t BookFile::cacheBytes() const {
+    return blocks ? (size_t)(blocks->slotCount + 1) << blocks->header.blockShift : 0;
+}
+
+// The block cached, or read and decompressed into the least recently used slot
+bool BookFile::loadBlock(uint32_t block, const uint8_t*& data, size_t& length) {
+    BookBlockCache& c = *blocks;
+    BookBlockSlot* slot = &c.slots[0];
+    for (int i = 0; i < c.slotCount; i++) {
+        if (c.slots[i].block == (int32_t)block) {
+            slot = &c.slots[i];
+            slot->lastUse = ++c.useCount;
+            data = slot->data;
+            length = slot->length;
+            return true;
+        }
+        if (c.slots[i].lastUse < slot->lastUse) {
+            slot = &c.slots[i];
+        }
+    }
+
+    size_t blockSize = 1UL << c.header.blockShift;
+    size_t textLength = min(blockSize, c.header.textSize - ((size_t)block << c.header.blockShift));
+    uint32_t start = c.offsets[block];
+    uint32_t end = c.offsets[block + 1];
+    if (end < start || end - start > blockSize || !file.seek(start)) {
+        return false;
+    }
+
+    // A block stored at full length wasn't worth compressing
+    size_t storedLength = end - start;
+    uint8_t* target = storedLength == textLength ? slot->data : c.staging;
+    slot->block = -1;
+    bool ok = file.read(target, storedLength) == storedLength;
+    PERF_COUNT(PERF_SD_BYTES, storedLength);
+    if (ok && target == c.staging) {
+        ok = lz4DecompressBlock(c.staging, storedLength, slot->data, textLength);
+    }
+    if (!ok) {
+        Serial.printf("  Compressed book: block %lu unreadable\n", (unsigned long)block);
+        return false;
+    }
+
+    slot->block = block;
+    slot->length = textLength;
+    slot->lastUse = ++c.useCount;
+    data = slot->data;
+    length = textLength;
+    return true;
+}
@@ -0,0 +1,46 @@
+// A book on the SD card, plain .txt or block-compressed .txtz. Reads look
+// the same either way: offsets are into the text, so page tables, the
+// catalog and the journal never see the compression. Compressed books are
+// read a block at a time into a small cache of decompressed blocks in
+// PSRAM, so a page turn usually reads nothing from the card at all.
+// Like File, a BookFile is used by one task at a time with the bus held.
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include <memory>
+
+#include "bookcodec.h"
+
+#define BOOK_CACHE_BLOCKS 4  // Decompressed blocks kept per open book
+
+struct BookBlockCache;
+
+class BookFile {
+public:
+    // Compressed if the path ends in BOOK_COMPRESSED_EXT. False if the file
+    // is missing, or compressed and unreadable.
+    bool open(fs::FS& fs, const char* path);
+    void close();
+    operator bool() const { return (bool)file; }
+
+    bool seek(long offset);
+    int read(uint8_t* buffer, size_t len);
+    size_t readBytes(char* buffer, size_t len);
+    size_t size();        // Bytes of text
+    size_t storedSize();  // Bytes on the card, as the directory scan sees them
+    time_t getLastWrite() { return file.getLastWrite(); }
+    bool compressed() const { return blocks != nullptr; }
+    size_t cacheBytes() const;       // Held for decompressed blocks, 0 for plain text
+    File& stored() { return file; }  // The file as it lies on the card
+
+private:
+    bool loadBlock(uint32_t block, const uint8_t*& data, size_t& length);
+
+    File file;
+    std::shared_ptr<BookBlockCache> blocks;  // Null for plain text - copies share it
+    size_t pos = 0;
+};
+
+// Extension check shared with the directory scan
+bool isBookFilename(const char* filename);
@@ -4,6 +4,19 @@
 #include <SPI.h>
 #include <Wire.h>
 #include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_heap_caps.h>
+#include <esp_sleep.h>
+#include <driver/gpio.h>
+#include <driver/rtc_io.h>
+#include "bookfile.h"
+#include "pagination.h"
+#include "perf.h"
 
 // ============================================================================
 // T-DECK PRO V1.1 HARDWARE DEFINITIONS
@@ -26,12 +39,23 @@
 #define SD_MOSI 33  
 #define SD_SCK  36
 
+// SD SPI clock - the fastest that reads back cleanly is picked at boot
+#ifndef SD_MAX_CLOCK
+#define SD_MAX_CLOCK  20000000
+#endif
+#define SD_SAFE_CLOCK 4000000
+
 // Keyboard (TCA8418)
 #define KB_SDA  13
 #define KB_SCL  14
 #define KB_INT  15
 #define KB_ADDR 0x34
 
+// Fuel gauge (BQ27220) - on the keyboard's I2C bus
+#define GAUGE_ADDR        0x55
+#define GAUGE_REG_VOLTAGE 0x08  // mV
+#define GAUGE_REG_SOC     0x2C  // State of charge, %
+
 // TCA8418 Register addresses
 #define TCA8418_REG_CFG         0x01
 #define TCA8418_REG_INT_STAT    0x02
@@ -49,6 +73,13 @@
 #define SCREEN_WIDTH  240
 #define SCREEN_HEIGHT 320
 
+// Reading page layout - (320px - 14px status bar) / 12px lines.
+// The actual layout comes from Settings, capped at PAGE_MAX_LINES.
+#define PAGE_MAX_LINES      25
+#define PAGE_MAX_LINE_CHARS (SCREEN_WIDTH / 2)  // Proportional, all 2 px glyphs
+// Room for a page of 4-byte UTF-8 throughout, and a CRLF on every line
+#define PAGE_BUF_SIZE       (PAGE_MAX_LINES * (PAGE_MAX_LINE_CHARS * 4 + 2) + 1)
+
 // ============================================================================
 // DISPLAY SETUP
 // ============================================================================
@@ -57,12 +88,80 @@
 // They MUST use the same SPI peripheral (HSPI) to avoid GPIO conflicts
 SPIClass displaySpi(HSPI);
 
+// Screens are drawn once into our own full-frame buffer (in PSRAM when
+// available) and pushed to the panel in one transfer - see SCREEN RENDERING.
+// Build with -DRENDER_PAGED to draw through GxEPD2's firstPage()/nextPage()
+// loop instead, which re-runs the drawing code for every page it buffers.
+#ifdef RENDER_PAGED
+#define DISPLAY_PAGE_HEIGHT GxEPD2_310_GDEQ031T10::HEIGHT
+#else
+#define DISPLAY_PAGE_HEIGHT 8  // GxEPD2's own buffer goes unused, keep it small
+#endif
+
 // Using GxEPD2_BW for black & white e-paper
 // GDEQ031T10 is a 320x240 e-paper display
-GxEPD2_BW<GxEPD2_310_GDEQ031T10, GxEPD2_310_GDEQ031T10::HEIGHT> display(
+GxEPD2_BW<GxEPD2_310_GDEQ031T10, DISPLAY_PAGE_HEIGHT> display(
     GxEPD2_310_GDEQ031T10(EPD_CS, EPD_DC, EPD_RST, EPD_BUSY)
 );
 
+#ifndef RENDER_PAGED
+// 1-bpp frame in the controller's native layout: rows of SCREEN_WIDTH / 8
+// bytes, pixels MSB first, set bit = white (as in GxEPD2_BW's buffer)
+#define FRAME_BYTES_PER_ROW ((SCREEN_WIDTH + 7) / 8)
+#define FRAME_BUFFER_SIZE   (FRAME_BYTES_PER_ROW * SCREEN_HEIGHT)
+
+class FrameBuffer : public Adafruit_GFX {
+public:
+    FrameBuffer() : Adafruit_GFX(SCREEN_WIDTH, SCREEN_HEIGHT), buffer(nullptr) {}
+    
+    bool begin() {
+        buffer = (uint8_t*)heap_caps_malloc(FRAME_BUFFER_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (buffer == nullptr) {
+            buffer = (uint8_t*)malloc(FRAME_BUFFER_SIZE);
+        }
+        if (buffer != nullptr) {
+            memset(buffer, 0xFF, FRAME_BUFFER_SIZE);
+        }
+        return buffer != nullptr;
+    }
+    
+    void drawPixel(int16_t x, int16_t y, uint16_t color) override {
+        if (x < 0 || y < 0 || x >= SCREEN_WIDTH || y >= SCREEN_HEIGHT) {
+            return;
+        }
+        uint8_t* p = buffer + y * FRAME_BYTES_PER_ROW + (x >> 3);
+        uint8_t mask = 0x80 >> (x & 7);
+        if (color) {
+            *p |= mask;
+        } else {
+            *p &= ~mask;
+        }
+    }
+    
+    void fillScreen(uint16_t color) override {
+        memset(buffer, color ? 0xFF : 0x00, FRAME_BUFFER_SIZE);
+    }
+    
+    // Ink a full-width bitmap (set bit = black) into rows [y, y + rows)
+    void drawInkRows(const uint8_t* ink, int y, int rows) {
+        for (int row = 0; row < rows; row++, ink += FRAME_BYTES_PER_ROW) {
+            if (y + row < 0 || y + row >= SCREEN_HEIGHT) continue;
+            uint8_t* dst = buffer + (y + row) * FRAME_BYTES_PER_ROW;
+            for (int i = 0; i < FRAME_BYTES_PER_ROW; i++) {
+                dst[i] &= ~ink[i];
+            }
+        }
+    }
+    
+    const uint8_t* getBuffer() const { return buffer; }
+    
+private:
+    uint8_t* buffer;
+};
+
+FrameBuffer frame;
+#endif
+
 // ============================================================================
 // READER STATE
 // ============================================================================
@@ -72,43 +171,406 @@ GxEPD2_BW<GxEPD2_310_GDEQ031T10, GxEPD2_310_GDEQ031T10::HEIGHT> display(
 #define BUILD_DATE "Feb 2026"
 
 // Index file version - increment when format changes
-#define INDEX_VERSION 3
+#define INDEX_VERSION 4
+#define INDEX_VERSION_RAW 3            // Raw 4-byte positions, still readable
+#define INDEX_CHECKPOINT_INTERVAL 64   // v4: pages between absolute checkpoints
 
 // Books folder on SD card
 #define BOOKS_FOLDER "/books"
+#define LIBRARY_MAX_DEPTH 4  // Subfolder levels scanned below BOOKS_FOLDER
+#define BOOK_PATH_MAX     256                                  // Full path of a book, NUL included
+#define BOOK_NAME_MAX     (BOOK_PATH_MAX - sizeof(BOOKS_FOLDER) - 1)  // Path below BOOKS_FOLDER, NUL excluded
+
+// Library catalog - one record per book plus a shared page-position blob
+#define INDEX_FOLDER          "/.indexes"
+#define CATALOG_PATH          "/.indexes/catalog.bin"
+#define CATALOG_BLOB_PATH     "/.indexes/pages.bin"
+#define CATALOG_BLOB_TMP_PATH "/.indexes/pages.tmp"
+#define CATALOG_TMP_PATH      "/.indexes/catalog.tmp"  // Rewrites go here first, see finishCatalogSwap()
+#define CATALOG_MAGIC         0x54435854  // "TXCT"
+#define CATALOG_VERSION       5           // v2: layout and resume offset, v3: content fingerprint, v4: read order, v5: outline
+#define CATALOG_RECORD_V1_SIZE 32         // Older records are upgraded on load
+#define CATALOG_RECORD_V2_SIZE 40
+#define CATALOG_RECORD_V3_SIZE 44
+#define CATALOG_RECORD_V4_SIZE 48
+
+// Content fingerprint - hash of the first and last FINGERPRINT_SPAN bytes.
+// Always recorded when a book is indexed; checked at boot for books whose
+// directory entry has no usable mtime, or for every book when built with
+// -DINDEX_CONTENT_FINGERPRINT (one extra open per book).
+#define FINGERPRINT_SPAN 4096
+#define CATALOG_COMPACT_SLACK 16384       // Dead blob bytes tolerated before compacting
+
+// Build with -DPROPORTIONAL_TEXT to lay pages out by pixel width, with
+// narrow glyphs taking less room, instead of on the 38-column grid
+#ifdef PROPORTIONAL_TEXT
+#define DEFAULT_PROPORTIONAL 1
+#else
+#define DEFAULT_PROPORTIONAL 0
+#endif
+#define PROPORTIONAL_LINE_WIDTH (SCREEN_WIDTH - 4)  // Pixels, same margins as the grid
+static_assert(PROPORTIONAL_LINE_WIDTH / 2 <= PAGE_MAX_LINE_CHARS, "a page buffer has to hold a full line");
 
 struct Settings {
     uint8_t textSize;
     uint8_t linesPerPage;
-    uint8_t charsPerLine;
-} settings = {1, 25, 38};  // Size 1 font, ~25 lines, ~38 chars per line
+    uint8_t charsPerLine;      // Grid layout only
+    uint8_t fullRefreshEvery;  // Page turns per full refresh (1 = always full)
+    uint8_t proportional;      // Lay out by glyph pixel widths
+} settings = {1, 25, 38, 10, DEFAULT_PROPORTIONAL};  // Size 1 font, ~25 lines, ~38 chars per line, full refresh every 10 turns
+
+// Page positions are only valid for the layout they were computed with
+#define LAYOUT_FINGERPRINT(size, lines, chars) \
+    (((uint32_t)(size) << 16) | ((uint32_t)(lines) << 8) | (uint32_t)(chars))
+#define LAYOUT_LEGACY   LAYOUT_FINGERPRINT(1, 25, 38)  // Fixed layout of indexes before fingerprints
+#define LAYOUT_WRAP_UTF8 (1UL << 24)                    // Flag: columns count characters, not bytes
+#define LAYOUT_PROPORTIONAL (1UL << 25)                 // Flag: width is PROPORTIONAL_LINE_WIDTH pixels
+#define READ_OFFSET_UNKNOWN -1                          // Only the page of the resume point is known
+
+// Chapter headings and words per page come from the pagination pass, see
+// pagination.h
+#define READING_WPM          230  // Reading speed for the time-left estimate
+
+// Page start offsets for one book - see PAGE TABLE below
+#define PAGE_TABLE_SPARSE_STRIDE 16                          // Sparse tables keep every 16th page
+#define PAGE_TABLE_SPARSE_MIN_BYTES      (32UL * 1024 * 1024)  // Go sparse above this with PSRAM
+#define PAGE_TABLE_SPARSE_MIN_BYTES_SRAM (2UL * 1024 * 1024)   // ...and above this without
+struct PageTable {
+    long* entries;           // Every stride-th page start, in PSRAM when available
+    uint32_t entryCount;
+    uint32_t capacity;
+    uint32_t pageCount;      // Logical pages in the book so far
+    long lastPos;            // Start of the last page, whatever the stride
+    uint8_t stride;          // 1 = dense
+    int refCount;
+    SemaphoreHandle_t lock;  // The indexer appends while the reader looks up
+    int cachedGroup;         // Sparse: group whose pages are in groupPositions
+    long groupPositions[PAGE_TABLE_SPARSE_STRIDE];
+    std::vector<long> derived;  // Scratch for filling groupPositions, reserved so page turns don't allocate
+    // Outline, appended along with the pages
+    bool hasOutline;              // False if pages were added without word counts
+    std::vector<Chapter> chapters;
+    std::vector<uint16_t> words;  // Words on each entry's pages, once the next entry has started
+    uint32_t openWords;           // Words on the finished pages of the last entry
+};
 
 struct ReaderState {
-    String currentFile;
-    File file;
-    std::vector<long> pagePositions;
+    char currentFile[BOOK_NAME_MAX + 1];  // Path below BOOKS_FOLDER
+    BookFile file;
+    PageTable* pages;                 // Shared with the book's FileCache entry
     int currentPage;
-    int totalPages;
+    volatile int totalPages;          // Grows while the background indexer runs
+    unsigned long fileSize;           // Of the text - the card holds less if it is compressed
     bool fileOpen;
 } reader;
 
-// Pre-indexed page cache for quick opening
+// Per-book index summary loaded at boot. Page positions stay on SD until
+// openBook() needs them; new books are pre-indexed in the background.
 #define PREINDEX_PAGES 100  // Pre-index first 100 pages of each file
 struct FileCache {
-    String filename;
-    std::vector<long> pagePositions;  // First N page positions
-    unsigned long fileSize;
-    bool fullyIndexed;  // True if file has <= PREINDEX_PAGES pages
-    int lastReadPage;   // Resume position - NEW!
+    const char* filename;    // Path below BOOKS_FOLDER, interned in libraryNames
+    unsigned long fileSize;  // 0 until the book has been opened or indexed
+    int pageCount;           // Pages in the saved index
+    bool hasIndex;           // False until an index exists on SD
+    bool fullyIndexed;       // True once the whole file has been indexed
+    int lastReadPage;        // Resume page, only meaningful for layout
+    long readOffset;         // Resume position as a file offset, or READ_OFFSET_UNKNOWN
+    uint32_t layout;         // Layout fingerprint of the saved index and lastReadPage
+    uint32_t mtime;          // Last write time from the directory scan
+    uint32_t contentHash;    // contentFingerprint(), 0 until computed
+    uint32_t readSequence;   // Bumped each time the book is closed, 0 if never read
+    int catalogSlot;         // Record index in catalog, -1 if none
+    PageTable* pages;        // Loaded once the book has been opened, else null
+};
+
+// Fixed block carved up front to back and only ever freed all at once, so
+// rebuilding what lives in it never fragments the heap
+struct Arena {
+    uint8_t* base;
+    size_t capacity;
+    size_t used;
+    size_t highWater;   // Most ever used
+};
+
+// The library lives in blocks allocated once at boot: the directory scan
+// starts them over instead of freeing and reallocating entries and names
+#define LIBRARY_MAX_BOOKS  2048
+#define LIBRARY_NAME_BYTES (64 * 1024)
+FileCache* fileCache = nullptr;  // LIBRARY_MAX_BOOKS entries
+int fileCount = 0;
+Arena libraryNames;              // Book paths, each a length byte, the path and a NUL
+uint32_t lastReadSequence = 0;   // Highest readSequence in the library
+
+// On-disk catalog layout - fixed-size records so one can be rewritten in place
+struct CatalogHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;    // sizeof(CatalogRecord), guards against layout changes
+    uint32_t recordCount;
+    uint32_t blobSize;      // Bytes in use in pages.bin
+};
+
+struct CatalogRecord {
+    uint32_t nameHash;      // hashFilename() of the book
+    uint32_t fileSize;
+    uint32_t mtime;
+    uint32_t pageCount;
+    int32_t  lastReadPage;
+    uint32_t blobOffset;    // Page positions in pages.bin
+    uint32_t blobLength;
+    uint8_t  fullyIndexed;
+    uint8_t  indexVersion;  // Encoding of the positions (INDEX_VERSION)
+    uint8_t  stride;        // Page table stride, 0 in records from before sparse tables
+    uint8_t  reserved;
+    // v2
+    uint32_t layout;        // LAYOUT_FINGERPRINT the positions were computed with
+    int32_t  readOffset;    // File offset of the resume page, READ_OFFSET_UNKNOWN if not recorded
+    // v3
+    uint32_t contentHash;   // contentFingerprint() when indexed, 0 if unknown
+    // v4
+    uint32_t readSequence;  // Orders books by when they were last read
+    // v5
+    uint32_t outlineLength; // Outline bytes at the end of the blob region, 0 if none
+};
+
+CatalogHeader catalogHeader;
+std::vector<CatalogRecord> catalog;
+
+// Page positions are moved between SD and RAM as one block, which relies
+// on long matching the 4-byte on-disk entries (true on the ESP32)
+static_assert(sizeof(long) == 4, "page index layout assumes a 32-bit long");
+static_assert(offsetof(CatalogRecord, layout) == CATALOG_RECORD_V1_SIZE, "v2 fields must follow the v1 record");
+static_assert(offsetof(CatalogRecord, contentHash) == CATALOG_RECORD_V2_SIZE, "v3 fields must follow the v2 record");
+static_assert(offsetof(CatalogRecord, readSequence) == CATALOG_RECORD_V3_SIZE, "v4 fields must follow the v3 record");
+static_assert(offsetof(CatalogRecord, outlineLength) == CATALOG_RECORD_V4_SIZE, "v5 fields must follow the v4 record");
+
+// Reading position journal - a ring of records in one preallocated file, so
+// the position survives a dead battery without a catalog rewrite per page.
+// Records never straddle a sector, a torn write only loses its own record.
+#define JOURNAL_PATH        "/.indexes/position.jnl"
+#define JOURNAL_MAGIC       0x4C4E4A50  // "PJNL"
+#define JOURNAL_SLOTS       128         // 4 KB - 8 sectors taking turns
+#define JOURNAL_FLUSH_PAGES 10          // Page turns before a flush is due...
+#define JOURNAL_IDLE_MS     2000        // ...or this long after the last one
+#define BATTERY_POLL_MS     60000
+#define BATTERY_LOW_PERCENT 5           // From here on every page turn is flushed
+#define BATTERY_LOW_MV      3450
+
+struct JournalRecord {
+    uint32_t magic;
+    uint32_t sequence;      // Newest record wins, slot is sequence % JOURNAL_SLOTS
+    uint32_t nameHash;      // hashFilename() of the book
+    int32_t  page;
+    int32_t  offset;
+    uint32_t layout;        // Fingerprint page is valid for
+    uint32_t readSequence;  // What closing the book would set - older than the catalog's means superseded
+    uint32_t check;         // fnv1a() of the fields above
+};
+static_assert(512 % sizeof(JournalRecord) == 0, "journal records must not straddle a sector");
+
+struct PositionJournal {
+    File file;                 // Kept open for the session
+    uint32_t sequence;         // Of the next record
+    bool dirty;                // Displayed page not journaled yet
+    int page;
+    long offset;
+    int pagesSinceFlush;
+    unsigned long changedAt;   // millis() of the last page shown
+} journal;
+
+struct BatteryState {
+    bool low;
+    unsigned long checkedAt;   // millis() of the last gauge read, 0 = never
+} battery;
+
+// Deep sleep keeps RTC memory (a reset or power cut doesn't), so the open
+// book is picked up again on wake without the library scan. The panel
+// holds the page meanwhile.
+#define SUSPEND_MAGIC        0x50535553  // "SUSP"
+#define SUSPEND_WINDOW_PAGES 48          // Page starts kept around the current page
+
+struct SuspendState {
+    uint32_t magic;
+    uint32_t check;                   // suspendCheck() of the rest
+    char filename[BOOK_NAME_MAX + 1]; // Path below BOOKS_FOLDER
+    uint32_t fileSize;                // On the card, as in FileCache
+    uint32_t mtime;
+    uint32_t layout;                  // layoutFingerprint() of the window
+    int32_t currentPage;
+    int32_t totalPages;
+    int32_t windowFirst;              // Page of window[0]
+    int32_t windowCount;              // 0 once the page table has taken over
+    int32_t window[SUSPEND_WINDOW_PAGES];
+    uint32_t lastReadSequence;
+    uint32_t journalSequence;
 };
-std::vector<FileCache> fileCache;
+RTC_DATA_ATTR SuspendState suspendState;
+bool resumingFromSuspend = false;     // setup() is taking the fast path
+
+// File list - a sorted view over fileCache, drawn a window of rows at a time
+#define LIBRARY_VISIBLE_ROWS 12
+#define LIBRARY_ROW_HEIGHT   18
+#define LIBRARY_FIRST_ROW_Y  32
+
+enum LibrarySort { SORT_NAME, SORT_RECENT, SORT_SIZE, SORT_COUNT };
+const char* const librarySortNames[SORT_COUNT] = {"name", "recent", "size"};
 
-std::vector<String> fileList;
-int selectedFileIndex = 0;
+struct LibraryView {
+    std::vector<uint16_t> order;  // fileCache indices in display order
+    uint8_t sort;                 // LibrarySort
+    int top;                      // First row of the visible window
+    int drawnSelection;           // Selected row as on screen, -1 if the list isn't showing
+    bool loaded;                  // Scanned and matched against the catalog - not yet after a resume
+} library = {{}, SORT_NAME, 0, -1, false};
+
+int selectedFileIndex = 0;        // Row in library.order
 
 // Partial refresh tracking
 int lastDisplayedPage = -1;
 int lastDisplayedTotal = -1;
+int turnsSinceFullRefresh = 0;  // Partial page turns since the last full refresh
+
+// 1-bpp atlas of the GFX font, one byte per glyph row (pixels MSB first),
+// so text lines can be blitted instead of printed character by character
+uint8_t glyphAtlas[GLYPH_COUNT][GLYPH_HEIGHT];
+uint8_t glyphInkLeft[GLYPH_COUNT];  // First inked column, trimmed off in proportional layout
+uint8_t lineBitmap[(SCREEN_WIDTH + 7) / 8 * GLYPH_HEIGHT];
+
+// Laid-out pages around the current one, ready to draw
+#define PAGE_CACHE_SLOTS 5  // Current page +-2
+struct RenderedPage {
+    int page;                            // -1 when the slot is empty
+    int length;
+    int lineCount;
+    uint16_t lineStart[PAGE_MAX_LINES];  // Offsets into text
+    uint16_t lineEnd[PAGE_MAX_LINES];
+    char text[PAGE_BUF_SIZE];
+};
+RenderedPage* pageCache;  // PAGE_CACHE_SLOTS of them, in PSRAM
+
+// Books left recently, kept open so going back to one skips the file open,
+// the index load and the page layout. Least recently left goes first, when
+// the slots are full or the book coming in would take them over budget.
+#define WARM_BOOKS        3
+#define WARM_BUDGET_BYTES (1024 * 1024)  // Page tables and block caches of warm books
+
+struct WarmBook {
+    FileCache* cache;    // Null when the slot is empty; holds the page table in cache->pages
+    BookFile file;
+    size_t bytes;        // What keeping it costs, as of when it was left
+    uint32_t lastUse;
+    RenderedPage* page;  // The page it was left on, page -1 if none
+};
+WarmBook warmBooks[WARM_BOOKS];
+uint32_t warmUseCount = 0;
+
+// Background indexer - runs on the core not used by loop()
+#define INDEXER_CORE        0
+#define INDEXER_STACK_SIZE  8192
+#define INDEXER_PRIORITY    1
+#define INDEXER_BATCH_PAGES 32  // Room reserved for the pages of one read-ahead chunk
+
+// SD read-ahead for the indexer: a helper task reads the next chunk of the
+// book into one PSRAM buffer while the indexer wraps lines in the other
+#define READ_AHEAD_BYTES     (32 * 1024)  // Per buffer
+#define READ_AHEAD_FALLBACK  4096         // Per buffer when PSRAM is short
+#define READ_AHEAD_HEADROOM  2048         // Room in front of a chunk for the last chunk's partial line
+#define READ_AHEAD_CORE      1
+#define READ_AHEAD_PRIORITY  1
+#define READ_AHEAD_STACK     4096
+
+struct ReadAhead {
+    TaskHandle_t task;
+    SemaphoreHandle_t filled;  // Given when a requested chunk is in
+    char* buffers[2];          // READ_AHEAD_HEADROOM + chunkBytes each
+    int chunkBytes;
+    BookFile* file;
+    long fillOffset;           // Where the requested chunk starts in the file
+    int fillBuffer;            // Which buffer it goes into
+    int fillLength;            // Bytes read, valid once filled is given
+} readAhead;
+
+enum IndexerJob {
+    INDEX_JOB_READER,   // Extend the open book
+    INDEX_JOB_LIBRARY,  // Pre-index the library
+    INDEX_JOB_SEARCH    // Search the open book, see SearchState
+};
+
+struct IndexerState {
+    TaskHandle_t task;
+    uint8_t job;              // IndexerJob
+    char path[BOOK_PATH_MAX]; // Full path of the book being indexed (reader job)
+    FileCache* cache;         // Summary entry of the open book, may be null (reader job)
+    volatile bool running;
+    volatile bool cancel;
+    volatile bool finished;   // Set when a job completes, cleared by loop()
+} indexer;
+
+// SD card and display share displaySpi - whoever touches either must hold
+// the bus. During a refresh the panel only needs it to start and finish, so
+// the display lends it out for the BUSY wait in between (see onDisplayBusy).
+#define SPI_LEND_MAX_MS 1000  // Longest lend before GxEPD2 gets to check its own timeout
+
+struct SpiBus {
+    SemaphoreHandle_t mutex;      // Recursive; waiters queue by priority
+    TaskHandle_t owner;           // Only written by the task holding the mutex
+    int depth;                    // Its recursive holds
+    volatile bool lent;           // Display is in a BUSY wait with the bus given up
+    volatile uint32_t lentBytes;  // Read ahead from SD while lent, since boot
+} spiBus;
+
+// Keyboard input - KB_INT wakes loop(), which drains the TCA8418 FIFO into
+// the queue in one go. Held navigation keys auto-repeat from the queue.
+#define KEY_QUEUE_SIZE         32
+#define KEY_REPEAT_DELAY_MS    500   // Hold time before the first repeat
+#define KEY_REPEAT_INTERVAL_MS 150
+#define LIGHT_SLEEP_IDLE_MS    3000  // Idle time before light sleep (-DNO_LIGHT_SLEEP to disable)
+#define SUSPEND_IDLE_MS        (10UL * 60 * 1000)  // ...and before deep sleep (-DNO_DEEP_SLEEP to disable)
+
+struct KeyboardState {
+    uint8_t queue[KEY_QUEUE_SIZE];  // Mapped key characters, oldest at head
+    uint8_t head;
+    uint8_t count;
+    uint8_t heldKey;                // Repeatable key still held down, 0 if none
+    uint8_t heldCode;               // Its TCA8418 key code, to match the release
+    unsigned long nextRepeat;
+    unsigned long lastActivity;
+    TaskHandle_t loopTask;          // Notified by the KB_INT handler and the indexer
+    bool symHeld;                   // Sym/Alt is down
+    bool symArmed;                  // Next key uses the symbol layer (one-shot unless held)
+} keyboard;
+
+// "Go to" entry in reading mode - 'g', digits, then Enter (page) or P (percent)
+#define GOTO_MAX_DIGITS 6
+struct GotoInput {
+    bool active;
+    char digits[GOTO_MAX_DIGITS + 1];
+    int length;
+} gotoInput;
+
+// Text search in reading mode - 'f', type the text, Enter. 'n' finds the
+// next match. Runs as an indexer job; 'q' stops it.
+#define SEARCH_MAX_CHARS 24
+
+struct SearchState {
+    bool editing;                    // Typing the query
+    char query[SEARCH_MAX_CHARS + 1];
+    int length;
+    uint8_t pattern[SEARCH_MAX_CHARS];  // Folded query, see searchFold
+    uint8_t shift[256];              // Horspool shifts for the pattern
+    long from;                       // Offset the search started at
+    bool resumeIndexing;             // Reader indexing was stopped for the search
+    volatile bool done;              // Set by the job, cleared by loop()
+    long hit;                        // Offset of the match, -1 if none
+    bool cancelled;
+} search;
+
+// Contents screen in reading mode - 'c' lists the headings in the outline
+struct ChapterList {
+    bool active;
+    int selected;
+    int top;  // First row of the visible window
+} chapterList;
 
 // ============================================================================
 // FUNCTION DECLARATIONS
@@ -117,35 +579,196 @@ int lastDisplayedTotal = -1;
 void initHardware();
 void initDisplay();
 void initSD();
+bool sdClockWorks();
 void initKeyboard();
 void showSplashScreen();
-void showIndexingScreen(const String& filename);
+void showIndexingScreen(const char* filename);
+void* psramRealloc(void* ptr, size_t bytes);
+void initLibrary();
+bool arenaInit(Arena& arena, size_t capacity);
+void* arenaAlloc(Arena& arena, size_t bytes, size_t align);
+void arenaReset(Arena& arena);
+const char* internName(Arena& arena, const char* name, size_t length);
+size_t nameLength(const char* name);
+void bookPath(char* out, const char* filename);
+void loadLibrary();
 void listTextFiles();
-void preIndexFiles();
-bool loadIndexFromSD(const String& filename, FileCache& cache);
-bool saveIndexToSD(const String& filename, const std::vector<long>& pagePositions, unsigned long fileSize, bool fullyIndexed, int lastReadPage);
-bool saveReadingPosition(const String& filename, int page);
-String getIndexFilename(const String& txtFilename);
+void scanBooksFolder(File& dir, char* path, size_t prefixLength, int depth);
+bool addFileCacheEntry(const char* path, unsigned long fileSize, uint32_t mtime);
+BookFile openBookFile(const char* path);
+void sortLibrary();
+void drawFileList(bool partialRefresh);
+void drawLibraryRow(Adafruit_GFX& gfx, int row);
+void moveLibrarySelection(int target);
+void loadIndexSummaries();
+FileCache* findFileCache(const char* filename);
+uint32_t hashFilename(const char* filename);
+uint32_t fnv1a(uint32_t hash, const uint8_t* data, size_t len);
+uint32_t contentFingerprint(File& file);
+bool catalogRecordCurrent(const CatalogRecord& rec, const FileCache& cache);
+int findCatalogRecord(uint32_t nameHash);
+bool loadCatalog();
+bool saveCatalog();
+bool writeCatalogFile(const char* path);
+bool catalogFileComplete(const char* path);
+bool finishCatalogSwap();
+bool writeCatalogRecord(int slot);
+void compactCatalog(const std::vector<bool>& keep);
+bool loadLegacyIndex(const char* filename, FileCache& cache, std::vector<long>& pagePositions);
+PageTable* pageTableCreate(uint8_t stride);
+PageTable* pageTableRetain(PageTable* table);
+void pageTableRelease(PageTable* table);
+bool pageTableReserve(PageTable* table, uint32_t entryCapacity);
+void pageTableClear(PageTable* table, uint8_t stride);
+bool pageTableAppend(PageTable* table, const long* positions, int count, const OutlineScan* outline);
+void pageTableCloseOutline(PageTable* table, uint32_t lastPageWords);
+uint32_t pageTableStoredEntries(uint32_t pageCount, uint8_t stride);
+void pageTableSnapshot(PageTable* table, std::vector<long>& out, uint32_t& pageCount, uint8_t& stride,
+                       std::vector<uint8_t>& outline);
+bool pageTableRestore(PageTable* table, const long* stored, uint32_t storedCount, uint32_t pageCount, uint8_t stride);
+uint32_t pageTableSize(PageTable* table);
+bool pageTableHasOutline(PageTable* table);
+void pageTableAdopt(PageTable* table, PageTable* from);
+size_t pageTableBytes(PageTable* table);
+long pageTableBack(PageTable* table);
+long pageTablePosition(PageTable* table, int page, BookFile& file);
+int pageTableEntryAt(PageTable* table, long offset);
+int pageTableFindPage(PageTable* table, long offset, BookFile& file);
+int pageTableChapterCount(PageTable* table);
+Chapter pageTableChapter(PageTable* table, int index);
+int pageTableChapterAt(PageTable* table, long offset);
+bool pageTableWordsToNextChapter(PageTable* table, long offset, uint32_t& words);
+uint8_t pageTableStrideFor(unsigned long fileSize);
+void migrateLegacyIndexes();
+bool readPositionsBlock(File& file, std::vector<long>& pagePositions, uint32_t pageCount);
+void encodePagePositions(const std::vector<long>& pagePositions, std::vector<uint8_t>& out);
+bool decodePagePositions(const uint8_t* data, size_t len, uint32_t firstPage, uint32_t count, long* out);
+void appendVarint(std::vector<uint8_t>& out, uint32_t value);
+bool readVarint(const uint8_t* data, size_t len, size_t& offset, uint32_t& value);
+void encodeOutline(const PageTable* table, std::vector<uint8_t>& out);
+bool decodeOutline(const uint8_t* data, size_t len, PageTable* table, bool complete);
+bool isSupportedIndexVersion(uint8_t version);
+bool loadIndexFromSD(const char* filename, FileCache& cache, PageTable* pages);
+bool saveIndexToSD(const char* filename, PageTable* pages, unsigned long fileSize, bool fullyIndexed, uint32_t layout);
+bool saveReadingPosition(const char* filename, int page, long offset);
+bool openPositionJournal();
+void replayPositionJournal();
+void notePositionChange();
+void pollPositionJournal();
+bool flushPositionJournal();
+uint32_t journalCheck(const JournalRecord& rec);
+bool batteryLow();
+bool readGaugeWord(uint8_t reg, uint16_t& value);
+uint32_t layoutFingerprint();
+int layoutLinesPerPage();
+int layoutLineWidth();
+const uint8_t* layoutGlyphWidths();
+PageLayout pageLayout();
+void getIndexFilename(char* out, const char* txtFilename);
 void displayFileList();
-void openBook(const String& filename);
+void openBook(const char* filename);
 void displayPage();
 void displayPageFull();
+void displayPagePartial();
+void drawReadingPage(bool partialRefresh);
+
+// Screen rendering
+typedef std::function<void(Adafruit_GFX& gfx)> ScreenDrawFn;
+void renderScreen(const ScreenDrawFn& draw);
+void renderScreenPartial(const ScreenDrawFn& draw, int y, int height);
+
+// Glyph-run text renderer
+void initGlyphAtlas();
+int blitTextLine(uint8_t* bitmap, int bytesPerRow, int x, const char* text, int start, int end);
+void drawTextLine(Adafruit_GFX& gfx, int x, int y, const char* text, int start, int end);
+#ifdef RENDER_BENCHMARK
+void benchmarkTextRenderer(Adafruit_GFX& gfx, RenderedPage* rendered);
+#endif
 void updateStatusBar();
-void nextPage();
-void prevPage();
+void turnPages(int delta);
+void beginSearchInput();
+void handleSearchKey(uint8_t key);
+void drawSearchPrompt(const char* message);
+void startSearch();
+void finishSearch();
+bool searchRunning();
+void runSearchJob();
+long searchRange(BookFile& file, long start, long end);
+int searchChunk(const uint8_t* text, int len);
+void printChapterStatus(Adafruit_GFX& gfx, int y);
+void drawStatusMessage(const char* message);
+void openChapterList();
+void drawChapterList(bool partialRefresh);
+void handleChapterListKey(uint8_t key);
+void beginGotoInput();
+void handleGotoKey(uint8_t key);
+void drawGotoPrompt();
 void closeBook();
+void initWarmBooks();
+WarmBook* findWarmBook(const FileCache* cache);
+void keepWarmBook(FileCache* cache, BookFile& file, const RenderedPage* page);
+void closeColdBook(FileCache* cache, BookFile& file);
+void evictWarmBook(WarmBook& warm);
+void clearWarmBooks();
+void onKeyboardInterrupt();
 uint8_t readKeyboard();
+bool isRepeatKey(uint8_t key);
+void drainKeyboard();
+bool pushKey(uint8_t key);
+void waitForInput();
+void enterLightSleep();
+void enterDeepSleep();
+void saveSuspendState();
+uint32_t suspendCheck();
+bool resumeFromSuspend();
+char getSymKeyChar(uint8_t keyCode);
+int navigationDelta(uint8_t key);
+int coalesceNavigation(int delta);
+bool navigationPending();
+void onDisplayBusy(const void* param);
 void handleKeyPress(uint8_t key);
 void writeKBReg(uint8_t reg, uint8_t value);
 uint8_t readKBReg(uint8_t reg);
 
-// Word wrap helper
-struct WrapResult {
-    int lineEnd;      // End position for this line
-    int nextStart;    // Start position for next line
-};
-WrapResult findLineBreak(const char* buffer, int bufLen, int lineStart, int maxChars);
-int indexPagesWordWrap(File& file, long startPos, std::vector<long>& pagePositions, int maxPages);
+// Text decoding, word wrap and the outline scan are in pagination.h
+#ifdef WRAP_BENCHMARK
+void benchmarkLineBreaks(BookFile& file);
+#endif
+
+// Background indexer
+void initIndexer();
+void indexerTaskMain(void* param);
+bool indexBookIncremental(BookFile& file, PageTable* pages, int maxPages, volatile int* pageCount);
+void initReadAhead();
+void readAheadTaskMain(void* param);
+void readAheadRequest(BookFile& file, long offset, int buffer);
+int readAheadWait();
+void runReaderIndexJob();
+bool rebuildReaderOutline(BookFile& file);
+void runLibraryIndexJob();
+void indexLibraryBook(FileCache& cache, int maxPages);
+void startBackgroundIndexing(const char* fullPath, FileCache* cache);
+void startLibraryIndexing();
+void stopBackgroundIndexing();
+bool readerIndexing();
+bool waitForPage(int page);
+bool waitForOffset(long offset);
+int findResumePage(FileCache* cache);
+long getPagePosition(int page);
+bool pagePositionKnown(int page);
+int estimatedTotalPages();
+void printPageStatus(Adafruit_GFX& gfx, int y);
+void lockSpiBus();
+void unlockSpiBus();
+void lockDisplayBus();
+int lendSpiBus();
+void reclaimSpiBus(int holds);
+
+// Page render cache
+void invalidatePageCache();
+RenderedPage* findRenderedPage(int page);
+RenderedPage* layoutPage(int page);
+void prefetchPages();
 
 // ============================================================================
 // SETUP
@@ -153,7 +776,13 @@ int indexPagesWordWrap(File& file, long startPos, std::vector<long>& pagePositio
 
 void setup() {
     Serial.begin(115200);
-    delay(1000);
+    
+    // A key press out of deep sleep with a book open goes straight back to it
+    resumingFromSuspend = esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_EXT0 &&
+                          suspendState.magic == SUSPEND_MAGIC && suspendState.check == suspendCheck();
+    if (!resumingFromSuspend) {
+        delay(1000);  // Time to attach the serial monitor
+    }
     
     Serial.println("\n\n====================================");
     Serial.println("T-Deck Pro E-Paper Text Reader");
@@ -164,17 +793,29 @@ void setup() {
     initDisplay();
     initSD();
     initKeyboard();
+    initIndexer();
+    initLibrary();
+    
+    if (resumingFromSuspend) {
+        bool resumed = resumeFromSuspend();
+        resumingFromSuspend = false;
+        if (resumed) {
+            Serial.printf("Resumed from deep sleep in %lu ms\n", millis());
+            return;
+        }
+        Serial.println("Cannot resume - booting the library");
+    }
     
     // Skip splash screen for now - focus on fixing navigation
     showSplashScreen();
     
-    listTextFiles();
-    preIndexFiles();  // Pre-index files for fast opening
+    loadLibrary();
     
     reader.fileOpen = false;
     reader.currentPage = 0;
     
     displayFileList();
+    startLibraryIndexing();  // Pre-index new books while the user browses
     
     Serial.println("Setup complete!");
 }
@@ -187,9 +828,31 @@ void loop() {
     uint8_t key = readKeyboard();
     if (key != 0) {
         handleKeyPress(key);
+        if (keyboard.count == 0) {
+            PERF_KEY_IDLE();  // Whatever it drew is done, or it drew nothing
+        }
+    }
+    PERF_POLL_SERIAL();
+    
+    // Write the position out once due - never ahead of a waiting key
+    if (keyboard.count == 0 && digitalRead(KB_INT) == HIGH) {
+        pollPositionJournal();
+    }
+    
+    // Background indexing finished - replace the "~N" estimate with the real count
+    if (indexer.finished) {
+        indexer.finished = false;
+        if (reader.fileOpen && !chapterList.active && reader.currentPage == lastDisplayedPage) {
+            updateStatusBar();
+        }
     }
     
-    delay(50);
+    if (search.done && !indexer.running) {  // Task has let go of the bus
+        search.done = false;
+        finishSearch();
+    }
+    
+    waitForInput();  // Until KB_INT, an auto-repeat tick or the indexer needs us
 }
 
 // ============================================================================
@@ -202,7 +865,10 @@ void initHardware() {
     // Enable power - CRITICAL!
     pinMode(PWR_EN, OUTPUT);
     digitalWrite(PWR_EN, HIGH);
-    delay(200);
+    gpio_hold_dis((gpio_num_t)PWR_EN);  // Held on through deep sleep
+    if (!resumingFromSuspend) {
+        delay(200);  // Peripherals stayed powered if we slept
+    }
     
     // Disable 4G modem to turn off red LED (4G version boards only)
     pinMode(41, OUTPUT);
@@ -230,6 +896,7 @@ void initDisplay() {
     
     // Tell GxEPD2 to use our SPI instance
     display.epd2.selectSPI(displaySpi, SPISettings(4000000, MSBFIRST, SPI_MODE0));
+    display.epd2.setBusyCallback(onDisplayBusy);  // Keep collecting keys during refreshes
     
     // Initialize display
     display.init(115200, true, 2, false);
@@ -238,12 +905,31 @@ void initDisplay() {
     display.setTextColor(GxEPD_BLACK);
     display.setTextSize(1);
     
-    // Initial clear with full window
-    display.setFullWindow();
-    display.firstPage();
-    do {
-        display.fillScreen(GxEPD_WHITE);
-    } while (display.nextPage());
+    initGlyphAtlas();
+    
+    pageCache = (RenderedPage*)psramRealloc(nullptr, PAGE_CACHE_SLOTS * sizeof(RenderedPage));
+    if (pageCache == nullptr) {
+        Serial.println("Page cache allocation failed!");
+        while (1) delay(1000);
+    }
+    invalidatePageCache();
+    
+#ifndef RENDER_PAGED
+    if (!frame.begin()) {
+        Serial.println("Frame buffer allocation failed!");
+        while (1) delay(1000);
+    }
+    frame.setTextColor(GxEPD_BLACK);
+    frame.setTextSize(1);
+#endif
+    
+    // Initial clear with full window - on a resume the page is redrawn
+    // over what the panel kept instead
+    if (!resumingFromSuspend) {
+        renderScreen([&](Adafruit_GFX& gfx) {
+            gfx.fillScreen(GxEPD_WHITE);
+        });
+    }
     
     Serial.println("Ã¢Å“â€œ Display initialized");
 }
@@ -251,87 +937,78 @@ void initDisplay() {
 void showSplashScreen() {
     Serial.println("Showing splash screen...");
     
-    // Deselect SD card to free SPI bus for display
-    digitalWrite(SD_CS, HIGH);
-    
-    display.setFullWindow();
-    display.firstPage();
-    do {
-        display.fillScreen(GxEPD_WHITE);
-        display.setTextColor(GxEPD_BLACK);
+    renderScreen([&](Adafruit_GFX& gfx) {
+        gfx.fillScreen(GxEPD_WHITE);
+        gfx.setTextColor(GxEPD_BLACK);
         
         // Title - centered
-        display.setTextSize(2);
-        display.setCursor(60, 130);
-        display.println("TextReader");
+        gfx.setTextSize(2);
+        gfx.setCursor(60, 130);
+        gfx.println("TextReader");
         
         // Version - centered
-        display.setTextSize(1);
-        display.setCursor(96, 155);
-        display.printf("v%s", VERSION);
+        gfx.setTextSize(1);
+        gfx.setCursor(96, 155);
+        gfx.printf("v%s", VERSION);
         
         // Build date - centered
-        display.setCursor(90, 170);
-        display.print(BUILD_DATE);
+        gfx.setCursor(90, 170);
+        gfx.print(BUILD_DATE);
         
         // Loading message - centered
-        display.setCursor(85, 210);
-        display.print("Loading...");
-    } while (display.nextPage());
+        gfx.setCursor(85, 210);
+        gfx.print("Loading...");
+    });
     
     delay(1000);
     display.hibernate();  // Deep sleep forces full re-init on next draw
     Serial.println("Splash screen complete");
 }
 
-void showIndexingScreen(const String& filename) {
-    // Deselect SD card to free SPI bus for display
-    digitalWrite(SD_CS, HIGH);
+void showIndexingScreen(const char* filename) {
+    lockSpiBus();
     
-    display.setFullWindow();
-    display.firstPage();
-    do {
-        display.fillScreen(GxEPD_WHITE);
-        display.setTextColor(GxEPD_BLACK);
+    renderScreen([&](Adafruit_GFX& gfx) {
+        gfx.fillScreen(GxEPD_WHITE);
+        gfx.setTextColor(GxEPD_BLACK);
         
-        display.setTextSize(2);
-        display.setCursor(20, 40);
-        display.println("Indexing");
-        display.setCursor(20, 65);
-        display.println("Pages...");
+        gfx.setTextSize(2);
+        gfx.setCursor(20, 40);
+        gfx.println("Indexing");
+        gfx.setCursor(20, 65);
+        gfx.println("Pages...");
         
-        display.setTextSize(1);
+        gfx.setTextSize(1);
         int y = 110;
-        int maxChars = 36;
-        String remaining = filename;
-        
-        while (remaining.length() > 0 && y < 200) {
-            String line;
-            if (remaining.length() <= maxChars) {
-                line = remaining;
-                remaining = "";
-            } else {
-                int breakPoint = maxChars;
+        const int maxChars = 36;
+        const char* remaining = filename;
+        
+        while (*remaining != '\0' && y < 200) {
+            int length = strlen(remaining);
+            int breakPoint = length;
+            if (length > maxChars) {
+                breakPoint = maxChars;
                 for (int i = maxChars; i > 0; i--) {
                     if (remaining[i] == ' ' || remaining[i] == '-' || remaining[i] == '_') {
                         breakPoint = i;
                         break;
                     }
                 }
-                line = remaining.substring(0, breakPoint);
-                remaining = remaining.substring(breakPoint);
-                remaining.trim();
             }
-            display.setCursor(20, y);
-            display.println(line);
+            gfx.setCursor(20, y);
+            gfx.write((const uint8_t*)remaining, breakPoint);
+            remaining += breakPoint;
+            while (*remaining == ' ') remaining++;
             y += 12;
         }
         
-        display.setCursor(20, 230);
-        display.println("Please wait.");
-        display.setCursor(20, 245);
-        display.println("Loading shortly...");
-    } while (display.nextPage());
+        gfx.setCursor(20, 230);
+        gfx.println("Please wait.");
+        gfx.setCursor(20, 245);
+        gfx.println("Loading shortly...");
+    });
+    
+    unlockSpiBus();
 }
 
 void initSD() {
@@ -340,26 +1017,41 @@ void initSD() {
     pinMode(SD_CS, OUTPUT);
     digitalWrite(SD_CS, HIGH);
     
-    if (!SD.begin(SD_CS, displaySpi, 4000000)) {
+    // The display sets its own clock for each transfer, and the bus lock
+    // keeps the two apart, so the card can run faster than the panel
+    const uint32_t clocks[] = {SD_MAX_CLOCK, SD_MAX_CLOCK / 2, SD_SAFE_CLOCK};
+    uint32_t sdClock = 0;
+    for (int i = 0; i < 3 && sdClock == 0; i++) {
+        if (clocks[i] < SD_SAFE_CLOCK || (i > 0 && clocks[i] >= clocks[i - 1])) {
+            continue;
+        }
+        // Default five open files, plus one for each warm book
+        if (SD.begin(SD_CS, displaySpi, clocks[i], "/sd", 5 + WARM_BOOKS) && sdClockWorks()) {
+            sdClock = clocks[i];
+        } else {
+            Serial.printf("  SD card not reliable at %lu Hz\n", (unsigned long)clocks[i]);
+            SD.end();
+        }
+    }
+    
+    if (sdClock == 0) {
         Serial.println("Ã¢Å“â€” SD Card failed!");
         
-        display.setFullWindow();
-        display.firstPage();
-        do {
-            display.fillScreen(GxEPD_WHITE);
-            display.setCursor(10, 60);
-            display.setTextSize(2);
-            display.println("SD CARD ERROR");
-            display.setCursor(10, 90);
-            display.setTextSize(1);
-            display.println("Insert card & reset");
-        } while (display.nextPage());
+        renderScreen([&](Adafruit_GFX& gfx) {
+            gfx.fillScreen(GxEPD_WHITE);
+            gfx.setCursor(10, 60);
+            gfx.setTextSize(2);
+            gfx.println("SD CARD ERROR");
+            gfx.setCursor(10, 90);
+            gfx.setTextSize(1);
+            gfx.println("Insert card & reset");
+        });
         
         while (1) delay(1000);
     }
     
     uint64_t cardSize = SD.cardSize() / (1024 * 1024);
-    Serial.printf("Ã¢Å“â€œ SD Card: %llu MB\n", cardSize);
+    Serial.printf("Ã¢Å“â€œ SD Card: %llu MB at %lu MHz\n", (unsigned long long)cardSize, (unsigned long)sdClock / 1000000);
     
     // Create books folder if it does not exist
     if (!SD.exists(BOOKS_FOLDER)) {
@@ -373,6 +1065,17 @@ void initSD() {
     }
 }
 
+// Read the first sector twice. A clock the card or the wiring can't keep up
+// with garbles the transfer, and the garbage doesn't repeat exactly.
+bool sdClockWorks() {
+    uint8_t first[512];
+    uint8_t second[512];
+    if (!SD.readRAW(first, 0) || !SD.readRAW(second, 0)) {
+        return false;
+    }
+    return memcmp(first, second, sizeof(first)) == 0 && first[510] == 0x55 && first[511] == 0xAA;
+}
+
 void writeKBReg(uint8_t reg, uint8_t value) {
     Wire.beginTransmission(KB_ADDR);
     Wire.write(reg);
@@ -388,6 +1091,24 @@ uint8_t readKBReg(uint8_t reg) {
     return Wire.available() ? Wire.read() : 0;
 }
 
+// Little-endian 16-bit gauge register, false if the gauge doesn't answer
+bool readGaugeWord(uint8_t reg, uint16_t& value) {
+    Wire.beginTransmission(GAUGE_ADDR);
+    Wire.write(reg);
+    if (Wire.endTransmission(false) != 0 || Wire.requestFrom((uint8_t)GAUGE_ADDR, (uint8_t)2) != 2) {
+        return false;
+    }
+    value = Wire.read();
+    value |= Wire.read() << 8;
+    return true;
+}
+
+void IRAM_ATTR onKeyboardInterrupt() {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(keyboard.loopTask, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
 void initKeyboard() {
     Serial.println("Initializing keyboard...");
     
@@ -395,6 +1116,9 @@ void initKeyboard() {
     Wire.setClock(100000);
     pinMode(KB_INT, INPUT_PULLUP);
     
+    keyboard.loopTask = xTaskGetCurrentTaskHandle();  // setup() runs on the loop task
+    keyboard.lastActivity = millis();
+    
     // Check if TCA8418 is present
     Wire.beginTransmission(KB_ADDR);
     uint8_t error = Wire.endTransmission();
@@ -433,6 +1157,9 @@ void initKeyboard() {
     // Clear interrupt status again
     writeKBReg(TCA8418_REG_INT_STAT, 0x1F);  // Clear all interrupt flags
     
+    // INT goes low while events are waiting in the FIFO
+    attachInterrupt(digitalPinToInterrupt(KB_INT), onKeyboardInterrupt, FALLING);
+    
     Serial.println("Ã¢Å“â€œ Keyboard initialized");
 }
 
@@ -440,10 +1167,98 @@ void initKeyboard() {
 // FILE MANAGEMENT
 // ============================================================================
 
+// Allocate the library blocks - once, at boot
+void initLibrary() {
+    fileCache = (FileCache*)psramRealloc(nullptr, LIBRARY_MAX_BOOKS * sizeof(FileCache));
+    if (fileCache == nullptr || !arenaInit(libraryNames, LIBRARY_NAME_BYTES)) {
+        libraryNames.capacity = 0;  // addFileCacheEntry() refuses everything
+        Serial.println("Library: out of memory");
+    }
+    library.order.reserve(LIBRARY_MAX_BOOKS);
+    initWarmBooks();
+}
+
+bool arenaInit(Arena& arena, size_t capacity) {
+    arena.base = (uint8_t*)psramRealloc(nullptr, capacity);
+    arena.capacity = arena.base != nullptr ? capacity : 0;
+    arena.used = 0;
+    arena.highWater = 0;
+    return arena.base != nullptr;
+}
+
+// Null once the arena is full
+void* arenaAlloc(Arena& arena, size_t bytes, size_t align) {
+    size_t start = (arena.used + align - 1) & ~(align - 1);
+    if (start + bytes > arena.capacity) {
+        return nullptr;
+    }
+    arena.used = start + bytes;
+    arena.highWater = max(arena.highWater, arena.used);
+    return arena.base + start;
+}
+
+void arenaReset(Arena& arena) {
+    arena.used = 0;
+}
+
+// Copy a name into the arena behind its length byte - see nameLength()
+const char* internName(Arena& arena, const char* name, size_t length) {
+    if (length > UINT8_MAX) {
+        return nullptr;
+    }
+    uint8_t* slot = (uint8_t*)arenaAlloc(arena, length + 2, 1);
+    if (slot == nullptr) {
+        return nullptr;
+    }
+    slot[0] = length;
+    memcpy(slot + 1, name, length);
+    slot[length + 1] = '\0';
+    return (const char*)slot + 1;
+}
+
+// Length of a name from internName(), without a strlen
+size_t nameLength(const char* name) {
+    return ((const uint8_t*)name)[-1];
+}
+
+// Full path of a book into a BOOK_PATH_MAX buffer
+void bookPath(char* out, const char* filename) {
+    snprintf(out, BOOK_PATH_MAX, "%s/%s", BOOKS_FOLDER, filename);
+}
+
+// Scan the books folder and match it against the catalog. At boot, or on
+// leaving a book that was resumed from deep sleep.
+void loadLibrary() {
+    char selected[BOOK_NAME_MAX + 1] = "";
+    if (selectedFileIndex < library.order.size()) {
+        strcpy(selected, fileCache[library.order[selectedFileIndex]].filename);
+    }
+    clearWarmBooks();
+    for (int i = 0; i < fileCount; i++) {
+        if (fileCache[i].pages != nullptr) {
+            pageTableRelease(fileCache[i].pages);
+        }
+    }
+    
+    lockSpiBus();
+    listTextFiles();
+    unlockSpiBus();
+    loadIndexSummaries();  // Headers only - positions load when a book is opened
+    library.loaded = true;
+    
+    for (int i = 0; i < library.order.size(); i++) {
+        if (strcmp(selected, fileCache[library.order[i]].filename) == 0) {
+            selectedFileIndex = i;
+            break;
+        }
+    }
+}
+
 void listTextFiles() {
-    fileList.clear();
+    fileCount = 0;
+    arenaReset(libraryNames);
     
-    Serial.println("Scanning for .txt files...");
+    Serial.println("Scanning for books...");
     
     File root = SD.open(BOOKS_FOLDER);
     if (!root || !root.isDirectory()) {
@@ -451,776 +1266,3738 @@ void listTextFiles() {
         return;
     }
     
-    File file = root.openNextFile();
+    char path[BOOK_NAME_MAX + 1];
+    scanBooksFolder(root, path, 0, 0);
+    root.close();
+    
+    sortLibrary();
+    Serial.printf("Total: %d text files, %u of %u name bytes (most %u)\n", fileCount,
+                  (unsigned)libraryNames.used, (unsigned)libraryNames.capacity, (unsigned)libraryNames.highWater);
+}
+
+// Add the books in dir and its subfolders, down to LIBRARY_MAX_DEPTH levels.
+// Books are named by their path below BOOKS_FOLDER, built up in path: the
+// first prefixLength bytes name dir.
+void scanBooksFolder(File& dir, char* path, size_t prefixLength, int depth) {
+    File file = dir.openNextFile();
     while (file) {
-        if (!file.isDirectory()) {
-            String filename = String(file.name());
-            // Extract just the filename (strip any path prefix)
-            int lastSlash = filename.lastIndexOf('/');
-            if (lastSlash >= 0) {
-                filename = filename.substring(lastSlash + 1);
-            }
-            
-            // Skip macOS hidden files (._* and .DS_Store etc)
-            if (filename.startsWith("._") || filename.startsWith(".")) {
-                file = root.openNextFile();
-                continue;
+        // Extract just the filename (strip any path prefix)
+        const char* filename = file.name();
+        const char* lastSlash = strrchr(filename, '/');
+        if (lastSlash != nullptr) {
+            filename = lastSlash + 1;
+        }
+        size_t length = prefixLength + strlen(filename);
+        
+        // Skip macOS hidden files (._* and .DS_Store etc) and hidden folders,
+        // and anything too deep to name
+        if (filename[0] == '.' || length + 1 > BOOK_NAME_MAX) {
+            file = dir.openNextFile();
+            continue;
+        }
+        memcpy(path + prefixLength, filename, length - prefixLength + 1);
+        
+        if (file.isDirectory()) {
+            if (depth < LIBRARY_MAX_DEPTH) {
+                path[length] = '/';
+                scanBooksFolder(file, path, length + 1, depth + 1);
             }
-            
-            if (filename.endsWith(".txt") || filename.endsWith(".TXT")) {
-                fileList.push_back(filename);
-                Serial.printf("  Found: %s (%d bytes)\n", filename.c_str(), file.size());
+        } else if (isBookFilename(filename)) {
+            // Size and mtime come free with the directory entry - the
+            // catalog is validated against these without reopening the book
+            if (addFileCacheEntry(path, file.size(), (uint32_t)file.getLastWrite())) {
+                LOG_VERBOSE("  Found: %s (%u bytes)\n", path, (unsigned)file.size());
+            } else {
+                Serial.printf("  Library full - skipping %s\n", path);
             }
         }
-        file = root.openNextFile();
+        file = dir.openNextFile();
     }
-    
-    root.close();
-    Serial.printf("Total: %d text files\n", fileList.size());
 }
 
-// Get the index filename for a given text file
-String getIndexFilename(const String& txtFilename) {
-    // Create index filename like ".mybook.idx" in a .indexes folder
-    return "/.indexes/" + txtFilename + ".idx";
+// False once the library blocks are full
+bool addFileCacheEntry(const char* path, unsigned long fileSize, uint32_t mtime) {
+    const char* name = fileCount < LIBRARY_MAX_BOOKS ? internName(libraryNames, path, strlen(path)) : nullptr;
+    if (name == nullptr) {
+        return false;
+    }
+    
+    FileCache& cache = fileCache[fileCount++];
+    cache.filename = name;
+    cache.fileSize = fileSize;
+    cache.mtime = mtime;
+    cache.contentHash = 0;  // Only computed when needed
+    cache.pageCount = 0;
+    cache.hasIndex = false;
+    cache.fullyIndexed = false;
+    cache.lastReadPage = 0;  // Start at beginning for new files
+    cache.readOffset = 0;
+    cache.layout = layoutFingerprint();
+    cache.readSequence = 0;
+    cache.catalogSlot = -1;
+    cache.pages = nullptr;
+    return true;
 }
 
-// Load index from SD card - Updated for v2 format with lastReadPage
-bool loadIndexFromSD(const String& filename, FileCache& cache) {
-    String idxPath = getIndexFilename(filename);
+// Rebuild library.order for library.sort, keeping the selected book selected
+void sortLibrary() {
+    int selectedBook = selectedFileIndex < library.order.size() ? library.order[selectedFileIndex] : -1;
     
-    File idxFile = SD.open(idxPath.c_str(), FILE_READ);
-    if (!idxFile) {
-        return false;  // No index file exists
+    library.order.resize(fileCount);  // Within the capacity reserved at boot
+    for (int i = 0; i < fileCount; i++) {
+        library.order[i] = i;
     }
     
-    // Read header: version (1 byte) + filesize (4 bytes) + page count (4 bytes) + 
-    //              fully indexed flag (1 byte) + lastReadPage (4 bytes)
-    uint8_t indexVersion = 0;
-    unsigned long savedFileSize = 0;
-    unsigned long pageCount = 0;
-    uint8_t fullyIndexed = 0;
-    int lastReadPage = 0;
+    std::sort(library.order.begin(), library.order.end(), [](uint16_t a, uint16_t b) {
+        const FileCache& x = fileCache[a];
+        const FileCache& y = fileCache[b];
+        if (library.sort == SORT_RECENT && x.readSequence != y.readSequence) {
+            return x.readSequence > y.readSequence;
+        }
+        if (library.sort == SORT_SIZE && x.fileSize != y.fileSize) {
+            return x.fileSize > y.fileSize;
+        }
+        return strcasecmp(x.filename, y.filename) < 0;
+    });
     
-    idxFile.read(&indexVersion, 1);
+    selectedFileIndex = 0;
+    for (int i = 0; i < library.order.size(); i++) {
+        if (library.order[i] == selectedBook) {
+            selectedFileIndex = i;
+            break;
+        }
+    }
+}
+
+// Open a book for reading. Caller holds the bus.
+BookFile openBookFile(const char* path) {
+    PERF_SCOPE(PERF_SD_OPEN);
+    BookFile book;
+    book.open(SD, path);
+    return book;
+}
+
+// Get the legacy per-book index filename for a given text file, into a
+// BOOK_PATH_MAX buffer. Only used to migrate old cards into the catalog.
+void getIndexFilename(char* out, const char* txtFilename) {
+    // Create index filename like ".mybook.idx" in a .indexes folder
+    snprintf(out, BOOK_PATH_MAX, "/.indexes/%s.idx", txtFilename);
+}
+
+// ============================================================================
+// LIBRARY CATALOG
+// One fixed-size record per book in catalog.bin, page positions for all
+// books in the shared pages.bin blob. Loading the library is a single read.
+// All catalog access happens with the SPI bus held.
+// ============================================================================
+
+#define FNV_OFFSET_BASIS 2166136261u
+
+uint32_t fnv1a(uint32_t hash, const uint8_t* data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// FNV-1a, used to key catalog records by book filename
+uint32_t hashFilename(const char* filename) {
+    return fnv1a(FNV_OFFSET_BASIS, (const uint8_t*)filename, strlen(filename));
+}
+
+// Hash of the size plus the first and last FINGERPRINT_SPAN bytes. Catches
+// same-size edits that a missing or unreliable mtime would let through.
+// Taken over the file as stored, compressed or not. Moves the file position. Never returns 0, which means "not computed".
+uint32_t contentFingerprint(File& file) {
+    uint8_t buf[512];
+    uint32_t size = file.size();
+    uint32_t hash = fnv1a(FNV_OFFSET_BASIS, (const uint8_t*)&size, sizeof(size));
     
-    // Handle old format (no version byte) - first byte would be part of fileSize
-    if (indexVersion != INDEX_VERSION) {
-        // Old format - seek back and read old way
-        idxFile.seek(0);
-        idxFile.read((uint8_t*)&savedFileSize, 4);
-        idxFile.read((uint8_t*)&pageCount, 4);
-        idxFile.read(&fullyIndexed, 1);
-        lastReadPage = 0;  // No saved position in old format
-    } else {
-        // New v2 format
-        idxFile.read((uint8_t*)&savedFileSize, 4);
-        idxFile.read((uint8_t*)&pageCount, 4);
-        idxFile.read(&fullyIndexed, 1);
-        idxFile.read((uint8_t*)&lastReadPage, 4);
+    uint32_t starts[2] = {0, size > FINGERPRINT_SPAN ? size - FINGERPRINT_SPAN : 0};
+    for (int span = 0; span < 2; span++) {
+        file.seek(starts[span]);
+        uint32_t remaining = min(size, (uint32_t)FINGERPRINT_SPAN);
+        while (remaining > 0) {
+            int got = file.read(buf, min(remaining, (uint32_t)sizeof(buf)));
+            if (got <= 0) break;
+            hash = fnv1a(hash, buf, got);
+            remaining -= got;
+        }
+    }
+    return hash != 0 ? hash : 1;
+}
+
+// Whether a record still describes the book found by the directory scan.
+// The content hash is compared only when both sides have one.
+bool catalogRecordCurrent(const CatalogRecord& rec, const FileCache& cache) {
+    if (rec.fileSize != cache.fileSize || rec.mtime != cache.mtime || !isSupportedIndexVersion(rec.indexVersion)) {
+        return false;
+    }
+    return rec.contentHash == 0 || cache.contentHash == 0 || rec.contentHash == cache.contentHash;
+}
+
+int findCatalogRecord(uint32_t nameHash) {
+    for (int i = 0; i < catalog.size(); i++) {
+        if (catalog[i].nameHash == nameHash) {
+            return i;
+        }
     }
+    return -1;
+}
+
+bool loadCatalog() {
+    finishCatalogSwap();  // A rewrite cut off by power loss
+    catalog.clear();
+    catalogHeader.magic = CATALOG_MAGIC;
+    catalogHeader.version = CATALOG_VERSION;
+    catalogHeader.recordSize = sizeof(CatalogRecord);
+    catalogHeader.recordCount = 0;
+    catalogHeader.blobSize = 0;
     
-    // Verify file size matches (if file changed, index is invalid)
-    String fullPath = String(BOOKS_FOLDER) + "/" + filename;
-    File txtFile = SD.open(fullPath.c_str(), FILE_READ);
-    if (!txtFile) {
-        idxFile.close();
+    File catFile = SD.open(CATALOG_PATH, FILE_READ);
+    if (!catFile) {
         return false;
     }
-    unsigned long currentFileSize = txtFile.size();
-    txtFile.close();
     
-    if (savedFileSize != currentFileSize) {
-        Serial.printf("  Index stale for %s (size changed)\n", filename.c_str());
-        idxFile.close();
-        SD.remove(idxPath.c_str());  // Delete stale index
+    // Each version only appends fields, so an older record is a prefix of
+    // the current one
+    CatalogHeader header;
+    bool readHeader = catFile.read((uint8_t*)&header, sizeof(header)) == sizeof(header);
+    bool legacy = readHeader && ((header.version == 1 && header.recordSize == CATALOG_RECORD_V1_SIZE) ||
+                                 (header.version == 2 && header.recordSize == CATALOG_RECORD_V2_SIZE) ||
+                                 (header.version == 3 && header.recordSize == CATALOG_RECORD_V3_SIZE) ||
+                                 (header.version == 4 && header.recordSize == CATALOG_RECORD_V4_SIZE));
+    if (!readHeader || header.magic != CATALOG_MAGIC ||
+        (!legacy && (header.version != CATALOG_VERSION || header.recordSize != sizeof(CatalogRecord)))) {
+        Serial.println("  Catalog unreadable - starting a new one");
+        catFile.close();
         return false;
     }
     
-    // Read page positions
-    cache.filename = filename;
-    cache.fileSize = savedFileSize;
-    cache.fullyIndexed = (fullyIndexed == 1);
-    cache.lastReadPage = lastReadPage;
-    cache.pagePositions.clear();
+    // Every record in one sequential read
+    catalog.resize(header.recordCount);
+    size_t bytes = header.recordCount * header.recordSize;
+    std::vector<uint8_t> raw(bytes);
+    if (bytes > 0 && catFile.read(raw.data(), bytes) != bytes) {
+        Serial.println("  Catalog truncated - starting a new one");
+        catalog.clear();
+        catFile.close();
+        return false;
+    }
+    catFile.close();
     
-    for (unsigned long i = 0; i < pageCount; i++) {
-        long pos = 0;
-        idxFile.read((uint8_t*)&pos, 4);
-        cache.pagePositions.push_back(pos);
+    // v1 indexes were all built with the fixed 38x25 layout and kept only
+    // the page; later fields start out unknown
+    for (uint32_t i = 0; i < header.recordCount; i++) {
+        memcpy(&catalog[i], &raw[i * header.recordSize], header.recordSize);
+        if (header.recordSize <= offsetof(CatalogRecord, layout)) {
+            catalog[i].layout = LAYOUT_LEGACY;
+            catalog[i].readOffset = READ_OFFSET_UNKNOWN;
+        }
+        if (header.recordSize <= offsetof(CatalogRecord, contentHash)) {
+            catalog[i].contentHash = 0;
+        }
+        if (header.recordSize <= offsetof(CatalogRecord, readSequence)) {
+            catalog[i].readSequence = 0;
+        }
+        if (header.recordSize <= offsetof(CatalogRecord, outlineLength)) {
+            catalog[i].outlineLength = 0;
+        }
     }
     
-    idxFile.close();
+    catalogHeader = header;
+    if (legacy) {
+        catalogHeader.version = CATALOG_VERSION;
+        catalogHeader.recordSize = sizeof(CatalogRecord);
+        saveCatalog();
+        Serial.printf("  Catalog upgraded to v%d\n", CATALOG_VERSION);
+    }
     return true;
 }
 
-// Save index to SD card - Updated for v2 format with lastReadPage
-bool saveIndexToSD(const String& filename, const std::vector<long>& pagePositions, unsigned long fileSize, bool fullyIndexed, int lastReadPage) {
-    // Create indexes folder if it doesn't exist
-    if (!SD.exists("/.indexes")) {
-        SD.mkdir("/.indexes");
+// Rewrite the whole catalog file from RAM. The old one stays until the new
+// one is complete.
+bool saveCatalog() {
+    if (!SD.exists(INDEX_FOLDER)) {
+        SD.mkdir(INDEX_FOLDER);
     }
     
-    String idxPath = getIndexFilename(filename);
-    
-    // Remove old index if exists
-    if (SD.exists(idxPath.c_str())) {
-        SD.remove(idxPath.c_str());
+    if (!writeCatalogFile(CATALOG_TMP_PATH)) {
+        Serial.println("  Failed to write catalog");
+        SD.remove(CATALOG_TMP_PATH);
+        return false;
     }
-    
-    File idxFile = SD.open(idxPath.c_str(), FILE_WRITE);
-    if (!idxFile) {
-        Serial.printf("  Failed to create index file: %s\n", idxPath.c_str());
+    finishCatalogSwap();  // If this stops short, the next boot finishes it
+    return true;
+}
+
+bool writeCatalogFile(const char* path) {
+    File catFile = SD.open(path, FILE_WRITE);
+    if (!catFile) {
         return false;
     }
     
-    // Write header - v2 format
-    uint8_t version = INDEX_VERSION;
-    unsigned long pageCount = pagePositions.size();
-    uint8_t fullyFlag = fullyIndexed ? 1 : 0;
+    catalogHeader.recordCount = catalog.size();
+    size_t recordBytes = catalog.size() * sizeof(CatalogRecord);
+    bool ok = catFile.write((uint8_t*)&catalogHeader, sizeof(catalogHeader)) == sizeof(catalogHeader);
+    if (ok && recordBytes > 0) {
+        ok = catFile.write((uint8_t*)catalog.data(), recordBytes) == recordBytes;
+    }
+    catFile.close();
+    return ok;
+}
+
+// Whether a catalog file holds its header and every record it announces
+bool catalogFileComplete(const char* path) {
+    File catFile = SD.open(path, FILE_READ);
+    if (!catFile) {
+        return false;
+    }
+    CatalogHeader header;
+    bool ok = catFile.read((uint8_t*)&header, sizeof(header)) == sizeof(header) && header.magic == CATALOG_MAGIC &&
+              catFile.size() == sizeof(header) + (size_t)header.recordCount * header.recordSize;
+    catFile.close();
+    return ok;
+}
+
+// Move a finished rewrite into place. CATALOG_TMP_PATH is only ever written
+// after the CATALOG_BLOB_TMP_PATH that goes with it has been closed, so once
+// it is complete both are, and the swap can be finished from any point it
+// stopped at. Anything less is dropped, leaving the old files as they were.
+bool finishCatalogSwap() {
+    bool haveCatalog = SD.exists(CATALOG_TMP_PATH);
+    bool haveBlob = SD.exists(CATALOG_BLOB_TMP_PATH);
+    if (!haveCatalog || !catalogFileComplete(CATALOG_TMP_PATH)) {
+        if (haveCatalog) SD.remove(CATALOG_TMP_PATH);
+        if (haveBlob) SD.remove(CATALOG_BLOB_TMP_PATH);
+        return false;
+    }
     
-    idxFile.write(&version, 1);
-    idxFile.write((uint8_t*)&fileSize, 4);
-    idxFile.write((uint8_t*)&pageCount, 4);
-    idxFile.write(&fullyFlag, 1);
-    idxFile.write((uint8_t*)&lastReadPage, 4);
+    // FAT can't rename over a file, hence the removes
+    if (haveBlob) {
+        if (SD.exists(CATALOG_BLOB_PATH)) SD.remove(CATALOG_BLOB_PATH);
+        SD.rename(CATALOG_BLOB_TMP_PATH, CATALOG_BLOB_PATH);
+    }
+    if (SD.exists(CATALOG_PATH)) SD.remove(CATALOG_PATH);
+    return SD.rename(CATALOG_TMP_PATH, CATALOG_PATH);
+}
+
+// Write back a single record (and the header, in case it was appended)
+bool writeCatalogRecord(int slot) {
+    if (!SD.exists(CATALOG_PATH)) {
+        return saveCatalog();
+    }
     
-    // Write page positions
-    for (unsigned long i = 0; i < pageCount; i++) {
-        long pos = pagePositions[i];
-        idxFile.write((uint8_t*)&pos, 4);
+    File catFile = SD.open(CATALOG_PATH, "r+");
+    if (!catFile) {
+        return saveCatalog();
     }
     
-    idxFile.close();
+    catalogHeader.recordCount = catalog.size();
+    catFile.write((uint8_t*)&catalogHeader, sizeof(catalogHeader));
+    catFile.seek(sizeof(CatalogHeader) + slot * sizeof(CatalogRecord));
+    catFile.write((uint8_t*)&catalog[slot], sizeof(CatalogRecord));
+    catFile.close();
     return true;
 }
 
-// Save only the reading position without rewriting entire index
-bool saveReadingPosition(const String& filename, int page) {
-    String idxPath = getIndexFilename(filename);
+// Drop records for books no longer in BOOKS_FOLDER (or changed since they
+// were indexed) and squeeze dead position arrays out of the blob
+void compactCatalog(const std::vector<bool>& keep) {
+    unsigned long startTime = millis();
+    std::vector<CatalogRecord> compacted;
+    uint32_t newBlobSize = 0;
+    
+    File oldBlob = SD.open(CATALOG_BLOB_PATH, FILE_READ);
+    File newBlob = SD.open(CATALOG_BLOB_TMP_PATH, FILE_WRITE);
+    if (!newBlob) {
+        Serial.println("  Compaction failed - cannot create blob");
+        if (oldBlob) oldBlob.close();
+        return;
+    }
+    
+    uint8_t copyBuf[512];
+    bool written = true;
+    for (int i = 0; i < catalog.size() && written; i++) {
+        if (!keep[i]) {
+            continue;
+        }
+        CatalogRecord rec = catalog[i];
+        if (!oldBlob || !oldBlob.seek(rec.blobOffset)) {
+            continue;  // Positions lost - rebuild this book later
+        }
+        uint32_t remaining = rec.blobLength;
+        rec.blobOffset = newBlobSize;
+        while (remaining > 0) {
+            int chunk = oldBlob.read(copyBuf, min(remaining, (uint32_t)sizeof(copyBuf)));
+            if (chunk <= 0) break;
+            if (newBlob.write(copyBuf, chunk) != chunk) {
+                written = false;
+                break;
+            }
+            remaining -= chunk;
+        }
+        if (remaining > 0) {
+            continue;  // Source blob damaged - rebuild this book later
+        }
+        newBlobSize += rec.blobLength;
+        compacted.push_back(rec);
+    }
+    
+    if (oldBlob) oldBlob.close();
+    newBlob.close();
+    if (!written) {
+        Serial.println("  Compaction failed - cannot write blob");
+        SD.remove(CATALOG_BLOB_TMP_PATH);
+        return;
+    }
+    
+    // The new blob only replaces the old one along with the records that
+    // point into it - if they can't be written, both stay as they were
+    uint32_t oldBlobSize = catalogHeader.blobSize;
+    catalog.swap(compacted);
+    catalogHeader.blobSize = newBlobSize;
+    if (!saveCatalog()) {
+        catalog.swap(compacted);
+        catalogHeader.blobSize = oldBlobSize;
+        SD.remove(CATALOG_BLOB_TMP_PATH);
+        return;
+    }
+    
+    Serial.printf("  Catalog compacted: %u -> %u records, blob %lu -> %lu bytes (%lu ms)\n",
+                  (unsigned)compacted.size(), (unsigned)catalog.size(), (unsigned long)oldBlobSize,
+                  (unsigned long)newBlobSize, millis() - startTime);
+}
+
+// Read a pre-catalog per-book .idx file (v3 or the unversioned layout)
+bool loadLegacyIndex(const char* filename, FileCache& cache, std::vector<long>& pagePositions) {
+    char idxPath[BOOK_PATH_MAX];
+    getIndexFilename(idxPath, filename);
     
-    // Open for read+write
-    File idxFile = SD.open(idxPath.c_str(), "r+");
+    File idxFile = SD.open(idxPath, FILE_READ);
     if (!idxFile) {
-        Serial.printf("  Cannot update position - no index file for %s\n", filename.c_str());
-        return false;
+        return false;  // No index file exists
     }
     
-    // Check version
-    uint8_t version = 0;
-    idxFile.read(&version, 1);
+    // Read header: version (1 byte) + filesize (4 bytes) + page count (4 bytes) + 
+    //              fully indexed flag (1 byte) + lastReadPage (4 bytes)
+    uint8_t indexVersion = 0;
+    unsigned long savedFileSize = 0;
+    unsigned long pageCount = 0;
+    uint8_t fullyIndexed = 0;
+    int lastReadPage = 0;
+    
+    idxFile.read(&indexVersion, 1);
+    
+    // Handle old format (no version byte) - first byte would be part of fileSize.
+    // v3 was the last per-book layout before the catalog.
+    if (indexVersion != 3) {
+        // Old format - seek back and read old way
+        idxFile.seek(0);
+        idxFile.read((uint8_t*)&savedFileSize, 4);
+        idxFile.read((uint8_t*)&pageCount, 4);
+        idxFile.read(&fullyIndexed, 1);
+        lastReadPage = 0;  // No saved position in old format
+    } else {
+        // v3 format
+        idxFile.read((uint8_t*)&savedFileSize, 4);
+        idxFile.read((uint8_t*)&pageCount, 4);
+        idxFile.read(&fullyIndexed, 1);
+        idxFile.read((uint8_t*)&lastReadPage, 4);
+    }
     
-    if (version != INDEX_VERSION) {
-        // Old format - need to do full rewrite
+    // Verify file size matches the directory scan (if file changed, index is invalid)
+    if (savedFileSize != cache.fileSize) {
+        Serial.printf("  Index stale for %s (size changed)\n", filename);
         idxFile.close();
-        
-        // Find cache entry and do full save
-        for (int i = 0; i < fileCache.size(); i++) {
-            if (fileCache[i].filename == filename) {
-                fileCache[i].lastReadPage = page;
-                return saveIndexToSD(filename, fileCache[i].pagePositions, 
-                                    fileCache[i].fileSize, fileCache[i].fullyIndexed, page);
-            }
-        }
         return false;
     }
     
-    // v2 format - seek to lastReadPage position and update
-    // Header: version(1) + fileSize(4) + pageCount(4) + fullyIndexed(1) + lastReadPage(4)
-    idxFile.seek(1 + 4 + 4 + 1);  // Seek to lastReadPage offset
-    idxFile.write((uint8_t*)&page, 4);
+    cache.pageCount = pageCount;
+    cache.fullyIndexed = (fullyIndexed == 1);
+    cache.lastReadPage = lastReadPage;
+    
+    bool ok = readPositionsBlock(idxFile, pagePositions, pageCount);
     idxFile.close();
+    return ok;
+}
+
+// One-time move of per-book .idx files into the catalog
+void migrateLegacyIndexes() {
+    if (!SD.exists(INDEX_FOLDER)) {
+        return;
+    }
+    
+    int migrated = 0;
+    std::vector<long> positions;
+    for (int i = 0; i < fileCount; i++) {
+        FileCache& cache = fileCache[i];
+        char idxPath[BOOK_PATH_MAX];
+        getIndexFilename(idxPath, cache.filename);
+        if (cache.hasIndex || !SD.exists(idxPath)) {
+            continue;
+        }
+        if (loadLegacyIndex(cache.filename, cache, positions) && positions.size() > 0) {
+            cache.layout = LAYOUT_LEGACY;
+            cache.readOffset = cache.lastReadPage < positions.size() ? positions[cache.lastReadPage] : READ_OFFSET_UNKNOWN;
+            PageTable* pages = pageTableCreate(1);
+            pageTableAppend(pages, positions.data(), positions.size(), nullptr);
+            saveIndexToSD(cache.filename, pages, cache.fileSize, cache.fullyIndexed, LAYOUT_LEGACY);
+            pageTableRelease(pages);
+            cache.hasIndex = true;
+            migrated++;
+        }
+        SD.remove(idxPath);
+    }
+    
+    // Write the catalog even if empty so migration only ever runs once
+    if (!SD.exists(CATALOG_PATH)) {
+        saveCatalog();
+    }
     
-    Serial.printf("  Saved reading position: page %d for %s\n", page + 1, filename.c_str());
+    if (migrated > 0) {
+        Serial.printf("  Migrated %d legacy index files into the catalog\n", migrated);
+    }
+}
+
+// Read pageCount positions in one SD transaction, sized up front so the
+// vector never reallocates. Large arrays land in PSRAM via the malloc
+// threshold when BOARD_HAS_PSRAM is set.
+bool readPositionsBlock(File& file, std::vector<long>& pagePositions, uint32_t pageCount) {
+    pagePositions.clear();
+    pagePositions.resize(pageCount);
+    
+    size_t bytes = pageCount * sizeof(long);
+    if (bytes > 0 && file.read((uint8_t*)pagePositions.data(), bytes) != bytes) {
+        pagePositions.clear();
+        return false;
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// v4 position encoding. Consecutive pages are ~900-2000 bytes apart, so each
+// position is stored as a LEB128 varint delta (2 bytes instead of 4). Every
+// INDEX_CHECKPOINT_INTERVAL pages an absolute checkpoint lets any page be
+// decoded without walking the whole stream:
+//
+//   uint32 pageCount
+//   uint32 checkpointCount
+//   { uint32 position, uint32 deltaOffset } x checkpointCount
+//   varint deltas for every page that is not a checkpoint
+//
+// Positions never decrease, so deltas are unsigned.
+// ----------------------------------------------------------------------------
+
+bool isSupportedIndexVersion(uint8_t version) {
+    return version == INDEX_VERSION || version == INDEX_VERSION_RAW;
+}
+
+void appendU32(std::vector<uint8_t>& out, uint32_t value) {
+    const uint8_t* bytes = (const uint8_t*)&value;
+    out.insert(out.end(), bytes, bytes + 4);
+}
+
+uint32_t readU32(const uint8_t* data) {
+    uint32_t value;
+    memcpy(&value, data, 4);
+    return value;
+}
+
+void appendVarint(std::vector<uint8_t>& out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+// Decode the varint at data[offset], advancing offset past it
+bool readVarint(const uint8_t* data, size_t len, size_t& offset, uint32_t& value) {
+    value = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+        if (offset >= len || shift > 28) {
+            return false;
+        }
+        byte = data[offset++];
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
     return true;
 }
 
-void preIndexFiles() {
-    Serial.println("Loading/building file indexes...");
-    fileCache.clear();
+void encodePagePositions(const std::vector<long>& pagePositions, std::vector<uint8_t>& out) {
+    uint32_t pageCount = pagePositions.size();
+    uint32_t checkpointCount = (pageCount + INDEX_CHECKPOINT_INTERVAL - 1) / INDEX_CHECKPOINT_INTERVAL;
+    size_t tableSize = 8 + checkpointCount * 8;
     
-    for (int f = 0; f < fileList.size(); f++) {
-        FileCache cache;
-        
-        // Try to load existing index from SD
-        if (loadIndexFromSD(fileList[f], cache)) {
-            Serial.printf("  %s: loaded %d pages from cache%s (resume: pg %d)\n", 
-                          fileList[f].c_str(), 
-                          cache.pagePositions.size(),
-                          cache.fullyIndexed ? " (complete)" : "",
-                          cache.lastReadPage + 1);
-            fileCache.push_back(cache);
+    out.clear();
+    out.reserve(tableSize + pageCount * 2 + 16);
+    appendU32(out, pageCount);
+    appendU32(out, checkpointCount);
+    out.resize(tableSize);  // Checkpoint table is filled in as the stream is written
+    
+    for (uint32_t i = 0; i < pageCount; i++) {
+        if (i % INDEX_CHECKPOINT_INTERVAL == 0) {
+            uint32_t entry = 8 + (i / INDEX_CHECKPOINT_INTERVAL) * 8;
+            uint32_t position = pagePositions[i];
+            uint32_t deltaOffset = out.size() - tableSize;
+            memcpy(&out[entry], &position, 4);
+            memcpy(&out[entry + 4], &deltaOffset, 4);
             continue;
         }
         
-        // No cached index - build it
-        Serial.printf("  %s: building index...\n", fileList[f].c_str());
-        
-        String fullPath = String(BOOKS_FOLDER) + "/" + fileList[f];
-        File file = SD.open(fullPath.c_str(), FILE_READ);
-        
-        if (!file) {
-            Serial.printf("    Skip: cannot open\n");
-            continue;
+        appendVarint(out, (uint32_t)(pagePositions[i] - pagePositions[i - 1]));
+    }
+}
+
+// Decode count positions starting at firstPage. Only the checkpoint group
+// containing firstPage has to be walked to find the starting point.
+bool decodePagePositions(const uint8_t* data, size_t len, uint32_t firstPage, uint32_t count, long* out) {
+    if (len < 8) {
+        return false;
+    }
+    uint32_t pageCount = readU32(data);
+    uint32_t checkpointCount = readU32(data + 4);
+    size_t tableSize = 8 + (size_t)checkpointCount * 8;
+    if (tableSize > len || firstPage + count > pageCount ||
+        checkpointCount != (pageCount + INDEX_CHECKPOINT_INTERVAL - 1) / INDEX_CHECKPOINT_INTERVAL) {
+        return false;
+    }
+    if (count == 0) {
+        return true;
+    }
+    
+    uint32_t page = firstPage - firstPage % INDEX_CHECKPOINT_INTERVAL;
+    uint32_t lastPage = firstPage + count - 1;
+    long pos = 0;
+    size_t offset = 0;
+    
+    for (; page <= lastPage; page++) {
+        if (page % INDEX_CHECKPOINT_INTERVAL == 0) {
+            const uint8_t* entry = data + 8 + (page / INDEX_CHECKPOINT_INTERVAL) * 8;
+            pos = readU32(entry);
+            offset = tableSize + readU32(entry + 4);
+        } else {
+            uint32_t delta;
+            if (!readVarint(data, len, offset, delta)) {
+                return false;
+            }
+            pos += delta;
         }
         
-        cache.filename = fileList[f];
-        cache.fileSize = file.size();
+        if (page >= firstPage) {
+            out[page - firstPage] = pos;
+        }
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// Outline encoding (catalog v5), stored right after the positions in the
+// book's blob region:
+//
+//   uint32 chapterCount
+//   { uint32 offset, uint8 titleLength, title bytes } x chapterCount
+//   uint32 openWords
+//   uint32 wordCount
+//   varint words for each page table entry
+// ----------------------------------------------------------------------------
+
+// Caller holds the table lock
+void encodeOutline(const PageTable* table, std::vector<uint8_t>& out) {
+    out.clear();
+    appendU32(out, table->chapters.size());
+    for (const Chapter& chapter : table->chapters) {
+        uint8_t titleLength = strlen(chapter.title);
+        appendU32(out, chapter.offset);
+        out.push_back(titleLength);
+        out.insert(out.end(), chapter.title, chapter.title + titleLength);
+    }
+    appendU32(out, table->openWords);
+    appendU32(out, table->words.size());
+    for (uint16_t words : table->words) {
+        appendVarint(out, words);
+    }
+}
+
+// Replace the table's outline with a decoded one. The word counts have to
+// cover every entry but the last, or all of them once the book is complete.
+bool decodeOutline(const uint8_t* data, size_t len, PageTable* table, bool complete) {
+    std::vector<Chapter> chapters;
+    std::vector<uint16_t> words;
+    size_t offset = 4;
+    if (len < 4) {
+        return false;
+    }
+    
+    uint32_t chapterCount = readU32(data);
+    if (chapterCount > OUTLINE_MAX_CHAPTERS) {
+        return false;
+    }
+    chapters.resize(chapterCount);
+    for (Chapter& chapter : chapters) {
+        if (offset + 5 > len) {
+            return false;
+        }
+        chapter.offset = readU32(data + offset);
+        uint8_t titleLength = data[offset + 4];
+        offset += 5;
+        if (titleLength > CHAPTER_TITLE_CHARS || offset + titleLength > len) {
+            return false;
+        }
+        memcpy(chapter.title, data + offset, titleLength);
+        chapter.title[titleLength] = '\0';
+        offset += titleLength;
+    }
+    
+    if (offset + 8 > len) {
+        return false;
+    }
+    uint32_t openWords = readU32(data + offset);
+    uint32_t wordCount = readU32(data + offset + 4);
+    offset += 8;
+    words.resize(min(wordCount, (uint32_t)(len - offset)));  // Each takes at least a byte
+    if (words.size() != wordCount) {
+        return false;
+    }
+    for (uint32_t i = 0; i < wordCount; i++) {
+        uint32_t value;
+        if (!readVarint(data, len, offset, value)) {
+            return false;
+        }
+        words[i] = value;
+    }
+    
+    xSemaphoreTake(table->lock, portMAX_DELAY);
+    bool ok = wordCount + (complete ? 0 : 1) == table->entryCount;
+    if (ok) {
+        table->hasOutline = true;
+        table->chapters.swap(chapters);
+        table->words.swap(words);
+        table->openWords = openWords;
+    }
+    xSemaphoreGive(table->lock);
+    return ok;
+}
+
+// Load page positions for a book from the catalog blob.
+// Fills the summary in cache; page positions are only read into pages
+// when it is non-null.
+bool loadIndexFromSD(const char* filename, FileCache& cache, PageTable* pages) {
+    lockSpiBus();
+    
+    int slot = cache.catalogSlot;
+    if (slot < 0 || slot >= catalog.size()) {
+        unlockSpiBus();
+        return false;
+    }
+    
+    const CatalogRecord& rec = catalog[slot];
+    if (!catalogRecordCurrent(rec, cache)) {
+        unlockSpiBus();
+        return false;  // Book changed since it was indexed
+    }
+    
+    // The resume point is kept across layout changes, the positions are not
+    cache.lastReadPage = rec.lastReadPage;
+    cache.readOffset = rec.readOffset;
+    cache.layout = rec.layout;
+    cache.readSequence = rec.readSequence;
+    // Indexes from before the outline still load; the reader indexer
+    // rebuilds the outline behind them (rebuildReaderOutline)
+    if (rec.layout != layoutFingerprint()) {
+        cache.pageCount = 0;
+        cache.hasIndex = false;
         cache.fullyIndexed = false;
-        cache.lastReadPage = 0;  // Start at beginning for new files
-        cache.pagePositions.push_back(0);  // First page always at 0
-        
-        // Index using word-wrap aware logic (matches display rendering)
-        int pagesAdded = indexPagesWordWrap(file, 0, cache.pagePositions, PREINDEX_PAGES - 1);
-        int pageCount = 1 + pagesAdded;
+        unlockSpiBus();
+        return false;
+    }
+    
+    cache.pageCount = rec.pageCount;
+    cache.hasIndex = true;
+    cache.fullyIndexed = (rec.fullyIndexed == 1);
+    
+    if (pages == nullptr) {
+        unlockSpiBus();
+        return true;
+    }
+    
+    File blob = SD.open(CATALOG_BLOB_PATH, FILE_READ);
+    if (!blob || !blob.seek(rec.blobOffset)) {
+        if (blob) blob.close();
+        unlockSpiBus();
+        return false;
+    }
+    
+    // Read page positions
+    unsigned long startTime = micros();
+    uint8_t stride = rec.stride > 0 ? rec.stride : 1;
+    uint32_t storedCount = pageTableStoredEntries(rec.pageCount, stride);
+    std::vector<long> stored;
+    std::vector<uint8_t> encoded;
+    uint32_t positionsLength = 0;
+    bool ok;
+    if (rec.indexVersion == INDEX_VERSION_RAW) {
+        ok = readPositionsBlock(blob, stored, storedCount);  // Never has an outline
+    } else {
+        // Whole encoded region in one read, then decode in RAM
+        encoded.resize(rec.blobLength);
+        positionsLength = rec.blobLength - min(rec.outlineLength, rec.blobLength);
+        ok = blob.read(encoded.data(), rec.blobLength) == rec.blobLength;
+        stored.resize(storedCount);
+        ok = ok && decodePagePositions(encoded.data(), positionsLength, 0, storedCount, stored.data());
+    }
+    blob.close();
+    unlockSpiBus();
+    
+    ok = ok && pageTableRestore(pages, stored.data(), storedCount, rec.pageCount, stride) &&
+         (rec.outlineLength == 0 ||
+          decodeOutline(encoded.data() + positionsLength, encoded.size() - positionsLength, pages, cache.fullyIndexed));
+    if (!ok) {
+        pageTableClear(pages, 1);
+    }
+    
+    Serial.printf("  Index load: %s %lu pages (%lu bytes) in %lu us\n", filename,
+                  (unsigned long)rec.pageCount, (unsigned long)rec.blobLength, micros() - startTime);
+    return ok;
+}
+
+// Save a book's page positions into the blob and update its catalog record.
+// The positions are always appended, and the record only points at them
+// once they are written, so the old copy is intact until then. Compaction
+// reclaims it later.
+// The resume point is copied from the book's FileCache entry. layout is the
+// fingerprint the positions were computed with, which is not always the
+// current one (migrated legacy indexes).
+bool saveIndexToSD(const char* filename, PageTable* pages, unsigned long fileSize, bool fullyIndexed, uint32_t layout) {
+    // Copy out under the table lock - the indexer may still be appending
+    std::vector<long> stored;
+    std::vector<uint8_t> outline;
+    uint32_t pageCount;
+    uint8_t stride;
+    pageTableSnapshot(pages, stored, pageCount, stride, outline);
+    
+    lockSpiBus();
+    
+    // Create indexes folder if it doesn't exist
+    if (!SD.exists(INDEX_FOLDER)) {
+        SD.mkdir(INDEX_FOLDER);
+    }
+    
+    FileCache* cache = findFileCache(filename);
+    uint32_t nameHash = hashFilename(filename);
+    int slot = cache != nullptr ? cache->catalogSlot : findCatalogRecord(nameHash);
+    
+    uint32_t offset = catalogHeader.blobSize;
+    
+    if (!SD.exists(CATALOG_BLOB_PATH)) {
+        File created = SD.open(CATALOG_BLOB_PATH, FILE_WRITE);
+        if (created) created.close();
+    }
+    File blob = SD.open(CATALOG_BLOB_PATH, "r+");
+    if (!blob) {
+        Serial.printf("  Failed to open index blob for %s\n", filename);
+        unlockSpiBus();
+        return false;
+    }
+    blob.seek(offset);
+    
+    // Write page positions, with the outline behind them
+    unsigned long startTime = micros();
+    std::vector<uint8_t> encoded;
+    encodePagePositions(stored, encoded);
+    encoded.insert(encoded.end(), outline.begin(), outline.end());
+    bool written = blob.write(encoded.data(), encoded.size()) == encoded.size();
+    blob.close();
+    
+    Serial.printf("  Index save: %s %lu pages (%u bytes, raw %lu, outline %u) in %lu us\n", filename,
+                  (unsigned long)pageCount, (unsigned)encoded.size(), (unsigned long)stored.size() * 4, (unsigned)outline.size(),
+                  micros() - startTime);
+    
+    if (!written) {
+        Serial.printf("  Failed to write index for %s\n", filename);
+        unlockSpiBus();
+        return false;
+    }
+    
+    if (slot < 0) {
+        slot = catalog.size();
+        catalog.push_back(CatalogRecord());
+    }
+    
+    // Carry the resume point over. A page number saved under another layout
+    // means nothing for the new positions, so only the offset survives that.
+    CatalogRecord& rec = catalog[slot];
+    bool known = rec.nameHash == nameHash;
+    int32_t lastReadPage = known && rec.layout == layout ? rec.lastReadPage : 0;
+    int32_t readOffset = known ? rec.readOffset : 0;
+    uint32_t readSequence = known ? rec.readSequence : 0;
+    if (cache != nullptr) {
+        lastReadPage = cache->layout == layout ? cache->lastReadPage : 0;
+        readOffset = cache->readOffset;
+        readSequence = cache->readSequence;
+        cache->lastReadPage = lastReadPage;
+    }
+    
+    memset(&rec, 0, sizeof(rec));
+    rec.nameHash = nameHash;
+    rec.fileSize = fileSize;
+    rec.mtime = cache != nullptr ? cache->mtime : 0;
+    rec.pageCount = pageCount;
+    rec.lastReadPage = lastReadPage;
+    rec.blobOffset = offset;
+    rec.blobLength = encoded.size();
+    rec.fullyIndexed = fullyIndexed ? 1 : 0;
+    rec.indexVersion = INDEX_VERSION;
+    rec.stride = stride;
+    rec.layout = layout;
+    rec.readOffset = readOffset;
+    rec.contentHash = cache != nullptr ? cache->contentHash : 0;
+    rec.readSequence = readSequence;
+    rec.outlineLength = outline.size();
+    
+    catalogHeader.blobSize = max(catalogHeader.blobSize, offset + rec.blobLength);
+    bool ok = writeCatalogRecord(slot);
+    
+    if (cache != nullptr) {
+        cache->catalogSlot = slot;
+        cache->layout = rec.layout;
+    }
+    
+    unlockSpiBus();
+    return ok;
+}
+
+// Save only the reading position - one fixed-size record rewrite
+bool saveReadingPosition(const char* filename, int page, long offset) {
+    lockSpiBus();
+    
+    FileCache* cache = findFileCache(filename);
+    int slot = cache != nullptr ? cache->catalogSlot : -1;
+    if (slot < 0 || slot >= catalog.size()) {
+        Serial.printf("  Cannot update position - no catalog record for %s\n", filename);
+        unlockSpiBus();
+        return false;
+    }
+    
+    catalog[slot].lastReadPage = page;
+    catalog[slot].readOffset = offset;
+    catalog[slot].readSequence = cache->readSequence;
+    bool ok = writeCatalogRecord(slot);
+    unlockSpiBus();
+    
+    LOG_VERBOSE("  Saved reading position: page %d (offset %ld) for %s\n", page + 1, offset, filename);
+    return ok;
+}
+
+// Match the directory scan against the catalog so the file list can show
+// resume markers. Books without a valid record are left for the background
+// indexer. Stale and orphaned records are compacted away.
+void loadIndexSummaries() {
+    Serial.println("Loading library catalog...");
+    unsigned long startTime = millis();
+    
+    lockSpiBus();
+    bool haveCatalog = loadCatalog();
+    
+    // A record is kept if its book is still here and unchanged
+    std::vector<bool> keep(catalog.size(), false);
+    int kept = 0;
+    int fingerprinted = 0;
+    for (int f = 0; f < fileCount; f++) {
+        int slot = findCatalogRecord(hashFilename(fileCache[f].filename));
         
-        // Check if we indexed the whole file
-        if (!file.available()) {
-            cache.fullyIndexed = true;
+#ifdef INDEX_CONTENT_FINGERPRINT
+        bool checkContent = true;
+#else
+        bool checkContent = fileCache[f].mtime == 0;  // Card written without timestamps
+#endif
+        if (checkContent && slot >= 0 && catalog[slot].contentHash != 0) {
+            char fullPath[BOOK_PATH_MAX];
+            bookPath(fullPath, fileCache[f].filename);
+            BookFile book = openBookFile(fullPath);
+            if (book) {
+                fileCache[f].contentHash = contentFingerprint(book.stored());
+                book.close();
+                fingerprinted++;
+            }
         }
         
-        file.close();
-        
-        // Save the partial index to SD for next time
-        saveIndexToSD(cache.filename, cache.pagePositions, cache.fileSize, cache.fullyIndexed, 0);
-        
-        fileCache.push_back(cache);
+        if (slot >= 0 && catalogRecordCurrent(catalog[slot], fileCache[f])) {
+            keep[slot] = true;
+            kept++;
+        } else if (slot >= 0) {
+            Serial.printf("  Index stale for %s (file changed)\n", fileCache[f].filename);
+        }
+    }
+    
+    uint32_t liveBytes = 0;
+    for (int i = 0; i < catalog.size(); i++) {
+        if (keep[i]) liveBytes += catalog[i].blobLength;
+    }
+    if (kept < catalog.size() || catalogHeader.blobSize > 2 * liveBytes + CATALOG_COMPACT_SLACK) {
+        compactCatalog(keep);
+    }
+    
+    for (int f = 0; f < fileCount; f++) {
+        FileCache& cache = fileCache[f];
+        cache.catalogSlot = findCatalogRecord(hashFilename(cache.filename));
         
-        Serial.printf("    %d pages indexed%s (saved to SD)\n", 
-                      pageCount,
-                      cache.fullyIndexed ? " - complete" : "");
+        if (loadIndexFromSD(cache.filename, cache, nullptr)) {
+            LOG_VERBOSE("  %s: %d pages%s (resume: pg %d)\n", 
+                        cache.filename, 
+                        cache.pageCount,
+                        cache.fullyIndexed ? " (complete)" : "",
+                        cache.lastReadPage + 1);
+        } else if (cache.catalogSlot >= 0 && cache.layout != layoutFingerprint()) {
+            LOG_VERBOSE("  %s: layout changed - re-paginating (resume at offset %ld)\n",
+                        cache.filename, cache.readOffset);
+        } else {
+            LOG_VERBOSE("  %s: not indexed yet\n", cache.filename);
+        }
+        lastReadSequence = max(lastReadSequence, cache.readSequence);
     }
     
-    Serial.println("Index loading complete!");
+    if (!haveCatalog) {
+        migrateLegacyIndexes();
+    }
+    replayPositionJournal();  // Positions from a session that never closed its book
+    unlockSpiBus();
+    
+    Serial.printf("Library catalog loaded: %u records, %d fingerprinted (%lu ms)\n", (unsigned)catalog.size(),
+                  fingerprinted, millis() - startTime);
+}
+
+FileCache* findFileCache(const char* filename) {
+    size_t length = strlen(filename);
+    for (int i = 0; i < fileCount; i++) {
+        if (nameLength(fileCache[i].filename) == length && memcmp(fileCache[i].filename, filename, length) == 0) {
+            return &fileCache[i];
+        }
+    }
+    return nullptr;
 }
 
 void displayFileList() {
-    Serial.printf("Displaying file list, selectedFileIndex=%d\n", selectedFileIndex);
+    if (!library.loaded) {
+        loadLibrary();  // Resumed straight into a book
+    }
+    drawFileList(false);
+}
+
+// Draw the window of LIBRARY_VISIBLE_ROWS rows holding the selection. Only
+// that window is ever touched, however large the library is.
+void drawFileList(bool partialRefresh) {
+    LOG_VERBOSE("Displaying file list, selectedFileIndex=%d\n", selectedFileIndex);
     
-    // Deselect SD card to free SPI bus for display
-    digitalWrite(SD_CS, HIGH);
+    int count = library.order.size();
+    library.top = selectedFileIndex / LIBRARY_VISIBLE_ROWS * LIBRARY_VISIBLE_ROWS;
     
-    display.setFullWindow();
-    display.firstPage();
-    do {
-        display.fillScreen(GxEPD_WHITE);
-        display.setTextColor(GxEPD_BLACK);
-        display.setTextSize(1);
+    lockSpiBus();
+    
+    ScreenDrawFn draw = [&](Adafruit_GFX& gfx) {
+        gfx.fillScreen(GxEPD_WHITE);
+        gfx.setTextColor(GxEPD_BLACK);
+        gfx.setTextSize(1);
         
         // Title
-        display.setCursor(10, 5);
-        display.setTextSize(2);
-        display.println("TEXT FILES");
-        display.setTextSize(1);
-        display.drawFastHLine(0, 25, SCREEN_WIDTH, GxEPD_BLACK);
-        
-        if (fileList.size() == 0) {
-            display.setCursor(10, 35);
-            display.println("No .txt files found");
-            display.println();
-            display.println("Add .txt files to the");
-            display.printf("%s folder\n", BOOKS_FOLDER);
-            display.println("on SD card and reset");
+        gfx.setCursor(10, 5);
+        gfx.setTextSize(2);
+        gfx.println("TEXT FILES");
+        gfx.setTextSize(1);
+        gfx.drawFastHLine(0, 25, SCREEN_WIDTH, GxEPD_BLACK);
+        
+        if (count == 0) {
+            gfx.setCursor(10, 35);
+            gfx.println("No .txt files found");
+            gfx.println();
+            gfx.println("Add .txt files to the");
+            gfx.printf("%s folder\n", BOOKS_FOLDER);
+            gfx.println("on SD card and reset");
         } else {
-            int maxVisible = 12;
-            int startIdx = max(0, min(selectedFileIndex - 5, (int)fileList.size() - maxVisible));
-            int endIdx = min((int)fileList.size(), startIdx + maxVisible);
-            
-            int lineHeight = 18;
-            int y = 32;
+            int endIdx = min(count, library.top + LIBRARY_VISIBLE_ROWS);
             
-            Serial.printf("  Drawing files %d to %d, selected=%d\n", startIdx, endIdx-1, selectedFileIndex);
+            LOG_VERBOSE("  Drawing files %d to %d, selected=%d\n", library.top, endIdx - 1, selectedFileIndex);
             
-            for (int i = startIdx; i < endIdx; i++) {
-                bool isSelected = (i == selectedFileIndex);
-                
-                if (isSelected) {
-                    Serial.printf("  -> Drawing SELECTED item %d at y=%d\n", i, y);
-                    display.fillRect(0, y - 2, SCREEN_WIDTH, lineHeight, GxEPD_BLACK);
-                    display.setTextColor(GxEPD_WHITE, GxEPD_BLACK);
-                } else {
-                    display.setTextColor(GxEPD_BLACK, GxEPD_WHITE);
-                }
-                
-                display.setCursor(4, y);
-                display.print(isSelected ? "> " : "  ");
-                
-                String name = fileList[i];
-                
-                // Show resume indicator if there's a saved position
-                String suffix = "";
-                for (int j = 0; j < fileCache.size(); j++) {
-                    if (fileCache[j].filename == name && fileCache[j].lastReadPage > 0) {
-                        suffix = " *";  // Asterisk indicates saved position
-                        break;
-                    }
-                }
-                
-                int maxLen = 34 - suffix.length();
-                if (name.length() > maxLen) {
-                    name = name.substring(0, maxLen - 3) + "...";
-                }
-                display.print(name);
-                display.println(suffix);
-                
-                y += lineHeight;
+            for (int i = library.top; i < endIdx; i++) {
+                drawLibraryRow(gfx, i);
             }
             
-            display.setTextColor(GxEPD_BLACK, GxEPD_WHITE);
+            gfx.setTextColor(GxEPD_BLACK, GxEPD_WHITE);
             
-            display.setCursor(5, SCREEN_HEIGHT - 22);
-            display.printf("%d/%d files", selectedFileIndex + 1, fileList.size());
+            // Nothing here depends on the selection within the window, so a
+            // move between rows only has to refresh those two rows
+            int pageCount = (count + LIBRARY_VISIBLE_ROWS - 1) / LIBRARY_VISIBLE_ROWS;
+            gfx.setCursor(5, SCREEN_HEIGHT - 22);
+            gfx.printf("%d files  pg %d/%d  by %s", count, library.top / LIBRARY_VISIBLE_ROWS + 1, pageCount,
+                       librarySortNames[library.sort]);
             
-            display.drawFastHLine(0, SCREEN_HEIGHT - 12, SCREEN_WIDTH, GxEPD_BLACK);
-            display.setCursor(5, SCREEN_HEIGHT - 8);
-            display.print("ENTER=Open  W/S=Navigate");
+            gfx.drawFastHLine(0, SCREEN_HEIGHT - 12, SCREEN_WIDTH, GxEPD_BLACK);
+            gfx.setCursor(5, SCREEN_HEIGHT - 8);
+            gfx.print("ENT=Open W/S=Move O=Sort");
         }
-    } while (display.nextPage());
+    };
+    
+    if (partialRefresh) {
+        renderScreenPartial(draw, 0, SCREEN_HEIGHT);
+    } else {
+        renderScreen(draw);
+    }
+    library.drawnSelection = selectedFileIndex;
+    
+    unlockSpiBus();
     
-    Serial.println("File list display complete");
+    LOG_VERBOSE("File list display complete\n");
 }
 
-// ============================================================================
-// BOOK READING FUNCTIONS
-// ============================================================================
-
-void openBook(const String& filename) {
-    Serial.printf("Opening: %s\n", filename.c_str());
+// One list row, background included so it can be redrawn in place
+void drawLibraryRow(Adafruit_GFX& gfx, int row) {
+    const FileCache& cache = fileCache[library.order[row]];
+    bool isSelected = (row == selectedFileIndex);
+    int y = LIBRARY_FIRST_ROW_Y + (row - library.top) * LIBRARY_ROW_HEIGHT;
     
-    if (reader.fileOpen) {
-        closeBook();
+    uint16_t background = isSelected ? GxEPD_BLACK : GxEPD_WHITE;
+    uint16_t foreground = isSelected ? GxEPD_WHITE : GxEPD_BLACK;
+    gfx.fillRect(0, y - 2, SCREEN_WIDTH, LIBRARY_ROW_HEIGHT, background);
+    gfx.setTextColor(foreground, background);
+    
+    gfx.setCursor(4, y);
+    gfx.print(isSelected ? "> " : "  ");
+    
+    // Asterisk indicates saved position
+    bool resume = cache.lastReadPage > 0 || cache.readOffset > 0;
+    int maxLen = resume ? 32 : 34;
+    int len = strlen(cache.filename);
+    if (len > maxLen) {
+        gfx.printf("%.*s...", maxLen - 3, cache.filename);
+    } else {
+        gfx.print(cache.filename);
+    }
+    if (resume) {
+        gfx.print(" *");
+    }
+}
+
+// Move the selection, refreshing only the rows that changed while it stays
+// inside the current window
+void moveLibrarySelection(int target) {
+    int previous = library.drawnSelection;
+    selectedFileIndex = target;
+    
+    if (previous < 0 || previous >= library.order.size() ||
+        target / LIBRARY_VISIBLE_ROWS * LIBRARY_VISIBLE_ROWS != library.top) {
+        drawFileList(previous >= 0);
+        return;
+    }
+    
+    int first = min(previous, target) - library.top;
+    int last = max(previous, target) - library.top;
+    int bandY = LIBRARY_FIRST_ROW_Y - 2 + first * LIBRARY_ROW_HEIGHT;
+    int bandHeight = (last - first + 1) * LIBRARY_ROW_HEIGHT;
+    
+    lockSpiBus();
+    renderScreenPartial([&](Adafruit_GFX& gfx) {
+        // Rows in between are unchanged but lie inside the band
+        for (int row = first; row <= last; row++) {
+            drawLibraryRow(gfx, library.top + row);
+        }
+    }, bandY, bandHeight);
+    library.drawnSelection = target;
+    unlockSpiBus();
+}
+
+// ============================================================================
+// POSITION JOURNAL
+// Every page shown is noted, but only written out once JOURNAL_FLUSH_PAGES
+// turns have gone by, the reader has paused for JOURNAL_IDLE_MS, the device
+// is about to sleep, or - with the battery low - on every turn. Flushes run
+// from loop() after the refresh with no key waiting, so page turns don't
+// wait on them. Each one rewrites a 32-byte record in place: the file never
+// grows, so no clusters are allocated, and the writes rotate over
+// JOURNAL_SLOTS records. closeBook() still saves to the catalog; the
+// journal only matters when that never happened.
+// ============================================================================
+
+uint32_t journalCheck(const JournalRecord& rec) {
+    return fnv1a(FNV_OFFSET_BASIS, (const uint8_t*)&rec, offsetof(JournalRecord, check));
+}
+
+// Open the journal for the session, creating it at full size if it is
+// missing or was made with another JOURNAL_SLOTS. Caller holds the bus.
+bool openPositionJournal() {
+    const uint32_t size = JOURNAL_SLOTS * sizeof(JournalRecord);
+    if (journal.file) {
+        return true;
+    }
+    
+    File existing = SD.open(JOURNAL_PATH, FILE_READ);
+    bool sized = existing && existing.size() == size;
+    if (existing) {
+        existing.close();
+    }
+    if (!sized) {
+        File created = SD.open(JOURNAL_PATH, FILE_WRITE);
+        if (!created) {
+            Serial.println("  Failed to create position journal");
+            return false;
+        }
+        uint8_t zeros[512] = {0};
+        for (uint32_t written = 0; written < size; written += sizeof(zeros)) {
+            created.write(zeros, sizeof(zeros));
+        }
+        created.close();
+    }
+    
+    journal.file = SD.open(JOURNAL_PATH, "r+");
+    return journal.file;
+}
+
+// Apply the newest record of each book that is newer than its catalog
+// record, then open the journal for this session. Caller holds the bus.
+void replayPositionJournal() {
+    std::vector<JournalRecord> newest;  // One per book
+    uint32_t highest = 0;
+    int valid = 0;
+    
+    File file = SD.open(JOURNAL_PATH, FILE_READ);
+    if (file) {
+        JournalRecord sector[512 / sizeof(JournalRecord)];
+        int got;
+        while ((got = file.read((uint8_t*)sector, sizeof(sector))) >= (int)sizeof(JournalRecord)) {
+            for (int i = 0; i < got / (int)sizeof(JournalRecord); i++) {
+                const JournalRecord& rec = sector[i];
+                if (rec.magic != JOURNAL_MAGIC || rec.check != journalCheck(rec)) {
+                    continue;  // Never written, or torn
+                }
+                valid++;
+                highest = max(highest, rec.sequence);
+                
+                int k = 0;
+                while (k < newest.size() && newest[k].nameHash != rec.nameHash) k++;
+                if (k == newest.size()) {
+                    newest.push_back(rec);
+                } else if (rec.sequence > newest[k].sequence) {
+                    newest[k] = rec;
+                }
+            }
+        }
+        file.close();
+    }
+    
+    int replayed = 0;
+    for (const JournalRecord& rec : newest) {
+        for (int f = 0; f < fileCount; f++) {
+            FileCache& cache = fileCache[f];
+            if (hashFilename(cache.filename) != rec.nameHash || rec.readSequence <= cache.readSequence) {
+                continue;
+            }
+            
+            cache.lastReadPage = rec.layout == cache.layout ? rec.page : 0;
+            cache.readOffset = rec.offset;
+            cache.readSequence = rec.readSequence;
+            lastReadSequence = max(lastReadSequence, rec.readSequence);
+            if (cache.catalogSlot >= 0) {
+                catalog[cache.catalogSlot].lastReadPage = cache.lastReadPage;
+                catalog[cache.catalogSlot].readOffset = cache.readOffset;
+                catalog[cache.catalogSlot].readSequence = cache.readSequence;
+                writeCatalogRecord(cache.catalogSlot);
+            }
+            Serial.printf("  %s: resuming from the journal at offset %ld\n", cache.filename, cache.readOffset);
+            replayed++;
+        }
+    }
+    
+    journal.sequence = highest + 1;
+    journal.page = -1;
+    bool open = openPositionJournal();
+    Serial.printf("Position journal: %d records, %d replayed%s\n", valid, replayed, open ? "" : " (not writable)");
+}
+
+// With each page shown - no SD access here
+void notePositionChange() {
+    long offset = getPagePosition(reader.currentPage);
+    if (reader.currentPage == journal.page && offset == journal.offset) {
+        return;  // Redraw of the same page
+    }
+    journal.page = reader.currentPage;
+    journal.offset = offset;
+    journal.dirty = true;
+    journal.pagesSinceFlush++;
+    journal.changedAt = millis();
+}
+
+// Flush if one is due. loop() calls this once the keys so far are handled.
+void pollPositionJournal() {
+    if (!journal.dirty || !reader.fileOpen) {
+        return;
+    }
+    int due = batteryLow() ? 1 : JOURNAL_FLUSH_PAGES;
+    if (journal.pagesSinceFlush >= due || millis() - journal.changedAt >= JOURNAL_IDLE_MS) {
+        flushPositionJournal();
+    }
+}
+
+// Append the last page shown to the ring
+bool flushPositionJournal() {
+    if (!journal.dirty || !reader.fileOpen) {
+        return true;
+    }
+    
+    JournalRecord rec;
+    rec.magic = JOURNAL_MAGIC;
+    rec.sequence = journal.sequence;
+    rec.nameHash = hashFilename(reader.currentFile);
+    rec.page = journal.page;
+    rec.offset = journal.offset;
+    rec.layout = layoutFingerprint();
+    rec.readSequence = lastReadSequence + 1;  // As closeBook() will number this session
+    rec.check = journalCheck(rec);
+    
+    lockSpiBus();
+    bool ok = openPositionJournal();
+    if (ok) {
+        journal.file.seek((journal.sequence % JOURNAL_SLOTS) * sizeof(JournalRecord));
+        ok = journal.file.write((const uint8_t*)&rec, sizeof(rec)) == sizeof(rec);
+        journal.file.flush();
+    }
+    unlockSpiBus();
+    
+    // Not retried - the next page turn brings another chance
+    journal.sequence++;
+    journal.dirty = false;
+    journal.pagesSinceFlush = 0;
+    if (ok) {
+        LOG_VERBOSE("  Journaled page %d (offset %ld)\n", rec.page + 1, (long)rec.offset);
+    } else {
+        Serial.println("  Position journal write failed");
+    }
+    return ok;
+}
+
+// Per the fuel gauge, read at most every BATTERY_POLL_MS. False without a
+// gauge or a battery.
+bool batteryLow() {
+    unsigned long now = millis();
+    if (battery.checkedAt != 0 && now - battery.checkedAt < BATTERY_POLL_MS) {
+        return battery.low;
+    }
+    battery.checkedAt = max(now, 1UL);
+    
+    uint16_t percent = 0;
+    uint16_t millivolts = 0;
+    bool low = readGaugeWord(GAUGE_REG_SOC, percent) && readGaugeWord(GAUGE_REG_VOLTAGE, millivolts) &&
+               millivolts > 2500 && (percent <= BATTERY_LOW_PERCENT || millivolts < BATTERY_LOW_MV);
+    if (low && !battery.low) {
+        Serial.printf("Battery low (%u%%, %u mV) - journaling every page\n", percent, millivolts);
+    }
+    battery.low = low;
+    return low;
+}
+
+// ============================================================================
+// SUSPEND AND RESUME
+// After SUSPEND_IDLE_MS without a key the book is closed as usual and the
+// device goes into deep sleep, with the page left on the panel. What is
+// needed to draw it again - the book, its fingerprint and a window of page
+// starts around the current page - stays in RTC memory, so a key press
+// redraws the page without the splash, the library scan or the catalog
+// check. The page table and the library load once the page is up.
+// ============================================================================
+
+uint32_t suspendCheck() {
+    const size_t start = offsetof(SuspendState, check) + sizeof(suspendState.check);
+    return fnv1a(FNV_OFFSET_BASIS, (const uint8_t*)&suspendState + start, sizeof(SuspendState) - start);
+}
+
+// Capture the open book while the page table is still there
+void saveSuspendState() {
+    SuspendState& s = suspendState;
+    s.magic = 0;
+    if (!reader.fileOpen) {
+        return;
+    }
+    
+    memset(&s, 0, sizeof(s));
+    strcpy(s.filename, reader.currentFile);
+    lockSpiBus();
+    s.fileSize = reader.file.storedSize();
+    s.mtime = (uint32_t)reader.file.getLastWrite();
+    unlockSpiBus();
+    s.layout = layoutFingerprint();
+    s.currentPage = reader.currentPage;
+    s.totalPages = reader.totalPages;
+    
+    // A quarter of the window behind the current page, the rest ahead
+    s.windowFirst = max(0, reader.currentPage - SUSPEND_WINDOW_PAGES / 4);
+    s.windowCount = min(SUSPEND_WINDOW_PAGES, (int)pageTableSize(reader.pages) - s.windowFirst);
+    for (int i = 0; i < s.windowCount; i++) {
+        s.window[i] = getPagePosition(s.windowFirst + i);
+    }
+    s.magic = SUSPEND_MAGIC;
+}
+
+// Close everything down and deep-sleep until a key is pressed. Does not return.
+void enterDeepSleep() {
+    Serial.println("Idle - deep sleep until key press");
+    
+    saveSuspendState();
+    closeBook();  // Position to the catalog, as on leaving the book
+    stopBackgroundIndexing();
+    clearWarmBooks();
+    suspendState.lastReadSequence = lastReadSequence;
+    suspendState.journalSequence = journal.sequence;
+    suspendState.check = suspendCheck();
+    
+    lockSpiBus();
+    if (journal.file) {
+        journal.file.close();
+    }
+    digitalWrite(SD_CS, HIGH);
+    display.hibernate();
+    SD.end();
+    unlockSpiBus();
+    
+    // INT has to be high going in, or the wakeup fires straight away
+    while (readKBReg(TCA8418_REG_KEY_LCK_EC) & 0x0F) {
+        readKBReg(TCA8418_REG_KEY_EVENT_A);
+    }
+    writeKBReg(TCA8418_REG_INT_STAT, 0x1F);
+    
+    // The keyboard stays powered to wake us
+    gpio_hold_en((gpio_num_t)PWR_EN);
+    gpio_deep_sleep_hold_en();
+    rtc_gpio_pullup_en((gpio_num_t)KB_INT);
+    rtc_gpio_pulldown_dis((gpio_num_t)KB_INT);
+    esp_sleep_enable_ext0_wakeup((gpio_num_t)KB_INT, 0);
+    
+    Serial.flush();
+    esp_deep_sleep_start();
+}
+
+// Reopen the book from suspendState and redraw its page. False if the book
+// changed while we slept - setup() then boots as usual.
+bool resumeFromSuspend() {
+    SuspendState& s = suspendState;
+    const char* filename = s.filename;
+    char fullPath[BOOK_PATH_MAX];
+    bookPath(fullPath, filename);
+    Serial.printf("Resuming %s at page %d\n", filename, s.currentPage + 1);
+    
+    lockSpiBus();
+    BookFile file = openBookFile(fullPath);
+    bool unchanged = file && file.storedSize() == s.fileSize && (uint32_t)file.getLastWrite() == s.mtime &&
+                     s.layout == layoutFingerprint() && s.currentPage >= s.windowFirst &&
+                     s.currentPage < s.windowFirst + s.windowCount;
+    if (!unchanged) {
+        if (file) {
+            file.close();
+        }
+        unlockSpiBus();
+        s.magic = 0;
+        return false;
+    }
+    
+    // Just this book in the library until it is left
+    fileCount = 0;
+    arenaReset(libraryNames);
+    if (!addFileCacheEntry(filename, s.fileSize, s.mtime)) {
+        file.close();
+        unlockSpiBus();
+        s.magic = 0;
+        return false;
+    }
+    library.order.assign(1, 0);
+    selectedFileIndex = 0;
+    unlockSpiBus();
+    
+    lastReadSequence = s.lastReadSequence;
+    journal.sequence = s.journalSequence;
+    journal.page = -1;
+    
+    reader.file = file;
+    strlcpy(reader.currentFile, filename, sizeof(reader.currentFile));
+    reader.fileOpen = true;
+    reader.fileSize = reader.file.size();
+    reader.pages = pageTableCreate(1);
+    fileCache[0].pages = pageTableRetain(reader.pages);
+    reader.currentPage = s.currentPage;
+    reader.totalPages = s.totalPages;
+    lastDisplayedPage = -1;
+    lastDisplayedTotal = -1;
+    invalidatePageCache();
+    
+    displayPageFull();  // From the window - nothing else is loaded yet
+    
+    // Now the page table, as openBook() would
+    FileCache* cache = &fileCache[0];
+    lockSpiBus();
+    loadCatalog();
+    cache->catalogSlot = findCatalogRecord(hashFilename(cache->filename));
+    unlockSpiBus();
+    bool haveIndex = loadIndexFromSD(filename, *cache, reader.pages) && pageTableSize(reader.pages) > 0;
+    
+    if (!haveIndex) {
+        // Catalog record gone - close with the position in hand and let
+        // openBook() paginate up to it
+        Serial.println("  No index to resume with - reopening");
+        closeBook();
+        s.windowCount = 0;
+        s.magic = 0;
+        openBook(filename);
+        return true;
+    }
+    
+    reader.totalPages = pageTableSize(reader.pages);
+    s.windowCount = 0;
+    s.magic = 0;
+    if (!cache->fullyIndexed || !pageTableHasOutline(reader.pages)) {
+        startBackgroundIndexing(fullPath, cache);
+    }
+    Serial.printf("  Page table loaded: %d pages\n", reader.totalPages);
+    return true;
+}
+
+// ============================================================================
+// BOOK READING FUNCTIONS
+// ============================================================================
+
+void openBook(const char* filename) {
+    Serial.printf("Opening: %s\n", filename);
+    
+    if (reader.fileOpen) {
+        closeBook();
+    }
+    
+    // Library pre-indexing has to let go of the SD card and the cache first
+    stopBackgroundIndexing();
+    
+    // Find cached index for this file
+    FileCache* cache = findFileCache(filename);
+    
+    char fullPath[BOOK_PATH_MAX];
+    bookPath(fullPath, filename);
+    WarmBook* warm = findWarmBook(cache);
+    if (warm != nullptr) {
+        reader.file = warm->file;  // Its page table is still in cache->pages
+        warm->file = BookFile();
+        warm->cache = nullptr;
+        Serial.println("Book still open from earlier");
+    } else {
+        reader.file = openBookFile(fullPath);
+    }
+    
+    if (!reader.file) {
+        Serial.println("Failed to open file!");
+        renderScreen([&](Adafruit_GFX& gfx) {
+            gfx.fillScreen(GxEPD_WHITE);
+            gfx.setTextColor(GxEPD_BLACK);
+            gfx.setCursor(30, 140);
+            gfx.setTextSize(2);
+            gfx.println("FAILED TO");
+            gfx.setCursor(30, 170);
+            gfx.println("OPEN FILE");
+        });
+        delay(2000);
+        displayFileList();
+        return;
+    }
+    
+    strlcpy(reader.currentFile, filename, sizeof(reader.currentFile));
+    reader.fileOpen = true;
+    library.drawnSelection = -1;
+    reader.currentPage = 0;
+    invalidatePageCache();
+    reader.fileSize = reader.file.size();
+#ifdef WRAP_BENCHMARK
+    benchmarkLineBreaks(reader.file);
+#endif
+    
+    // Reset partial refresh tracking
+    lastDisplayedPage = -1;
+    lastDisplayedTotal = -1;
+    
+    // Share the book's page table if it was opened before, otherwise load
+    // the saved index now that the positions are actually needed
+    bool haveIndex;
+    if (cache != nullptr && cache->pages != nullptr) {
+        reader.pages = pageTableRetain(cache->pages);
+        haveIndex = pageTableSize(reader.pages) > 0;
+    } else {
+        reader.pages = pageTableCreate(1);
+        haveIndex = cache != nullptr && cache->hasIndex &&
+                    loadIndexFromSD(filename, *cache, reader.pages) &&
+                    pageTableSize(reader.pages) > 0;
+        if (cache != nullptr) {
+            cache->pages = pageTableRetain(reader.pages);
+        }
+    }
+    
+    if (haveIndex) {
+        Serial.printf("Using cached index (%lu pages pre-indexed)\n", (unsigned long)pageTableSize(reader.pages));
+        reader.totalPages = pageTableSize(reader.pages);
+        
+        // If fully indexed, we're done - unless the outline has to be rebuilt
+        if (cache->fullyIndexed && pageTableHasOutline(reader.pages)) {
+            Serial.printf("File fully pre-indexed: %d pages\n", reader.totalPages);
+        } else {
+            // Otherwise, continue indexing from where cache left off - in the background
+            Serial.println("Continuing indexing from cache in background...");
+            startBackgroundIndexing(fullPath, cache);
+        }
+        
+    } else {
+        // No cache - show page 1 straight away and index the rest in the background
+        Serial.println("No cache - indexing from start in background...");
+        long firstPage = 0;
+        pageTableClear(reader.pages, pageTableStrideFor(reader.fileSize));
+        pageTableAppend(reader.pages, &firstPage, 1, nullptr);
+        reader.totalPages = 1;
+        startBackgroundIndexing(fullPath, cache);
+    }
+    
+    // Restore reading position! This also covers a book whose layout changed
+    // since it was read: it is re-paginated from the start, and we only wait
+    // until the indexer gets to the resume point
+    reader.currentPage = findResumePage(cache);
+    if (reader.currentPage > 0) {
+        Serial.printf("Resuming at page %d\n", reader.currentPage + 1);
+    }
+    
+    // A warm book left its page laid out - the refresh only has to draw it
+    if (warm != nullptr && warm->page->page == reader.currentPage) {
+        memcpy(&pageCache[0], warm->page, sizeof(RenderedPage));
+    }
+    
+    displayPageFull();
+}
+
+#ifdef WRAP_BENCHMARK
+// Build with -DWRAP_BENCHMARK to time findLineBreak() over the start of each
+// book opened: once as read, once with every non-ASCII byte folded to 'x'
+void benchmarkLineBreaks(BookFile& file) {
+    const int SAMPLE_BYTES = 64 * 1024;
+    char* sample = (char*)heap_caps_malloc(SAMPLE_BYTES, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (sample == nullptr) {
+        return;
+    }
+    
+    lockSpiBus();
+    file.seek(0);
+    int len = file.read((uint8_t*)sample, SAMPLE_BYTES);
+    unlockSpiBus();
+    
+    unsigned long elapsed[2];
+    int lines[2];
+    int nonAscii = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            for (int i = 0; i < len; i++) {
+                if ((uint8_t)sample[i] >= 0x80) {
+                    sample[i] = 'x';
+                    nonAscii++;
+                }
+            }
+        }
+        
+        unsigned long start = micros();
+        lines[pass] = 0;
+        for (int pos = 0; pos < len; lines[pass]++) {
+            WrapResult wrap = findLineBreak(sample, len, pos, layoutLineWidth(), layoutGlyphWidths());
+            pos = wrap.nextStart > pos ? wrap.nextStart : pos + 1;
+        }
+        elapsed[pass] = max(micros() - start, 1UL);
+    }
+    
+    Serial.printf("Wrap benchmark: %d KB, %d%% non-ASCII: %lu KB/s (%d lines), folded to ASCII %lu KB/s (%d lines)\n",
+                  len / 1024, len > 0 ? nonAscii * 100 / len : 0,
+                  (unsigned long)((uint64_t)len * 1000000 / 1024 / elapsed[0]), lines[0],
+                  (unsigned long)((uint64_t)len * 1000000 / 1024 / elapsed[1]), lines[1]);
+    free(sample);
+}
+#endif
+
+// ============================================================================
+// LAYOUT
+// ============================================================================
+
+// Identifies the settings that decide where pages break. Indexes built with
+// a different fingerprint are re-paginated.
+uint32_t layoutFingerprint() {
+    if (settings.proportional) {
+        return LAYOUT_FINGERPRINT(settings.textSize, layoutLinesPerPage(), PROPORTIONAL_LINE_WIDTH) |
+               LAYOUT_WRAP_UTF8 | LAYOUT_PROPORTIONAL;
+    }
+    return LAYOUT_FINGERPRINT(settings.textSize, layoutLinesPerPage(), settings.charsPerLine) | LAYOUT_WRAP_UTF8;
+}
+
+// Line width in the units of layoutGlyphWidths()
+int layoutLineWidth() {
+    return settings.proportional ? PROPORTIONAL_LINE_WIDTH : settings.charsPerLine;
+}
+
+// Width of each glyph: 1 column on the grid, its advance in pixels otherwise
+const uint8_t* layoutGlyphWidths() {
+    return settings.proportional ? proportionalWidths : gridWidths;
+}
+
+// Lines per page, capped to what a RenderedPage can hold
+int layoutLinesPerPage() {
+    return constrain((int)settings.linesPerPage, 1, PAGE_MAX_LINES);
+}
+
+// The current settings as the pagination engine takes them
+PageLayout pageLayout() {
+    PageLayout layout = {layoutLineWidth(), layoutGlyphWidths(), layoutLinesPerPage()};
+    return layout;
+}
+
+static_assert(PROPORTIONAL_LINE_WIDTH <= 255, "line width has to fit the layout fingerprint");
+
+// Book file as the pagination engine reads it. Caller holds the bus.
+class FileTextStream : public TextStream {
+public:
+    explicit FileTextStream(BookFile& file) : file(file) {}
+    bool seek(long pos) override { return file.seek(pos); }
+    int read(char* buffer, int len) override {
+        PERF_SCOPE(PERF_SD_READ);
+        return file.read((uint8_t*)buffer, len);
+    }
+    long size() override { return file.size(); }
+
+private:
+    BookFile& file;
+};
+
+// ============================================================================
+// PAGE TABLE
+// Page start offsets for one book, allocated in PSRAM when the board has it
+// and shared by reference between FileCache and ReaderState. Huge books use
+// a sparse table that keeps every PAGE_TABLE_SPARSE_STRIDE-th page and
+// re-derives the pages in between with the indexer when they are needed.
+// ============================================================================
+
+// In PSRAM when the board has it, like realloc() otherwise
+void* psramRealloc(void* ptr, size_t bytes) {
+#ifdef BOARD_HAS_PSRAM
+    if (psramFound()) {
+        return heap_caps_realloc(ptr, bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    }
+#endif
+    return realloc(ptr, bytes);
+}
+
+// Dense tables are cheap in PSRAM, so only really huge books go sparse there
+uint8_t pageTableStrideFor(unsigned long fileSize) {
+    unsigned long sparseMin = PAGE_TABLE_SPARSE_MIN_BYTES_SRAM;
+#ifdef BOARD_HAS_PSRAM
+    if (psramFound()) {
+        sparseMin = PAGE_TABLE_SPARSE_MIN_BYTES;
+    }
+#endif
+    return fileSize >= sparseMin ? PAGE_TABLE_SPARSE_STRIDE : 1;
+}
+
+PageTable* pageTableCreate(uint8_t stride) {
+    PageTable* table = new PageTable();
+    table->entries = nullptr;
+    table->entryCount = 0;
+    table->capacity = 0;
+    table->pageCount = 0;
+    table->lastPos = 0;
+    table->stride = stride > 0 ? stride : 1;
+    table->refCount = 1;
+    table->lock = xSemaphoreCreateMutex();
+    table->cachedGroup = -1;
+    table->derived.reserve(PAGE_TABLE_SPARSE_STRIDE);
+    table->hasOutline = true;
+    table->openWords = 0;
+    return table;
+}
+
+PageTable* pageTableRetain(PageTable* table) {
+    if (table != nullptr) {
+        xSemaphoreTake(table->lock, portMAX_DELAY);
+        table->refCount++;
+        xSemaphoreGive(table->lock);
+    }
+    return table;
+}
+
+void pageTableRelease(PageTable* table) {
+    if (table == nullptr) {
+        return;
+    }
+    xSemaphoreTake(table->lock, portMAX_DELAY);
+    bool last = --table->refCount == 0;
+    xSemaphoreGive(table->lock);
+    
+    if (last) {
+        free(table->entries);
+        vSemaphoreDelete(table->lock);
+        delete table;
+    }
+}
+
+// Grow storage so at least entryCapacity entries fit. Caller holds the lock.
+bool pageTableReserve(PageTable* table, uint32_t entryCapacity) {
+    if (entryCapacity <= table->capacity) {
+        return true;
+    }
+    uint32_t newCapacity = max(entryCapacity, max((uint32_t)64, table->capacity * 2));
+    long* grown = (long*)psramRealloc(table->entries, newCapacity * sizeof(long));
+    if (grown == nullptr) {
+        Serial.printf("Page table: out of memory at %lu entries\n", (unsigned long)newCapacity);
+        return false;
+    }
+    table->entries = grown;
+    table->capacity = newCapacity;
+    return true;
+}
+
+// Reset to an empty table with the given stride
+void pageTableClear(PageTable* table, uint8_t stride) {
+    xSemaphoreTake(table->lock, portMAX_DELAY);
+    table->entryCount = 0;
+    table->pageCount = 0;
+    table->lastPos = 0;
+    table->stride = stride > 0 ? stride : 1;
+    table->cachedGroup = -1;
+    table->hasOutline = true;
+    table->chapters.clear();
+    table->words.clear();
+    table->openWords = 0;
+    xSemaphoreGive(table->lock);
+}
+
+// Append the start offsets of the next count pages. outline has the words
+// on the page each of them ends and the headings found on the way; without
+// it the table no longer has an outline.
+bool pageTableAppend(PageTable* table, const long* positions, int count, const OutlineScan* outline) {
+    xSemaphoreTake(table->lock, portMAX_DELAY);
+    bool ok = true;
+    for (int i = 0; i < count; i++) {
+        if (table->pageCount > 0) {
+            if (outline != nullptr) {
+                table->openWords += outline->words[i];
+            } else {
+                table->hasOutline = false;
+            }
+        }
+        if (table->pageCount % table->stride == 0) {
+            if (!pageTableReserve(table, table->entryCount + 1)) {
+                ok = false;
+                break;
+            }
+            if (table->pageCount > 0 && table->hasOutline) {
+                table->words.push_back(min(table->openWords, (uint32_t)UINT16_MAX));
+                table->openWords = 0;
+            }
+            table->entries[table->entryCount++] = positions[i];
+        }
+        table->lastPos = positions[i];
+        table->pageCount++;
+    }
+    
+    // A resumed scan finds the headings after the last page start again
+    if (outline != nullptr && table->hasOutline) {
+        for (const Chapter& chapter : outline->chapters) {
+            if (table->chapters.size() < OUTLINE_MAX_CHAPTERS &&
+                (table->chapters.empty() || chapter.offset > table->chapters.back().offset)) {
+                table->chapters.push_back(chapter);
+            }
+        }
+    }
+    xSemaphoreGive(table->lock);
+    return ok;
+}
+
+// Count the words of the book's last page once the end has been reached
+void pageTableCloseOutline(PageTable* table, uint32_t lastPageWords) {
+    xSemaphoreTake(table->lock, portMAX_DELAY);
+    if (table->hasOutline && table->words.size() + 1 == table->entryCount) {
+        table->words.push_back(min(table->openWords + lastPageWords, (uint32_t)UINT16_MAX));
+        table->openWords = 0;
+    }
+    xSemaphoreGive(table->lock);
+}
+
+// Number of stored entries a table of pageCount pages keeps. Sparse tables
+// also keep the last page start, so indexing can resume from it.
+uint32_t pageTableStoredEntries(uint32_t pageCount, uint8_t stride) {
+    if (pageCount == 0) {
+        return 0;
+    }
+    uint32_t entries = (pageCount + stride - 1) / stride;
+    if ((pageCount - 1) % stride != 0) {
+        entries++;
+    }
+    return entries;
+}
+
+// Copy the stored entries out in save order (see pageTableStoredEntries),
+// and the encoded outline if the table has one
+void pageTableSnapshot(PageTable* table, std::vector<long>& out, uint32_t& pageCount, uint8_t& stride,
+                       std::vector<uint8_t>& outline) {
+    xSemaphoreTake(table->lock, portMAX_DELAY);
+    out.assign(table->entries, table->entries + table->entryCount);
+    if (table->pageCount > 0 && (table->pageCount - 1) % table->stride != 0) {
+        out.push_back(table->lastPos);
+    }
+    pageCount = table->pageCount;
+    stride = table->stride;
+    outline.clear();
+    if (table->hasOutline) {
+        encodeOutline(table, outline);
+    }
+    xSemaphoreGive(table->lock);
+}
+
+// Replace the contents with entries as saved by pageTableSnapshot()
+bool pageTableRestore(PageTable* table, const long* stored, uint32_t storedCount, uint32_t pageCount, uint8_t stride) {
+    if (stride == 0) stride = 1;
+    if (storedCount != pageTableStoredEntries(pageCount, stride)) {
+        return false;
+    }
+    
+    xSemaphoreTake(table->lock, portMAX_DELAY);
+    uint32_t entryCount = (pageCount + stride - 1) / stride;
+    bool ok = pageTableReserve(table, entryCount);
+    if (ok) {
+        memcpy(table->entries, stored, entryCount * sizeof(long));
+        table->entryCount = entryCount;
+        table->pageCount = pageCount;
+        table->lastPos = storedCount > 0 ? stored[storedCount - 1] : 0;
+        table->stride = stride;
+        table->cachedGroup = -1;
+        table->hasOutline = false;  // Until decodeOutline() puts one back
+        table->chapters.clear();
+        table->words.clear();
+        table->openWords = 0;
+    }
+    xSemaphoreGive(table->lock);
+    return ok;
+}
+
+uint32_t pageTableSize(PageTable* table) {
+    return table != nullptr ? table->pageCount : 0;
+}
+
+// False for an index saved before outlines, until one is rebuilt
+bool pageTableHasOutline(PageTable* table) {
+    xSemaphoreTake(table->lock, portMAX_DELAY);
+    bool has = table->hasOutline;
+    xSemaphoreGive(table->lock);
+    return has;
+}
+
+// Take over the pages and outline of from, leaving it with the old ones
+void pageTableAdopt(PageTable* table, PageTable* from) {
+    xSemaphoreTake(table->lock, portMAX_DELAY);
+    xSemaphoreTake(from->lock, portMAX_DELAY);
+    std::swap(table->entries, from->entries);
+    std::swap(table->entryCount, from->entryCount);
+    std::swap(table->capacity, from->capacity);
+    std::swap(table->pageCount, from->pageCount);
+    std::swap(table->lastPos, from->lastPos);
+    std::swap(table->stride, from->stride);
+    std::swap(table->hasOutline, from->hasOutline);
+    std::swap(table->openWords, from->openWords);
+    table->chapters.swap(from->chapters);
+    table->words.swap(from->words);
+    table->cachedGroup = -1;
+    from->cachedGroup = -1;
+    xSemaphoreGive(from->lock);
+    xSemaphoreGive(table->lock);
+}
+
+// Memory held by the positions and the outline
+size_t pageTableBytes(PageTable* table) {
+    xSemaphoreTake(table->lock, portMAX_DELAY);
+    size_t bytes = sizeof(PageTable) + table->capacity * sizeof(long) + table->chapters.capacity() * sizeof(Chapter) +
+                   table->words.capacity() * sizeof(uint16_t);
+    xSemaphoreGive(table->lock);
+    return bytes;
+}
+
+long pageTableBack(PageTable* table) {
+    xSemaphoreTake(table->lock, portMAX_DELAY);
+    long pos = table->lastPos;
+    xSemaphoreGive(table->lock);
+    return pos;
+}
+
+// Start offset of a page. Sparse tables re-index the group around the page
+// from its stored anchor using file (same wrap logic, so offsets are exact)
+// and keep that group for the following page turns.
+long pageTablePosition(PageTable* table, int page, BookFile& file) {
+    xSemaphoreTake(table->lock, portMAX_DELAY);
+    uint8_t stride = table->stride;
+    int group = page / stride;
+    long pos;
+    
+    if (page % stride == 0) {
+        pos = table->entries[group];
+    } else if (page == table->pageCount - 1) {
+        pos = table->lastPos;
+    } else if (group == table->cachedGroup) {
+        pos = table->groupPositions[page % stride];
+    } else {
+        long anchor = table->entries[group];
+        xSemaphoreGive(table->lock);
+        
+        // Only the reader derives (it owns the file), so the scratch needs no lock
+        std::vector<long>& derived = table->derived;
+        derived.clear();
+        FileTextStream stream(file);
+        lockSpiBus();
+        indexPagesWordWrap(stream, pageLayout(), anchor, derived, stride - 1);
+        unlockSpiBus();
+        
+        xSemaphoreTake(table->lock, portMAX_DELAY);
+        table->groupPositions[0] = anchor;
+        for (int i = 1; i < stride; i++) {
+            table->groupPositions[i] = i - 1 < derived.size() ? derived[i - 1] : table->lastPos;
+        }
+        table->cachedGroup = group;
+        pos = table->groupPositions[page % stride];
+    }
+    
+    xSemaphoreGive(table->lock);
+    return pos;
+}
+
+// Last stored entry starting at or before offset. Caller holds the lock.
+int pageTableEntryAt(PageTable* table, long offset) {
+    int lo = 0;
+    int hi = (int)table->entryCount - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (table->entries[mid] <= offset) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+// Page containing file offset - the last page starting at or before it
+int pageTableFindPage(PageTable* table, long offset, BookFile& file) {
+    xSemaphoreTake(table->lock, portMAX_DELAY);
+    int page = pageTableEntryAt(table, offset) * table->stride;
+    int pageCount = table->pageCount;
+    uint8_t stride = table->stride;
+    xSemaphoreGive(table->lock);
+    
+    // Sparse tables: step through the group for the exact page
+    for (int i = 1; i < stride && page + 1 < pageCount; i++) {
+        if (pageTablePosition(table, page + 1, file) > offset) {
+            break;
+        }
+        page++;
+    }
+    return page;
+}
+
+int pageTableChapterCount(PageTable* table) {
+    xSemaphoreTake(table->lock, portMAX_DELAY);
+    int count = table->chapters.size();
+    xSemaphoreGive(table->lock);
+    return count;
+}
+
+// Copy of a chapter - the indexer may be adding to the list
+Chapter pageTableChapter(PageTable* table, int index) {
+    xSemaphoreTake(table->lock, portMAX_DELAY);
+    Chapter chapter = table->chapters[index];
+    xSemaphoreGive(table->lock);
+    return chapter;
+}
+
+// Chapter the offset lies in, -1 if it is before the first heading
+int pageTableChapterAt(PageTable* table, long offset) {
+    xSemaphoreTake(table->lock, portMAX_DELAY);
+    int index = -1;
+    while (index + 1 < (int)table->chapters.size() && table->chapters[index + 1].offset <= offset) {
+        index++;
+    }
+    xSemaphoreGive(table->lock);
+    return index;
+}
+
+// Words from the entry holding offset up to the next heading, or the end of
+// the book. Counts per entry, so a sparse table gives whole groups. False
+// while the words that far have not been counted yet.
+bool pageTableWordsToNextChapter(PageTable* table, long offset, uint32_t& words) {
+    xSemaphoreTake(table->lock, portMAX_DELAY);
+    bool ok = table->hasOutline && table->entryCount > 0;
+    if (ok) {
+        int chapter = 0;
+        while (chapter < (int)table->chapters.size() && table->chapters[chapter].offset <= offset) {
+            chapter++;
+        }
+        int first = pageTableEntryAt(table, offset);
+        int last = chapter < (int)table->chapters.size() ? pageTableEntryAt(table, table->chapters[chapter].offset)
+                                                         : (int)table->entryCount;
+        ok = last <= (int)table->words.size();
+        words = 0;
+        for (int i = first; ok && i < last; i++) {
+            words += table->words[i];
+        }
+    }
+    xSemaphoreGive(table->lock);
+    return ok;
+}
+
+// ============================================================================
+// SPI BUS ARBITRATION
+// One recursive mutex over displaySpi. The SD driver and GxEPD2 each frame
+// their own transfers and raise their chip select after, so whoever holds
+// the bus can use either device. A refresh spends most of its time waiting
+// on BUSY without touching the bus; the display lends it out meanwhile so
+// the indexer's read-ahead keeps reading the card.
+// ============================================================================
+
+void lockSpiBus() {
+    if (spiBus.mutex == nullptr) {
+        return;
+    }
+    xSemaphoreTakeRecursive(spiBus.mutex, portMAX_DELAY);
+    spiBus.owner = xTaskGetCurrentTaskHandle();
+    spiBus.depth++;
+}
+
+void unlockSpiBus() {
+    if (spiBus.mutex == nullptr) {
+        return;
+    }
+    if (--spiBus.depth == 0) {
+        spiBus.owner = nullptr;
+    }
+    xSemaphoreGiveRecursive(spiBus.mutex);
+}
+
+// Hold the bus for the panel, with the card deselected
+void lockDisplayBus() {
+    lockSpiBus();
+    digitalWrite(SD_CS, HIGH);
+}
+
+// Give the bus up entirely, however many holds the caller has on it.
+// Returns the holds for reclaimSpiBus(), 0 if the caller didn't hold it.
+int lendSpiBus() {
+    if (spiBus.mutex == nullptr || spiBus.owner != xTaskGetCurrentTaskHandle()) {
+        return 0;
+    }
+    int holds = spiBus.depth;
+    spiBus.owner = nullptr;
+    spiBus.depth = 0;
+    spiBus.lent = true;
+    for (int i = 0; i < holds; i++) {
+        xSemaphoreGiveRecursive(spiBus.mutex);
+    }
+    return holds;
+}
+
+// Take a lent bus back - waits for the transfer in progress, at most one
+// read-ahead chunk
+void reclaimSpiBus(int holds) {
+    if (holds == 0) {
+        return;
+    }
+    PERF_SCOPE(PERF_BUS_RECLAIM);
+    for (int i = 0; i < holds; i++) {
+        xSemaphoreTakeRecursive(spiBus.mutex, portMAX_DELAY);
+    }
+    spiBus.owner = xTaskGetCurrentTaskHandle();
+    spiBus.depth = holds;
+    spiBus.lent = false;
+    digitalWrite(SD_CS, HIGH);
+}
+
+// ============================================================================
+// BACKGROUND INDEXER
+// Extends the open book's page table on the second core while the user is already
+// reading. The task uses its own File handle so it never moves reader.file.
+// ============================================================================
+
+void initIndexer() {
+    spiBus.mutex = xSemaphoreCreateRecursiveMutex();
+    indexer.running = false;
+    indexer.cancel = false;
+    indexer.finished = false;
+    
+    xTaskCreatePinnedToCore(indexerTaskMain, "indexer", INDEXER_STACK_SIZE, nullptr,
+                            INDEXER_PRIORITY, &indexer.task, INDEXER_CORE);
+    Serial.printf("Indexer task started on core %d\n", INDEXER_CORE);
+    
+    initReadAhead();
+}
+
+void initReadAhead() {
+    readAhead.chunkBytes = READ_AHEAD_BYTES;
+    for (int i = 0; i < 2; i++) {
+        readAhead.buffers[i] = (char*)heap_caps_malloc(READ_AHEAD_HEADROOM + READ_AHEAD_BYTES,
+                                                       MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    }
+    if (readAhead.buffers[0] == nullptr || readAhead.buffers[1] == nullptr) {
+        for (int i = 0; i < 2; i++) {
+            free(readAhead.buffers[i]);
+            readAhead.buffers[i] = (char*)malloc(READ_AHEAD_HEADROOM + READ_AHEAD_FALLBACK);
+        }
+        readAhead.chunkBytes = READ_AHEAD_FALLBACK;
+    }
+    
+    readAhead.filled = xSemaphoreCreateBinary();
+    // Reads sit on the loop() core - it idles while the indexer is busy
+    xTaskCreatePinnedToCore(readAheadTaskMain, "readahead", READ_AHEAD_STACK, nullptr,
+                            READ_AHEAD_PRIORITY, &readAhead.task, READ_AHEAD_CORE);
+    Serial.printf("Read-ahead: 2 x %d KB buffers\n", readAhead.chunkBytes / 1024);
+}
+
+void readAheadTaskMain(void* param) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        
+        char* chunk = readAhead.buffers[readAhead.fillBuffer] + READ_AHEAD_HEADROOM;
+        lockSpiBus();
+        {
+            PERF_SCOPE(PERF_SD_READ);
+            readAhead.file->seek(readAhead.fillOffset);
+            readAhead.fillLength = readAhead.file->read((uint8_t*)chunk, readAhead.chunkBytes);
+        }
+        if (spiBus.lent) {
+            spiBus.lentBytes += max(readAhead.fillLength, 0);
+            PERF_COUNT(PERF_LENT_SD_BYTES, max(readAhead.fillLength, 0));
+        }
+        unlockSpiBus();
+        
+        xSemaphoreGive(readAhead.filled);
+    }
+}
+
+// Start reading the chunk at offset into buffer 0 or 1. Every request has to
+// be collected with readAheadWait() before the next one, or before the file
+// is used by anyone else.
+void readAheadRequest(BookFile& file, long offset, int buffer) {
+    readAhead.file = &file;
+    readAhead.fillOffset = offset;
+    readAhead.fillBuffer = buffer;
+    xTaskNotifyGive(readAhead.task);
+}
+
+// Wait for the requested chunk, returns its length
+int readAheadWait() {
+    xSemaphoreTake(readAhead.filled, portMAX_DELAY);
+    return readAhead.fillLength;
+}
+
+void indexerTaskMain(void* param) {
+    for (;;) {
+        // Sleep until startBackgroundIndexing()/startLibraryIndexing() hands us a job
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        
+        if (indexer.job == INDEX_JOB_READER) {
+            runReaderIndexJob();
+        } else if (indexer.job == INDEX_JOB_SEARCH) {
+            runSearchJob();
+        } else {
+            runLibraryIndexJob();
+        }
+        indexer.running = false;
+        xTaskNotifyGive(keyboard.loopTask);  // Let loop() pick up the result
+    }
+}
+
+// Extend pages from its last page by up to maxPages (0 = to the end).
+// Chunks stream in through the read-ahead buffers, and the bus is only held
+// while a chunk is read. Pages are appended under the table lock after each
+// chunk, so the reader can use them as they arrive.
+// Returns true if the end of the file was reached.
+bool indexBookIncremental(BookFile& file, PageTable* pages, int maxPages, volatile int* pageCount) {
+    PERF_SCOPE(PERF_INDEX_PASS);
+    unsigned long startTime = micros();
+    unsigned long waitTime = 0;
+    std::vector<long> batch;
+    batch.reserve(INDEXER_BATCH_PAGES);
+    OutlineScan scan;
+    scan.words.reserve(INDEXER_BATCH_PAGES);
+    PageLayout layout = pageLayout();
+    int pagesDone = 0;
+    int lineCount = 0;
+    bool complete = false;
+    long startPos = pageTableBack(pages);
+    
+    lockSpiBus();
+    long fileSize = file.size();
+    FileTextStream stream(file);
+    outlineScanBegin(scan, stream, startPos);
+    unlockSpiBus();
+    long nextRead = startPos;
+    int leftover = 0;
+    int current = 0;
+    
+    readAheadRequest(file, nextRead, current);
+    for (;;) {
+        unsigned long waitStart = micros();
+        int bytesRead = readAheadWait();
+        waitTime += micros() - waitStart;
+        
+        char* buffer = readAhead.buffers[current] + READ_AHEAD_HEADROOM - leftover;
+        long chunkFileStart = nextRead - leftover;
+        int bufLen = leftover + max(bytesRead, 0);
+        nextRead += max(bytesRead, 0);
+        bool moreData = bytesRead > 0 && nextRead < fileSize;
+        
+        // Read the next chunk while this one is wrapped
+        bool stopping = indexer.cancel || (maxPages > 0 && pagesDone >= maxPages);
+        if (moreData && !stopping) {
+            readAheadRequest(file, nextRead, current ^ 1);
+        }
+        if (stopping || bufLen == 0) {
+            break;
+        }
+        
+        batch.clear();
+        scan.words.clear();
+        scan.chapters.clear();
+        int pos;
+        {
+            PERF_SCOPE(PERF_PAGINATE);
+            pos = wrapChunkPages(buffer, bufLen, moreData, chunkFileStart, layout, lineCount, batch,
+                                 maxPages > 0 ? maxPages - pagesDone : 0, &scan);
+        }
+        if (!batch.empty() || !scan.chapters.empty()) {
+            if (!pageTableAppend(pages, batch.data(), batch.size(), &scan)) {
+                if (moreData) readAheadWait();
+                break;  // Out of memory - keep what we have
+            }
+            if (pageCount != nullptr) {
+                *pageCount = pageTableSize(pages);
+            }
+            pagesDone += batch.size();
+        }
+        
+        if (!moreData) {
+            complete = maxPages <= 0 || pagesDone < maxPages;
+            if (complete) {
+                pageTableCloseOutline(pages, scan.pageWords);
+            }
+            break;
+        }
+        
+        // The unfinished line goes in front of the next chunk. One that
+        // doesn't fit can only be made of control bytes and is skipped.
+        leftover = bufLen - pos;
+        if (leftover > READ_AHEAD_HEADROOM) {
+            leftover = 0;
+        }
+        current ^= 1;
+        memcpy(readAhead.buffers[current] + READ_AHEAD_HEADROOM - leftover, buffer + pos, leftover);
+    }
+    
+    unsigned long elapsed = micros() - startTime;
+    long scanned = nextRead - startPos;
+    if (scanned >= 64 * 1024) {
+        Serial.printf("  Scanned %ld KB in %lu ms: %lu ms/MB, %lu ms waiting for SD\n", scanned / 1024,
+                      elapsed / 1000, (unsigned long)((uint64_t)elapsed * 1048576 / ((uint64_t)scanned * 1000)), waitTime / 1000);
+    }
+    return complete;
+}
+
+// Finish indexing the open book
+void runReaderIndexJob() {
+    unsigned long startTime = millis();
+    
+    lockSpiBus();
+    BookFile file = openBookFile(indexer.path);
+    unlockSpiBus();
+    
+    if (!file) {
+        Serial.printf("Indexer: cannot open %s\n", indexer.path);
+        return;
+    }
+    
+    bool complete;
+    if (pageTableHasOutline(reader.pages)) {
+        complete = indexBookIncremental(file, reader.pages, 0, &reader.totalPages);
+    } else if (!(complete = rebuildReaderOutline(file))) {
+        lockSpiBus();
+        file.close();
+        unlockSpiBus();
+        Serial.println("Indexer: outline rebuild cancelled");  // Starts over on the next open
+        return;
+    }
+    
+    lockSpiBus();
+    if (indexer.cache != nullptr) {
+        indexer.cache->contentHash = contentFingerprint(file.stored());
+    }
+    unsigned long storedSize = file.storedSize();
+    file.close();
+    
+    // A cancelled job still saves, so the next open resumes from here
+    saveIndexToSD(reader.currentFile, reader.pages, storedSize, complete, layoutFingerprint());
+    unlockSpiBus();
+    
+    if (indexer.cache != nullptr) {
+        indexer.cache->fileSize = storedSize;
+        indexer.cache->pageCount = reader.totalPages;
+        indexer.cache->hasIndex = true;
+        indexer.cache->fullyIndexed = complete;
+    }
+    
+    Serial.printf("Indexer: %d pages %s in %lu ms (saved to SD)\n", reader.totalPages,
+                  complete ? "complete" : "so far, cancelled", millis() - startTime);
+    
+    indexer.finished = complete;
+}
+
+// Paginate the open book again from the start for the outline its saved
+// index lacks. Same layout, same pages, so the reader keeps using the old
+// positions and swaps in the new table once it reaches the end. Pages past
+// a partial old index wait for the whole pass.
+bool rebuildReaderOutline(BookFile& file) {
+    Serial.println("Indexer: rebuilding the outline");
+    PageTable* scratch = pageTableCreate(pageTableStrideFor(reader.fileSize));
+    long firstPage = 0;
+    pageTableAppend(scratch, &firstPage, 1, nullptr);
+    bool complete = indexBookIncremental(file, scratch, 0, nullptr);
+    if (complete) {
+        pageTableAdopt(reader.pages, scratch);
+        reader.totalPages = pageTableSize(reader.pages);
+    }
+    pageTableRelease(scratch);
+    return complete;
+}
+
+// Pre-index the library while the file list is showing: first give every
+// new book its PREINDEX_PAGES so it opens instantly, then complete them all.
+void runLibraryIndexJob() {
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < fileCount && !indexer.cancel; i++) {
+            FileCache& cache = fileCache[i];
+            if (pass == 0 ? cache.hasIndex : cache.fullyIndexed) {
+                continue;
+            }
+            indexLibraryBook(cache, pass == 0 ? PREINDEX_PAGES : 0);
+        }
+    }
+}
+
+void indexLibraryBook(FileCache& cache, int maxPages) {
+    unsigned long startTime = millis();
+    char fullPath[BOOK_PATH_MAX];
+    bookPath(fullPath, cache.filename);
+    
+    // Open and warm books already have their table in RAM
+    PageTable* pages = cache.pages != nullptr ? pageTableRetain(cache.pages)
+                                              : pageTableCreate(pageTableStrideFor(cache.fileSize));
+    
+    lockSpiBus();
+    // Continue from any partial index on SD
+    if (cache.pages == nullptr && (!cache.hasIndex || !loadIndexFromSD(cache.filename, cache, pages))) {
+        pageTableClear(pages, pageTableStrideFor(cache.fileSize));
+    }
+    if (pageTableSize(pages) == 0) {
+        long firstPage = 0;  // First page always at 0
+        pageTableAppend(pages, &firstPage, 1, nullptr);
+    }
+    BookFile file = openBookFile(fullPath);
+    unlockSpiBus();
+    
+    if (!file) {
+        Serial.printf("Indexer: skip %s, cannot open\n", cache.filename);
+        cache.hasIndex = true;  // Don't retry every pass
+        cache.fullyIndexed = true;
+        pageTableRelease(pages);
+        return;
+    }
+    
+    int pagesWanted = maxPages > 0 ? maxPages - (int)pageTableSize(pages) : 0;
+    bool complete = false;
+    if (maxPages <= 0 || pagesWanted > 0) {
+        complete = indexBookIncremental(file, pages, pagesWanted, nullptr);
+    }
+    
+    lockSpiBus();
+    cache.fileSize = file.storedSize();
+    cache.contentHash = contentFingerprint(file.stored());
+    file.close();
+    saveIndexToSD(cache.filename, pages, cache.fileSize, complete, layoutFingerprint());
+    unlockSpiBus();
+    
+    cache.pageCount = pageTableSize(pages);
+    pageTableRelease(pages);
+    cache.hasIndex = true;
+    cache.fullyIndexed = complete;
+    
+    Serial.printf("Indexer: %s %d pages%s in %lu ms\n", cache.filename, cache.pageCount,
+                  complete ? " (complete)" : "", millis() - startTime);
+}
+
+// Hand the open book to the indexer task, which continues from the
+// last page in reader.pages
+void startBackgroundIndexing(const char* fullPath, FileCache* cache) {
+    stopBackgroundIndexing();
+    
+    indexer.job = INDEX_JOB_READER;
+    if (fullPath != indexer.path) {  // finishSearch() hands back the same path
+        strlcpy(indexer.path, fullPath, sizeof(indexer.path));
+    }
+    indexer.cache = cache;
+    indexer.cancel = false;
+    indexer.finished = false;
+    indexer.running = true;
+    xTaskNotifyGive(indexer.task);
+}
+
+// Start pre-indexing books that have no complete index yet
+void startLibraryIndexing() {
+    stopBackgroundIndexing();
+    
+    bool pending = false;
+    for (int i = 0; i < fileCount; i++) {
+        if (!fileCache[i].fullyIndexed) {
+            pending = true;
+            break;
+        }
+    }
+    if (!pending) {
+        return;
+    }
+    
+    indexer.job = INDEX_JOB_LIBRARY;
+    indexer.cache = nullptr;
+    indexer.cancel = false;
+    indexer.finished = false;
+    indexer.running = true;
+    xTaskNotifyGive(indexer.task);
+}
+
+// Cancel any running job and block until the task has let go of the book
+void stopBackgroundIndexing() {
+    if (!indexer.running) {
+        return;
+    }
+    
+    indexer.cancel = true;
+    while (indexer.running) {
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+    indexer.cancel = false;
+}
+
+// Block until the given page has been indexed. Returns false if the
+// indexer finished without reaching it (page is past the end of the book).
+bool waitForPage(int page) {
+    if (page >= reader.totalPages && readerIndexing()) {
+        LOG_VERBOSE("Waiting for indexer to reach page %d...\n", page + 1);
+        while (page >= reader.totalPages && readerIndexing()) {
+            vTaskDelay(pdMS_TO_TICKS(20));
+        }
+    }
+    return page < reader.totalPages;
+}
+
+// Wait until the page containing offset is complete in the page table
+bool waitForOffset(long offset) {
+    if (readerIndexing() && pageTableBack(reader.pages) <= offset) {
+        LOG_VERBOSE("Waiting for indexer to reach offset %ld...\n", offset);
+        while (readerIndexing() && pageTableBack(reader.pages) <= offset) {
+            vTaskDelay(pdMS_TO_TICKS(20));
+        }
+    }
+    return pageTableBack(reader.pages) > offset || !readerIndexing();
+}
+
+// Page to reopen the book at. The byte offset is preferred as it holds for
+// any layout; the saved page is used when only it was recorded and the
+// layout still matches. Waits for the indexer if the point is not paginated yet.
+int findResumePage(FileCache* cache) {
+    if (cache == nullptr) {
+        return 0;
+    }
+    
+    if (cache->readOffset > 0) {
+        if (cache->readOffset >= pageTableBack(reader.pages) && readerIndexing()) {
+            showIndexingScreen(cache->filename);
+            waitForOffset(cache->readOffset);
+        }
+        return pageTableFindPage(reader.pages, cache->readOffset, reader.file);
+    }
+    
+    if (cache->readOffset == READ_OFFSET_UNKNOWN && cache->lastReadPage > 0 &&
+        cache->layout == layoutFingerprint()) {
+        if (cache->lastReadPage >= reader.totalPages && readerIndexing()) {
+            showIndexingScreen(cache->filename);
+            waitForPage(cache->lastReadPage);
+        }
+        if (cache->lastReadPage < reader.totalPages) {
+            return cache->lastReadPage;
+        }
+    }
+    return 0;
+}
+
+// True while the open book is still being paginated
+bool readerIndexing() {
+    return indexer.running && indexer.job == INDEX_JOB_READER;
+}
+
+// ============================================================================
+// TEXT SEARCH
+// The open book is streamed through the read-ahead buffers on the indexer
+// core and matched with Boyer-Moore-Horspool. Matching ignores ASCII case
+// and treats line ends and tabs as spaces, so a phrase is found across a
+// hard line break.
+// ============================================================================
+
+constexpr uint8_t searchFoldByte(int c) {
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') :
+           c == '\n' || c == '\r' || c == '\t' ? ' ' :
+           c;
+}
+constexpr uint8_t searchFold[256] = {GLYPH_TABLE(searchFoldByte)};
+
+bool searchRunning() {
+    return indexer.running && indexer.job == INDEX_JOB_SEARCH;
+}
+
+// Search forward from the page after the current one, wrapping around to
+// the start of the book. The reader indexer is paused meanwhile.
+void startSearch() {
+    int m = search.length;
+    for (int i = 0; i < m; i++) {
+        search.pattern[i] = searchFold[(uint8_t)search.query[i]];
+    }
+    for (int c = 0; c < 256; c++) {
+        search.shift[c] = m;
+    }
+    for (int i = 0; i < m - 1; i++) {
+        search.shift[search.pattern[i]] = m - 1 - i;
+    }
+    
+    search.from = reader.currentPage + 1 < reader.totalPages ? getPagePosition(reader.currentPage + 1)
+                                                              : getPagePosition(reader.currentPage) + 1;
+    search.resumeIndexing = readerIndexing();
+    stopBackgroundIndexing();
+    
+    Serial.printf("Search \"%s\" from offset %ld\n", search.query, search.from);
+    drawSearchPrompt("Searching...  Q:Stop");
+    
+    // indexer.path and indexer.cache still name the open book
+    search.done = false;
+    search.hit = -1;
+    search.cancelled = false;
+    indexer.job = INDEX_JOB_SEARCH;
+    indexer.cancel = false;
+    indexer.running = true;
+    xTaskNotifyGive(indexer.task);
+}
+
+void runSearchJob() {
+    unsigned long startTime = millis();
+    
+    lockSpiBus();
+    BookFile file = openBookFile(indexer.path);
+    long size = file ? (long)file.size() : 0;
+    unlockSpiBus();
+    
+    long hit = -1;
+    long scanned = 0;
+    if (file) {
+        hit = searchRange(file, search.from, size);
+        scanned = hit >= 0 ? hit - search.from : size - search.from;
+        if (hit < 0 && !indexer.cancel) {
+            // Wrap around - up to a match that would start before search.from
+            long end = min(search.from + search.length - 1, size);
+            hit = searchRange(file, 0, end);
+            scanned += hit >= 0 ? hit : end;
+        }
+        lockSpiBus();
+        file.close();
+        unlockSpiBus();
+    }
+    
+    unsigned long elapsed = max(millis() - startTime, 1UL);
+    Serial.printf("Search: %s, %ld KB in %lu ms (%lu KB/s)\n",
+                  indexer.cancel ? "stopped" : hit >= 0 ? "found" : "not found", scanned / 1024, elapsed,
+                  (unsigned long)(scanned / elapsed * 1000 / 1024));
+    
+    search.hit = hit;
+    search.cancelled = indexer.cancel;
+    search.done = true;
+}
+
+// Offset of the first match in [start, end), or -1. A match may straddle
+// two chunks, so the last length - 1 bytes of each chunk are carried over
+// in front of the next one.
+long searchRange(BookFile& file, long start, long end) {
+    int m = search.length;
+    if (end - start < m) {
+        return -1;
+    }
+    
+    long nextRead = start;
+    int carry = 0;
+    int current = 0;
+    readAheadRequest(file, nextRead, current);
+    
+    for (;;) {
+        int bytesRead = readAheadWait();
+        int got = (int)min((long)max(bytesRead, 0), end - nextRead);
+        const uint8_t* text = (const uint8_t*)readAhead.buffers[current] + READ_AHEAD_HEADROOM - carry;
+        long chunkStart = nextRead - carry;
+        int len = carry + got;
+        nextRead += got;
+        
+        bool more = got > 0 && nextRead < end && !indexer.cancel;
+        if (more) {
+            readAheadRequest(file, nextRead, current ^ 1);  // Read on while this chunk is matched
+        }
+        
+        int pos = searchChunk(text, len);
+        if (pos >= 0 || !more) {
+            if (more) {
+                readAheadWait();  // Collect the chunk already asked for
+            }
+            return pos >= 0 ? chunkStart + pos : -1;
+        }
+        
+        carry = min(len, m - 1);
+        current ^= 1;
+        memcpy(readAhead.buffers[current] + READ_AHEAD_HEADROOM - carry, text + len - carry, carry);
+    }
+}
+
+// Horspool over text[0..len), comparing folded bytes. Returns the first
+// match position or -1.
+int searchChunk(const uint8_t* text, int len) {
+    const int m = search.length;
+    const uint8_t* pattern = search.pattern;
+    const uint8_t last = pattern[m - 1];
+    
+    for (int i = 0; i <= len - m;) {
+        uint8_t c = searchFold[text[i + m - 1]];
+        if (c == last) {
+            int j = m - 2;
+            while (j >= 0 && searchFold[text[i + j]] == pattern[j]) {
+                j--;
+            }
+            if (j < 0) {
+                return i;
+            }
+        }
+        i += search.shift[c];
+    }
+    return -1;
+}
+
+// Called by loop() once the search job has ended
+void finishSearch() {
+    if (!reader.fileOpen) {
+        return;  // The book was closed underneath the search
+    }
+    if (search.resumeIndexing) {
+        startBackgroundIndexing(indexer.path, indexer.cache);
+    }
+    
+    if (search.hit < 0) {
+        drawSearchPrompt(search.cancelled ? "Search stopped" : "Not found");
+        return;
+    }
+    
+    // The match may be past what has been paginated so far
+    if (search.hit >= pageTableBack(reader.pages) && readerIndexing()) {
+        drawSearchPrompt("Found - paginating...");
+        waitForOffset(search.hit);
+    }
+    int target = pageTableFindPage(reader.pages, search.hit, reader.file);
+    Serial.printf("Search hit at offset %ld -> page %d\n", search.hit, target + 1);
+    
+    int startPage = reader.currentPage;
+    turnPages(target - reader.currentPage);
+    if (reader.currentPage == startPage) {
+        updateStatusBar();  // Match is on this page - nothing redrew the bar
+    }
+}
+
+long getPagePosition(int page) {
+    // Fresh out of deep sleep the window stands in for the page table
+    const SuspendState& s = suspendState;
+    if (s.windowCount > 0 && page >= s.windowFirst && page < s.windowFirst + s.windowCount) {
+        return s.window[page - s.windowFirst];
+    }
+    return pageTablePosition(reader.pages, page, reader.file);
+}
+
+// Whether getPagePosition() has the page - the window out of deep sleep
+// stands in for only some of them
+bool pagePositionKnown(int page) {
+    const SuspendState& s = suspendState;
+    if (s.windowCount > 0) {
+        return page >= s.windowFirst && page < s.windowFirst + s.windowCount;
+    }
+    return page >= 0 && page < (int)pageTableSize(reader.pages);
+}
+
+// Total pages, or an extrapolation from the bytes indexed so far
+int estimatedTotalPages() {
+    if (!readerIndexing()) {
+        return reader.totalPages;
     }
     
-    // Find cached index for this file
-    FileCache* cache = nullptr;
-    for (int i = 0; i < fileCache.size(); i++) {
-        if (fileCache[i].filename == filename) {
-            cache = &fileCache[i];
+    int pages = pageTableSize(reader.pages);
+    long lastPos = pageTableBack(reader.pages);
+    
+    if (lastPos <= 0) {
+        return pages;
+    }
+    int estimate = (int)(((uint64_t)reader.fileSize * (pages - 1)) / lastPos) + 1;
+    return max(estimate, pages);
+}
+
+// Page counter and percentage for the status bar.
+// Shows "12/~340" while the background indexer is still counting.
+void printPageStatus(Adafruit_GFX& gfx, int y) {
+    bool indexing = readerIndexing();
+    int total = estimatedTotalPages();
+    
+    gfx.setCursor(4, y);
+    gfx.printf(indexing ? "%d/~%d" : "%d/%d", reader.currentPage + 1, total);
+    
+    int percent = total > 1 ? (reader.currentPage * 100) / (total - 1) : 100;
+    gfx.setCursor(70, y);
+    gfx.printf("%d%%", percent);
+}
+
+// Reading time left in the chapter (or the book, if it has no headings) once
+// the words that far have been counted, the page-turn hint until then
+void printChapterStatus(Adafruit_GFX& gfx, int y) {
+    uint32_t words;
+    gfx.setCursor(100, y);
+    if (pageTableWordsToNextChapter(reader.pages, getPagePosition(reader.currentPage), words)) {
+        unsigned long minutes = (words + READING_WPM - 1) / READING_WPM;
+        gfx.printf(pageTableChapterCount(reader.pages) > 0 ? "Ch: %lum left" : "%lum left", minutes);
+    } else {
+        gfx.print("W:Prev S:Next");
+    }
+}
+
+// ============================================================================
+// PAGE RENDER CACHE
+// A small ring of laid-out pages around the current one. After each refresh
+// the neighbours are read and wrapped while the user is reading, so a page
+// turn normally only has to draw.
+// ============================================================================
+
+void invalidatePageCache() {
+    for (int i = 0; i < PAGE_CACHE_SLOTS; i++) {
+        pageCache[i].page = -1;
+    }
+}
+
+RenderedPage* findRenderedPage(int page) {
+    for (int i = 0; i < PAGE_CACHE_SLOTS; i++) {
+        if (pageCache[i].page == page) {
+            return &pageCache[i];
+        }
+    }
+    return nullptr;
+}
+
+// Read a page from SD and compute its line breaks into a free slot,
+// or the one farthest from the current page
+RenderedPage* layoutPage(int page) {
+    PERF_SCOPE(PERF_LAYOUT);
+    RenderedPage* slot = &pageCache[0];
+    int farthest = -1;
+    for (int i = 0; i < PAGE_CACHE_SLOTS; i++) {
+        if (pageCache[i].page < 0) {
+            slot = &pageCache[i];
             break;
         }
+        int distance = abs(pageCache[i].page - reader.currentPage);
+        if (distance > farthest) {
+            farthest = distance;
+            slot = &pageCache[i];
+        }
     }
     
-    String fullPath = String(BOOKS_FOLDER) + "/" + filename;
-    reader.file = SD.open(fullPath.c_str(), FILE_READ);
+    long pagePos = getPagePosition(page);
     
-    if (!reader.file) {
-        Serial.println("Failed to open file!");
-        digitalWrite(SD_CS, HIGH);
+    // Up to where the next page starts, once the indexer knows. The last
+    // page known so far gets the whole buffer and is cut at linesPerPage.
+    // Use readBytes so buffer positions match file offsets (same as indexer)
+    int linesPerPage = layoutLinesPerPage();
+    int bytesToRead = PAGE_BUF_SIZE - 1;
+    if (pagePositionKnown(page + 1)) {
+        bytesToRead = constrain(getPagePosition(page + 1) - pagePos, 0L, (long)PAGE_BUF_SIZE - 1);
+    }
+    int bufLen;
+    lockSpiBus();
+    {
+        PERF_SCOPE(PERF_SD_READ);
+        reader.file.seek(pagePos);
+        bufLen = reader.file.readBytes(slot->text, bytesToRead);
+    }
+    unlockSpiBus();
+    slot->text[bufLen] = '\0';
+    slot->length = bufLen;
+    
+    // Use improved word wrap
+    int lineCount = 0;
+    int pos = 0;
+    while (pos < bufLen && lineCount < linesPerPage) {
+        WrapResult wrap = findLineBreak(slot->text, bufLen, pos, layoutLineWidth(), layoutGlyphWidths());
+        slot->lineStart[lineCount] = pos;
+        slot->lineEnd[lineCount] = min(wrap.lineEnd, bufLen);
+        lineCount++;
+        
+        // Safety check
+        if (wrap.lineEnd >= bufLen) break;
+        pos = wrap.nextStart;
+    }
+    slot->lineCount = lineCount;
+    slot->page = page;
+    
+    return slot;
+}
+
+// Fill the ring with the pages either side of the current one, next first
+void prefetchPages() {
+    if (!reader.fileOpen) {
+        return;
+    }
+    
+    const int offsets[] = {1, -1, 2, -2};
+    for (int i = 0; i < 4; i++) {
+        // The user has already moved on - the next draw lays out its own page
+        if (navigationPending()) {
+            break;
+        }
+        int page = reader.currentPage + offsets[i];
+        if (page >= 0 && page < reader.totalPages && findRenderedPage(page) == nullptr) {
+            layoutPage(page);
+        }
+    }
+}
+
+// ============================================================================
+// GLYPH-RUN TEXT RENDERER
+// Rasterizes the GFX font once into glyphAtlas, then builds each text line
+// as a 1-bpp bitmap and merges it into the frame buffer in one pass (or
+// hands it to GxEPD2 in one drawBitmap() call with RENDER_PAGED), instead
+// of ~38 print() calls per line.
+// ============================================================================
+
+void initGlyphAtlas() {
+    GFXcanvas1 canvas(GLYPH_WIDTH, GLYPH_HEIGHT);
+    canvas.cp437(true);  // Index the font as real CP437, glyphForCodepoint() assumes it
+    
+    for (int c = 0; c < GLYPH_COUNT; c++) {
+        canvas.fillScreen(0);
+        canvas.drawChar(0, 0, c, 1, 0, 1);
+        
+        // Canvas rows are one byte wide with pixels MSB first - same as the atlas
+        const uint8_t* rows = canvas.getBuffer();
+        memcpy(glyphAtlas[c], rows, GLYPH_HEIGHT);
+    }
+    
+    // The font has no ellipsis - three dots on the baseline
+    memset(glyphAtlas[GLYPH_ELLIPSIS], 0, GLYPH_HEIGHT);
+    glyphAtlas[GLYPH_ELLIPSIS][5] = 0xA8;
+    glyphAtlas[GLYPH_ELLIPSIS][6] = 0xA8;
+    
+    // Proportional glyphs are drawn from their first inked column
+    int overhanging = 0;
+    for (int c = 0; c < GLYPH_COUNT; c++) {
+        uint8_t ink = 0;
+        for (int row = 0; row < GLYPH_HEIGHT; row++) {
+            ink |= glyphAtlas[c][row];
+        }
+        glyphInkLeft[c] = ink != 0 ? __builtin_clz((uint32_t)ink) - 24 : 0;
+        int inkWidth = ink != 0 ? 8 - __builtin_ctz(ink) - glyphInkLeft[c] : 0;
+        if (c > ' ' && c < 0x7F && inkWidth >= proportionalWidths[c]) {
+            overhanging++;  // Would touch the next letter
+        }
+    }
+    if (overhanging > 0) {
+        Serial.printf("Glyph atlas: %d glyphs wider than their proportional advance\n", overhanging);
+    }
+}
+
+// OR the glyphs for text[start..end) into a 1-bpp bitmap at pixel column x.
+// Characters without a glyph are skipped without advancing, as they are
+// when the line is wrapped. Returns the column after the last glyph.
+int blitTextLine(uint8_t* bitmap, int bytesPerRow, int x, const char* text, int start, int end) {
+    int maxX = bytesPerRow * 8 - GLYPH_WIDTH;
+    bool proportional = settings.proportional;
+    
+    for (int i = start; i < end && x <= maxX;) {
+        int ch = decodeGlyph(text, end, i);
+        if (ch == GLYPH_INCOMPLETE) {
+            break;
+        }
+        if (ch == GLYPH_SKIP) {
+            continue;
+        }
+        
+        const uint8_t* glyph = glyphAtlas[ch];
+        int trim = proportional ? glyphInkLeft[ch] : 0;
+        int byteIndex = x >> 3;
+        int shift = x & 7;
+        uint8_t* dst = bitmap + byteIndex;
+        
+        for (int row = 0; row < GLYPH_HEIGHT; row++, dst += bytesPerRow) {
+            uint8_t bits = (uint8_t)(glyph[row] << trim);
+            if (bits == 0) continue;
+            dst[0] |= bits >> shift;
+            if (shift > 8 - GLYPH_WIDTH && byteIndex + 1 < bytesPerRow) {
+                dst[1] |= bits << (8 - shift);
+            }
+        }
+        x += proportional ? proportionalWidths[ch] : GLYPH_WIDTH;
+    }
+    return x;
+}
+
+// Draw one line of text with its top-left corner at (x, y)
+void drawTextLine(Adafruit_GFX& gfx, int x, int y, const char* text, int start, int end) {
+    const int bytesPerRow = (SCREEN_WIDTH + 7) / 8;
+    
+    memset(lineBitmap, 0, sizeof(lineBitmap));
+    int endX = blitTextLine(lineBitmap, bytesPerRow, x, text, start, end);
+    if (endX > x) {
+#ifdef RENDER_PAGED
+        gfx.drawBitmap(0, y, lineBitmap, SCREEN_WIDTH, GLYPH_HEIGHT, GxEPD_BLACK);
+#else
+        frame.drawInkRows(lineBitmap, y, GLYPH_HEIGHT);  // gfx is the frame
+#endif
+    }
+}
+
+#ifdef RENDER_BENCHMARK
+// Build with -DRENDER_BENCHMARK to compare per-character printing with the
+// glyph-run renderer on every page drawn (drawing into the buffer only)
+void benchmarkTextRenderer(Adafruit_GFX& gfx, RenderedPage* rendered) {
+    const int RUNS = 10;
+    gfx.setTextSize(1);
+    gfx.setTextColor(GxEPD_BLACK, GxEPD_WHITE);
+    
+    unsigned long start = micros();
+    for (int run = 0; run < RUNS; run++) {
+        for (int line = 0; line < rendered->lineCount; line++) {
+            gfx.setCursor(2, 2 + line * 12);
+            for (int j = rendered->lineStart[line]; j < rendered->lineEnd[line]; j++) {
+                if (rendered->text[j] >= 32) gfx.print(rendered->text[j]);
+            }
+        }
+    }
+    unsigned long printUs = (micros() - start) / RUNS;
+    
+    start = micros();
+    for (int run = 0; run < RUNS; run++) {
+        for (int line = 0; line < rendered->lineCount; line++) {
+            drawTextLine(gfx, 2, 2 + line * 12, rendered->text, rendered->lineStart[line], rendered->lineEnd[line]);
+        }
+    }
+    unsigned long blitUs = (micros() - start) / RUNS;
+    
+    Serial.printf("Render benchmark: print() %lu us/page, glyph runs %lu us/page\n", printUs, blitUs);
+}
+#endif
+
+// ============================================================================
+// SCREEN RENDERING
+// Every screen is a draw function over an Adafruit_GFX. By default it runs
+// exactly once, into the frame buffer, which is then written to the panel
+// in one transfer. With RENDER_PAGED it is handed to GxEPD2's paged loop.
+// The bus is taken here, card deselected; callers that hold it already keep it.
+// ============================================================================
+
+#ifndef RENDER_PAGED
+// Write rows [y, y + height) of the frame to the controller and refresh them
+void pushFrame(bool partialRefresh, int y, int height) {
+    const uint8_t* rows = frame.getBuffer() + y * FRAME_BYTES_PER_ROW;
+    
+    display.epd2.writeImage(rows, 0, y, SCREEN_WIDTH, height);
+    if (partialRefresh) {
+        display.epd2.refresh(0, y, SCREEN_WIDTH, height);
+    } else {
+        display.epd2.refresh(false);
+    }
+    // The controller diffs against its previous image on partial updates
+    if (display.epd2.hasFastPartialUpdate) {
+        display.epd2.writeImageAgain(rows, 0, y, SCREEN_WIDTH, height);
+    }
+    if (!partialRefresh) {
+        display.epd2.powerOff();
+    }
+}
+#endif
+
+// Full-screen draw with a full refresh
+void renderScreen(const ScreenDrawFn& draw) {
+    lockDisplayBus();
+    PERF_KEY_REFRESH_BEGIN();
+#ifdef RENDER_PAGED
+    {
+        PERF_SCOPE(PERF_EPD_FULL);  // Drawing is interleaved with the transfer
         display.setFullWindow();
         display.firstPage();
         do {
-            display.fillScreen(GxEPD_WHITE);
-            display.setTextColor(GxEPD_BLACK);
-            display.setCursor(30, 140);
-            display.setTextSize(2);
-            display.println("FAILED TO");
-            display.setCursor(30, 170);
-            display.println("OPEN FILE");
+            draw(display);
         } while (display.nextPage());
-        delay(2000);
-        displayFileList();
+    }
+#else
+    {
+        PERF_SCOPE(PERF_DRAW);
+        draw(frame);
+    }
+    {
+        PERF_SCOPE(PERF_EPD_FULL);
+        pushFrame(false, 0, SCREEN_HEIGHT);
+    }
+#endif
+    PERF_KEY_REFRESH_END();
+    unlockSpiBus();
+}
+
+// Partial refresh of the full-width band [y, y + height). draw() may redraw
+// just that band - the rest of the frame keeps what is on screen.
+void renderScreenPartial(const ScreenDrawFn& draw, int y, int height) {
+    lockDisplayBus();
+    PERF_KEY_REFRESH_BEGIN();
+#ifdef RENDER_PAGED
+    {
+        PERF_SCOPE(PERF_EPD_PARTIAL);
+        display.setPartialWindow(0, y, SCREEN_WIDTH, height);
+        display.firstPage();
+        do {
+            draw(display);
+        } while (display.nextPage());
+    }
+#else
+    {
+        PERF_SCOPE(PERF_DRAW);
+        draw(frame);
+    }
+    {
+        PERF_SCOPE(PERF_EPD_PARTIAL);
+        pushFrame(true, y, height);
+    }
+#endif
+    PERF_KEY_REFRESH_END();
+    unlockSpiBus();
+}
+
+// ============================================================================
+// PARTIAL SCREEN REFRESH FOR STATUS BAR
+// ============================================================================
+
+void updateStatusBar() {
+    const int STATUS_BAR_HEIGHT = 14;
+    int statusY = SCREEN_HEIGHT - STATUS_BAR_HEIGHT;
+    
+    lockSpiBus();
+    
+    // Use partial window for just the status bar area
+    renderScreenPartial([&](Adafruit_GFX& gfx) {
+        // Clear status bar area
+        gfx.fillRect(0, statusY, SCREEN_WIDTH, STATUS_BAR_HEIGHT, GxEPD_WHITE);
+        
+        gfx.setTextColor(GxEPD_BLACK, GxEPD_WHITE);
+        gfx.setTextSize(1);
+        
+        // Separator line
+        gfx.drawFastHLine(0, statusY, SCREEN_WIDTH, GxEPD_BLACK);
+        
+        int textY = statusY + 3;
+        
+        // Page numbers and percentage
+        printPageStatus(gfx, textY);
+        printChapterStatus(gfx, textY);
+        
+        gfx.setCursor(195, textY);
+        gfx.print("Q:Exit");
+        
+    }, statusY, STATUS_BAR_HEIGHT);
+    
+    unlockSpiBus();
+    
+    lastDisplayedPage = reader.currentPage;
+    lastDisplayedTotal = reader.totalPages;
+}
+
+// Full page display (used for first display or after exiting/entering)
+void displayPageFull() {
+    drawReadingPage(false);
+}
+
+// Fast page turn - partial refresh of the whole screen, as the page number
+// in the status bar changes along with the text
+void displayPagePartial() {
+    drawReadingPage(true);
+}
+
+void drawReadingPage(bool partialRefresh) {
+    if (!reader.fileOpen || reader.currentPage >= reader.totalPages) {
+        Serial.println("Cannot display page - invalid state");
+        return;
+    }
+    
+    const int STATUS_BAR_HEIGHT = 14;
+    const int LINE_HEIGHT = 12;
+    
+    // Page content is laid out BEFORE display operations - usually by prefetch
+    unsigned long layoutStart = micros();
+    RenderedPage* rendered = findRenderedPage(reader.currentPage);
+    bool cacheHit = rendered != nullptr;
+    if (!cacheHit) {
+        rendered = layoutPage(reader.currentPage);
+    }
+    PERF_COUNT(cacheHit ? PERF_PAGE_CACHE_HIT : PERF_PAGE_CACHE_MISS, 1);
+    
+    LOG_VERBOSE("drawReadingPage: page %d, %d bytes, %s (%lu us)\n", reader.currentPage + 1,
+                rendered->length, cacheHit ? "prefetched" : "read from SD", micros() - layoutStart);
+    
+    // More page turns arrived while laying out - leave the screen to them
+    if (navigationPending()) {
+        LOG_VERBOSE("  Superseded by queued keys - skipping refresh\n");
+        return;
+    }
+    
+    ScreenDrawFn draw = [&](Adafruit_GFX& gfx) {
+#ifdef RENDER_BENCHMARK
+        benchmarkTextRenderer(gfx, rendered);
+#endif
+        gfx.fillScreen(GxEPD_WHITE);
+        gfx.setTextColor(GxEPD_BLACK, GxEPD_WHITE);
+        gfx.setTextSize(1);
+        
+        int y = 2;
+        
+        // Line breaks were computed by layoutPage()
+        for (int line = 0; line < rendered->lineCount; line++) {
+            drawTextLine(gfx, 2, y, rendered->text, rendered->lineStart[line], rendered->lineEnd[line]);
+            y += LINE_HEIGHT;
+        }
+        
+        // Status bar
+        gfx.setTextSize(1);
+        int statusY = SCREEN_HEIGHT - STATUS_BAR_HEIGHT + 3;
+        gfx.drawFastHLine(0, SCREEN_HEIGHT - STATUS_BAR_HEIGHT, SCREEN_WIDTH, GxEPD_BLACK);
+        
+        printPageStatus(gfx, statusY);
+        printChapterStatus(gfx, statusY);
+        
+        gfx.setCursor(195, statusY);
+        gfx.print("Q:Exit");
+    };
+    
+    lockSpiBus();
+    
+    unsigned long refreshStart = millis();
+    int pagesBefore = reader.totalPages;
+    uint32_t lentBefore = spiBus.lentBytes;
+    if (partialRefresh) {
+        renderScreenPartial(draw, 0, SCREEN_HEIGHT);
+    } else {
+        renderScreen(draw);
+    }
+    
+    unlockSpiBus();
+    
+    unsigned long refreshMs = millis() - refreshStart;
+    turnsSinceFullRefresh = partialRefresh ? turnsSinceFullRefresh + 1 : 0;
+    
+    lastDisplayedPage = reader.currentPage;
+    lastDisplayedTotal = reader.totalPages;
+    notePositionChange();
+    
+    LOG_VERBOSE("Displayed page %d/%d: %s refresh %lu ms (%d/%d partial turns), indexer +%d pages, %lu KB read meanwhile\n",
+                reader.currentPage + 1, reader.totalPages, partialRefresh ? "partial" : "full",
+                refreshMs, turnsSinceFullRefresh, settings.fullRefreshEvery - 1,
+                reader.totalPages - pagesBefore, (unsigned long)(spiBus.lentBytes - lentBefore) / 1024);
+    
+    // Get the neighbours ready while the user reads this one
+    prefetchPages();
+}
+
+// Regular page display - page turns use partial refresh, with a full
+// refresh every settings.fullRefreshEvery turns to clear ghosting
+void displayPage() {
+    bool needFull = lastDisplayedPage < 0 ||
+                    settings.fullRefreshEvery <= 1 ||
+                    turnsSinceFullRefresh >= settings.fullRefreshEvery - 1;
+    if (needFull) {
+        displayPageFull();
+    } else {
+        displayPagePartial();
+    }
+}
+
+// Move by delta pages - the net of all coalesced page-turn keys - and draw
+// only the page we end up on
+void turnPages(int delta) {
+    if (!reader.fileOpen) {
+        return;
+    }
+    
+    int target = max(0, reader.currentPage + delta);
+    
+    // Only block on the indexer if the target is beyond what it has reached
+    if (target >= reader.totalPages) {
+        waitForPage(target);
+    }
+    target = min(target, (int)reader.totalPages - 1);
+    
+    // A superseded render can leave the screen behind currentPage
+    if (target == reader.currentPage && target == lastDisplayedPage) {
+        return;
+    }
+    
+    LOG_VERBOSE("Turn %+d: page %d -> %d\n", delta, reader.currentPage + 1, target + 1);
+    PERF_TURN_BEGIN();
+    reader.currentPage = target;
+    displayPage();
+    PERF_TURN_END(!indexer.running);
+}
+
+// ============================================================================
+// GO TO PAGE / PERCENT
+// Typed in the status bar. The jump goes through turnPages(), so a target
+// past the indexed part only waits for the indexer to get that far.
+// ============================================================================
+
+void beginGotoInput() {
+    gotoInput.active = true;
+    gotoInput.length = 0;
+    gotoInput.digits[0] = '\0';
+    drawGotoPrompt();
+}
+
+void handleGotoKey(uint8_t key) {
+    if (key >= '0' && key <= '9') {
+        if (gotoInput.length < GOTO_MAX_DIGITS) {
+            gotoInput.digits[gotoInput.length++] = key;
+            gotoInput.digits[gotoInput.length] = '\0';
+            drawGotoPrompt();
+        }
+        return;
+    }
+    
+    if (key == '\b') {
+        if (gotoInput.length > 0) {
+            gotoInput.digits[--gotoInput.length] = '\0';
+            drawGotoPrompt();
+        }
+        return;
+    }
+    
+    bool toPage = key == '\r' || key == '\n';
+    bool toPercent = key == 'p';
+    if (!toPage && !toPercent && key != 'q' && key != 0x1B) {
+        return;
+    }
+    
+    gotoInput.active = false;
+    long value = gotoInput.length > 0 ? atol(gotoInput.digits) : -1;
+    if (value < 0 || key == 'q' || key == 0x1B) {
+        updateStatusBar();  // Cancelled - put the page status back
+        return;
+    }
+    
+    int target;
+    if (toPercent) {
+        // Same scale as the status bar percentage
+        int total = estimatedTotalPages();
+        target = (int)(((long long)min(value, 100L) * (total - 1)) / 100);
+    } else {
+        target = (int)max(value - 1, 0L);
+    }
+    
+    LOG_VERBOSE("Go to %ld%s -> page %d\n", value, toPercent ? "%" : "", target + 1);
+    int startPage = reader.currentPage;
+    turnPages(target - reader.currentPage);
+    if (reader.currentPage == startPage) {
+        updateStatusBar();  // Clamped to where we already were - nothing redrew the bar
+    }
+}
+
+void drawGotoPrompt() {
+    const int STATUS_BAR_HEIGHT = 14;
+    int statusY = SCREEN_HEIGHT - STATUS_BAR_HEIGHT;
+    
+    lockSpiBus();
+    
+    renderScreenPartial([&](Adafruit_GFX& gfx) {
+        gfx.fillRect(0, statusY, SCREEN_WIDTH, STATUS_BAR_HEIGHT, GxEPD_WHITE);
+        gfx.drawFastHLine(0, statusY, SCREEN_WIDTH, GxEPD_BLACK);
+        gfx.setTextColor(GxEPD_BLACK, GxEPD_WHITE);
+        gfx.setTextSize(1);
+        
+        gfx.setCursor(4, statusY + 3);
+        gfx.printf("Go to: %s_", gotoInput.digits);
+        
+        gfx.setCursor(112, statusY + 3);
+        gfx.print("ENT:Page P:% Q:X");
+    }, statusY, STATUS_BAR_HEIGHT);
+    
+    unlockSpiBus();
+}
+
+void beginSearchInput() {
+    search.editing = true;
+    search.length = 0;
+    search.query[0] = '\0';
+    drawSearchPrompt(nullptr);
+}
+
+// Every key is text while typing the query, so Backspace on an empty
+// query is what cancels
+void handleSearchKey(uint8_t key) {
+    if (key == '\b') {
+        if (search.length == 0) {
+            search.editing = false;
+            updateStatusBar();
+            return;
+        }
+        search.query[--search.length] = '\0';
+        drawSearchPrompt(nullptr);
+        return;
+    }
+    
+    if (key == '\r' || key == '\n') {
+        search.editing = false;
+        if (search.length > 0) {
+            startSearch();
+        } else {
+            updateStatusBar();
+        }
+        return;
+    }
+    
+    if (key >= 32 && key < 127 && search.length < SEARCH_MAX_CHARS) {
+        search.query[search.length++] = key;
+        search.query[search.length] = '\0';
+        drawSearchPrompt(nullptr);
+    }
+}
+
+// The query being typed, or a message about the search, in the status band
+void drawSearchPrompt(const char* message) {
+    if (message != nullptr) {
+        drawStatusMessage(message);
         return;
     }
     
-    reader.currentFile = filename;
-    reader.fileOpen = true;
-    reader.currentPage = 0;
-    reader.pagePositions.clear();
+    const int STATUS_BAR_HEIGHT = 14;
+    int statusY = SCREEN_HEIGHT - STATUS_BAR_HEIGHT;
+    
+    lockSpiBus();
+    
+    renderScreenPartial([&](Adafruit_GFX& gfx) {
+        gfx.fillRect(0, statusY, SCREEN_WIDTH, STATUS_BAR_HEIGHT, GxEPD_WHITE);
+        gfx.drawFastHLine(0, statusY, SCREEN_WIDTH, GxEPD_BLACK);
+        gfx.setTextColor(GxEPD_BLACK, GxEPD_WHITE);
+        gfx.setTextSize(1);
+        
+        gfx.setCursor(4, statusY + 3);
+        gfx.printf("Find: %s_", search.query);
+        gfx.setCursor(178, statusY + 3);
+        gfx.print("ENT:Go");
+    }, statusY, STATUS_BAR_HEIGHT);
+    
+    unlockSpiBus();
+}
+
+// A line of text in place of the status bar, until the next redraw
+void drawStatusMessage(const char* message) {
+    const int STATUS_BAR_HEIGHT = 14;
+    int statusY = SCREEN_HEIGHT - STATUS_BAR_HEIGHT;
+    
+    lockSpiBus();
     
-    // Reset partial refresh tracking
-    lastDisplayedPage = -1;
-    lastDisplayedTotal = -1;
+    renderScreenPartial([&](Adafruit_GFX& gfx) {
+        gfx.fillRect(0, statusY, SCREEN_WIDTH, STATUS_BAR_HEIGHT, GxEPD_WHITE);
+        gfx.drawFastHLine(0, statusY, SCREEN_WIDTH, GxEPD_BLACK);
+        gfx.setTextColor(GxEPD_BLACK, GxEPD_WHITE);
+        gfx.setTextSize(1);
+        gfx.setCursor(4, statusY + 3);
+        gfx.print(message);
+    }, statusY, STATUS_BAR_HEIGHT);
     
-    // Use cached index if available
-    if (cache != nullptr) {
-        Serial.printf("Using cached index (%d pages pre-indexed)\n", cache->pagePositions.size());
+    unlockSpiBus();
+}
+
+void closeBook() {
+    if (reader.fileOpen) {
+        Serial.println("Closing book");
         
-        // Copy cached page positions
-        for (int i = 0; i < cache->pagePositions.size(); i++) {
-            reader.pagePositions.push_back(cache->pagePositions[i]);
-        }
+        // Let the indexer save its progress and release the book first
+        stopBackgroundIndexing();
         
-        // Restore reading position!
-        if (cache->lastReadPage > 0 && cache->lastReadPage < cache->pagePositions.size()) {
-            reader.currentPage = cache->lastReadPage;
-            Serial.printf("Resuming at page %d\n", reader.currentPage + 1);
-        }
+        // Save reading position before closing! The offset is what survives
+        // a layout change, the page is a shortcut while the layout stays put
+        long offset = getPagePosition(reader.currentPage);
         
-        // If fully indexed, we're done
-        if (cache->fullyIndexed) {
-            reader.totalPages = reader.pagePositions.size();
-            Serial.printf("File fully pre-indexed: %d pages\n", reader.totalPages);
-            displayPageFull();
-            return;
+        // Update the cache first - index saves copy the position from it
+        FileCache* cache = findFileCache(reader.currentFile);
+        if (cache != nullptr) {
+            cache->lastReadPage = reader.currentPage;
+            cache->readOffset = offset;
+            cache->readSequence = ++lastReadSequence;
         }
+        if (!saveReadingPosition(reader.currentFile, reader.currentPage, offset)) {
+            flushPositionJournal();  // The journal still has it for next boot
+        }
+        journal.dirty = false;
+        journal.page = -1;
         
-        // Otherwise, continue indexing from where cache left off
-        Serial.println("Continuing indexing from cache...");
-        showIndexingScreen(filename);
-        
-        // Continue indexing from last cached position using word-wrap logic
-        long lastCachedPos = cache->pagePositions.back();
-        indexPagesWordWrap(reader.file, lastCachedPos, reader.pagePositions, 0);
-    } else {
-        // No cache - show loading and index from scratch
-        Serial.println("No cache - indexing from start...");
-        showIndexingScreen(filename);
-        reader.pagePositions.push_back(0);
+        // The book's FileCache entry keeps its own reference to the page
+        // table while the book stays warm
+        if (cache != nullptr && cache->pages == reader.pages) {
+            keepWarmBook(cache, reader.file, findRenderedPage(reader.currentPage));
+        } else {
+            lockSpiBus();
+            reader.file.close();
+            unlockSpiBus();
+        }
+        reader.file = BookFile();
+        reader.fileOpen = false;
+        chapterList.active = false;
         
-        // Index entire file using word-wrap logic
-        indexPagesWordWrap(reader.file, 0, reader.pagePositions, 0);
-    }
-    
-    reader.totalPages = reader.pagePositions.size();
-    Serial.printf("Total pages: %d\n", reader.totalPages);
-    
-    // Save the complete index to SD for next time (with current position)
-    if (saveIndexToSD(filename, reader.pagePositions, reader.file.size(), true, reader.currentPage)) {
-        Serial.println("Full index saved to SD card");
+        pageTableRelease(reader.pages);
+        reader.pages = nullptr;
+        invalidatePageCache();
     }
-    
-    displayPageFull();
 }
 
 // ============================================================================
-// IMPROVED WORD WRAP LOGIC
+// WARM BOOKS
+// A book left stays open in a slot: its file handle (and block cache for a
+// .txtz), its page table and the page it was left on. Evicting one closes
+// the file and lets go of the table.
 // ============================================================================
 
-// Find the best line break point, handling edge cases
-WrapResult findLineBreak(const char* buffer, int bufLen, int lineStart, int maxChars) {
-    WrapResult result;
-    result.lineEnd = lineStart;
-    result.nextStart = lineStart;
-    
-    if (lineStart >= bufLen) {
-        return result;
+void initWarmBooks() {
+    for (int i = 0; i < WARM_BOOKS; i++) {
+        warmBooks[i].cache = nullptr;
+        warmBooks[i].page = (RenderedPage*)psramRealloc(nullptr, sizeof(RenderedPage));
     }
-    
-    int charCount = 0;
-    int lastBreakPoint = -1;  // Position of last good break opportunity
-    int lastBreakCharCount = 0;
-    bool inWord = false;
-    
-    for (int i = lineStart; i < bufLen; i++) {
-        char c = buffer[i];
-        
-        // Hard line break - always honor
-        if (c == '\n') {
-            result.lineEnd = i;
-            result.nextStart = i + 1;
-            // Skip \r if present after \n (or before)
-            if (result.nextStart < bufLen && buffer[result.nextStart] == '\r') {
-                result.nextStart++;
-            }
-            return result;
+}
+
+WarmBook* findWarmBook(const FileCache* cache) {
+    for (int i = 0; i < WARM_BOOKS && cache != nullptr; i++) {
+        if (warmBooks[i].cache == cache) {
+            return &warmBooks[i];
         }
-        
-        if (c == '\r') {
-            result.lineEnd = i;
-            result.nextStart = i + 1;
-            // Skip \n if present after \r
-            if (result.nextStart < bufLen && buffer[result.nextStart] == '\n') {
-                result.nextStart++;
+    }
+    return nullptr;
+}
+
+// Take over the file of a book being closed. Its page table stays in
+// cache->pages for as long as the book is warm.
+void keepWarmBook(FileCache* cache, BookFile& file, const RenderedPage* page) {
+    size_t bytes = pageTableBytes(cache->pages) + file.cacheBytes();
+    if (bytes > WARM_BUDGET_BYTES) {
+        // Evicting would only empty the warm set for a book that can't fit
+        LOG_VERBOSE("  %s too large to keep warm (%u KB)\n", cache->filename, (unsigned)(bytes / 1024));
+        closeColdBook(cache, file);
+        return;
+    }
+    for (;;) {
+        WarmBook* oldest = nullptr;
+        WarmBook* empty = nullptr;
+        size_t used = 0;
+        for (int i = 0; i < WARM_BOOKS; i++) {
+            WarmBook& warm = warmBooks[i];
+            if (warm.cache == nullptr) {
+                empty = warm.page != nullptr ? &warm : empty;
+                continue;
+            }
+            used += warm.bytes;
+            if (oldest == nullptr || warm.lastUse < oldest->lastUse) {
+                oldest = &warm;
             }
-            return result;
         }
         
-        // Track printable characters for line width
-        if (c >= 32) {
-            charCount++;
-            
-            // Track word boundaries for smart wrapping
-            if (c == ' ' || c == '\t') {
-                if (inWord) {
-                    // Just finished a word - this is a good break point
-                    lastBreakPoint = i;
-                    lastBreakCharCount = charCount;
-                    inWord = false;
-                }
-            } else if (c == '-') {
-                // Hyphen - can break after it if we're in a word
-                if (inWord) {
-                    lastBreakPoint = i + 1;  // Break AFTER the hyphen
-                    lastBreakCharCount = charCount;
-                }
+        if (empty != nullptr && used + bytes <= WARM_BUDGET_BYTES) {
+            empty->cache = cache;
+            empty->file = file;
+            empty->bytes = bytes;
+            empty->lastUse = ++warmUseCount;
+            if (page != nullptr) {
+                memcpy(empty->page, page, sizeof(RenderedPage));
             } else {
-                inWord = true;
-            }
-            
-            // Check if we've exceeded line width
-            if (charCount >= maxChars) {
-                if (lastBreakPoint > lineStart) {
-                    // We have a good break point - use it
-                    result.lineEnd = lastBreakPoint;
-                    result.nextStart = lastBreakPoint;
-                    
-                    // Skip whitespace at break point
-                    while (result.nextStart < bufLen && 
-                           (buffer[result.nextStart] == ' ' || buffer[result.nextStart] == '\t')) {
-                        result.nextStart++;
-                    }
-                } else {
-                    // No good break point - force break mid-word
-                    // Back up one character so we don't exceed maxChars
-                    result.lineEnd = i;
-                    result.nextStart = i;
-                }
-                return result;
+                empty->page->page = -1;
             }
+            LOG_VERBOSE("  Kept %s warm (%u KB)\n", cache->filename, (unsigned)(bytes / 1024));
+            return;
+        }
+        if (oldest == nullptr) {
+            break;  // No slot memory
         }
+        evictWarmBook(*oldest);
     }
-    
-    // Reached end of buffer
-    result.lineEnd = bufLen;
-    result.nextStart = bufLen;
-    return result;
+    closeColdBook(cache, file);
 }
 
-// ============================================================================
-// WORD-WRAP AWARE PAGE INDEXER
-// Uses the same findLineBreak logic as the display so pages match exactly.
-// Reads raw bytes so buffer positions map 1:1 to file offsets.
-// ============================================================================
-
-int indexPagesWordWrap(File& file, long startPos, std::vector<long>& pagePositions, int maxPages) {
-    const int CHARS_PER_LINE = 38;
-    const int LINES_PER_PAGE = 25;
-    const int BUF_SIZE = 2048;
-    char buffer[BUF_SIZE];
-
-    file.seek(startPos);
-    int pagesAdded = 0;
-    int lineCount = 0;
-
-    // We read overlapping chunks: after processing a chunk we may have
-    // a partial line at the end.  We keep that remainder and prepend it
-    // to the next read.
-    int leftover = 0;
-    long chunkFileStart = startPos;  // file offset corresponding to buffer[0]
-
-    while (file.available() && (maxPages <= 0 || pagesAdded < maxPages)) {
-        // Read next chunk (after any leftover bytes already in buffer)
-        int bytesRead = file.readBytes(buffer + leftover, BUF_SIZE - leftover);
-        int bufLen = leftover + bytesRead;
-        if (bufLen == 0) break;
-
-        int pos = 0;
-        while (pos < bufLen) {
-            WrapResult wrap = findLineBreak(buffer, bufLen, pos, CHARS_PER_LINE);
-
-            // If findLineBreak couldn't make progress we need more data
-            if (wrap.nextStart <= pos && wrap.lineEnd >= bufLen) break;
-
-            lineCount++;
-            pos = wrap.nextStart;
-
-            if (lineCount >= LINES_PER_PAGE) {
-                long pageFilePos = chunkFileStart + pos;
-                pagePositions.push_back(pageFilePos);
-                pagesAdded++;
-                lineCount = 0;
-
-                if (maxPages > 0 && pagesAdded >= maxPages) break;
-            }
+// Close a book that isn't being kept warm
+void closeColdBook(FileCache* cache, BookFile& file) {
+    lockSpiBus();
+    file.close();
+    unlockSpiBus();
+    pageTableRelease(cache->pages);
+    cache->pages = nullptr;
+}
 
-            if (pos >= bufLen) break;
-        }
+void evictWarmBook(WarmBook& warm) {
+    LOG_VERBOSE("  Evicting %s from the warm books\n", warm.cache->filename);
+    lockSpiBus();
+    warm.file.close();
+    unlockSpiBus();
+    warm.file = BookFile();
+    
+    // Callers have stopped the indexer, so nothing is about to retain it
+    pageTableRelease(warm.cache->pages);
+    warm.cache->pages = nullptr;
+    warm.cache = nullptr;
+}
 
-        // Keep unprocessed bytes for next iteration
-        leftover = bufLen - pos;
-        if (leftover > 0 && leftover < BUF_SIZE) {
-            memmove(buffer, buffer + pos, leftover);
-        } else {
-            leftover = 0;
+// Before the library is rescanned or the card is let go
+void clearWarmBooks() {
+    for (int i = 0; i < WARM_BOOKS; i++) {
+        if (warmBooks[i].cache != nullptr) {
+            evictWarmBook(warmBooks[i]);
         }
-        chunkFileStart = file.position() - leftover;
     }
-
-    return pagesAdded;
 }
 
 // ============================================================================
-// PARTIAL SCREEN REFRESH FOR STATUS BAR
+// CONTENTS SCREEN
+// The headings found while paginating, a window of rows at a time like the
+// file list. Enter jumps to the page a heading is on.
 // ============================================================================
 
-void updateStatusBar() {
-    const int STATUS_BAR_HEIGHT = 14;
-    int statusY = SCREEN_HEIGHT - STATUS_BAR_HEIGHT;
-    
-    // Deselect SD card to free SPI bus for display
-    digitalWrite(SD_CS, HIGH);
-    
-    // Use partial window for just the status bar area
-    display.setPartialWindow(0, statusY, SCREEN_WIDTH, STATUS_BAR_HEIGHT);
-    display.firstPage();
-    do {
-        // Clear status bar area
-        display.fillRect(0, statusY, SCREEN_WIDTH, STATUS_BAR_HEIGHT, GxEPD_WHITE);
-        
-        display.setTextColor(GxEPD_BLACK, GxEPD_WHITE);
-        display.setTextSize(1);
-        
-        // Separator line
-        display.drawFastHLine(0, statusY, SCREEN_WIDTH, GxEPD_BLACK);
-        
-        int textY = statusY + 3;
-        
-        // Page numbers
-        display.setCursor(4, textY);
-        display.printf("%d/%d", reader.currentPage + 1, reader.totalPages);
-        
-        // Percentage
-        int percent = reader.totalPages > 1 ? 
-            (reader.currentPage * 100) / (reader.totalPages - 1) : 100;
-        display.setCursor(70, textY);
-        display.printf("%d%%", percent);
-        
-        // Controls hint
-        display.setCursor(100, textY);
-        display.print("W:Prev S:Next");
-        
-        display.setCursor(195, textY);
-        display.print("Q:Exit");
-        
-    } while (display.nextPage());
-    
-    lastDisplayedPage = reader.currentPage;
-    lastDisplayedTotal = reader.totalPages;
-}
-
-// Full page display (used for first display or after exiting/entering)
-void displayPageFull() {
-    if (!reader.fileOpen || reader.currentPage >= reader.totalPages) {
-        Serial.println("Cannot display page - invalid state");
+void openChapterList() {
+    if (pageTableChapterCount(reader.pages) == 0) {
+        drawStatusMessage(readerIndexing() ? "No chapters found yet" : "No chapters found");
         return;
     }
     
-    const int STATUS_BAR_HEIGHT = 14;
-    const int TEXT_AREA_HEIGHT = SCREEN_HEIGHT - STATUS_BAR_HEIGHT;
-    const int LINE_HEIGHT = 12;
-    const int MAX_LINES = TEXT_AREA_HEIGHT / LINE_HEIGHT;
-    const int CHARS_PER_LINE = 38;
-    
-    long pagePos = reader.pagePositions[reader.currentPage];
-    reader.file.seek(pagePos);
-    
-    Serial.printf("displayPageFull: page %d, pos %ld\n", reader.currentPage + 1, pagePos);
-    
-    // Read page content into buffer BEFORE display operations
-    // Use readBytes so buffer positions match file offsets (same as indexer)
-    const int BUF_SIZE = 2048;
-    char buffer[BUF_SIZE];
-    int bytesToRead = min((int)(BUF_SIZE - 1), MAX_LINES * CHARS_PER_LINE * 3);
-    int bufLen = reader.file.readBytes(buffer, bytesToRead);
-    buffer[bufLen] = '\0';
+    // Start on the chapter being read
+    int current = pageTableChapterAt(reader.pages, getPagePosition(reader.currentPage));
+    chapterList.active = true;
+    chapterList.selected = max(current, 0);
+    drawChapterList(false);
+}
+
+void drawChapterList(bool partialRefresh) {
+    const int TITLE_WIDTH = SCREEN_WIDTH - 56;  // Pixels, from x = 16 up to the page number
+    int count = pageTableChapterCount(reader.pages);
+    chapterList.top = chapterList.selected / LIBRARY_VISIBLE_ROWS * LIBRARY_VISIBLE_ROWS;
+    int rows = min(count - chapterList.top, LIBRARY_VISIBLE_ROWS);
     
-    Serial.printf("displayPageFull: read %d bytes\n", bufLen);
+    // Look the pages up before taking the display - a sparse table may
+    // have to read the book for them
+    Chapter chapters[LIBRARY_VISIBLE_ROWS];
+    int pages[LIBRARY_VISIBLE_ROWS];
+    for (int i = 0; i < rows; i++) {
+        chapters[i] = pageTableChapter(reader.pages, chapterList.top + i);
+        pages[i] = pageTableFindPage(reader.pages, chapters[i].offset, reader.file);
+    }
     
-    // Deselect SD card to free SPI bus for display
-    digitalWrite(SD_CS, HIGH);
+    lockSpiBus();
     
-    display.setFullWindow();
-    display.firstPage();
-    do {
-        display.fillScreen(GxEPD_WHITE);
-        display.setTextColor(GxEPD_BLACK, GxEPD_WHITE);
-        display.setTextSize(1);
+    ScreenDrawFn draw = [&](Adafruit_GFX& gfx) {
+        gfx.fillScreen(GxEPD_WHITE);
+        gfx.setTextColor(GxEPD_BLACK, GxEPD_WHITE);
         
-        int y = 2;
-        int lineCount = 0;
-        int pos = 0;
+        gfx.setCursor(10, 5);
+        gfx.setTextSize(2);
+        gfx.println("CONTENTS");
+        gfx.setTextSize(1);
+        gfx.drawFastHLine(0, 25, SCREEN_WIDTH, GxEPD_BLACK);
         
-        // Use improved word wrap
-        while (pos < bufLen && lineCount < MAX_LINES) {
-            WrapResult wrap = findLineBreak(buffer, bufLen, pos, CHARS_PER_LINE);
-            
-            // Draw this line
-            display.setCursor(2, y);
-            for (int j = pos; j < wrap.lineEnd && j < bufLen; j++) {
-                char ch = buffer[j];
-                if (ch >= 32) {  // Only print printable characters
-                    display.print(ch);
-                }
+        for (int i = 0; i < rows; i++) {
+            int y = LIBRARY_FIRST_ROW_Y + i * LIBRARY_ROW_HEIGHT;
+            bool isSelected = chapterList.top + i == chapterList.selected;
+            if (isSelected) {
+                gfx.drawRect(0, y - 4, SCREEN_WIDTH, LIBRARY_ROW_HEIGHT, GxEPD_BLACK);
             }
+            gfx.setCursor(4, y);
+            gfx.print(isSelected ? ">" : " ");
             
-            y += LINE_HEIGHT;
-            lineCount++;
-            pos = wrap.nextStart;
+            // Titles come from the book, so they are wrapped and drawn like its text
+            WrapResult fit = findLineBreak(chapters[i].title, strlen(chapters[i].title), 0,
+                                           settings.proportional ? TITLE_WIDTH : TITLE_WIDTH / GLYPH_WIDTH,
+                                           layoutGlyphWidths());
+            drawTextLine(gfx, 16, y, chapters[i].title, 0, fit.lineEnd);
             
-            // Safety check
-            if (wrap.nextStart <= pos && wrap.lineEnd >= bufLen) break;
-            if (pos >= bufLen) break;
+            char page[12];
+            snprintf(page, sizeof(page), "%d", pages[i] + 1);
+            gfx.setCursor(SCREEN_WIDTH - 4 - GLYPH_WIDTH * strlen(page), y);
+            gfx.print(page);
         }
         
-        // Status bar
-        display.setTextSize(1);
-        int statusY = SCREEN_HEIGHT - STATUS_BAR_HEIGHT + 3;
-        display.drawFastHLine(0, SCREEN_HEIGHT - STATUS_BAR_HEIGHT, SCREEN_WIDTH, GxEPD_BLACK);
-        
-        display.setCursor(4, statusY);
-        display.printf("%d/%d", reader.currentPage + 1, reader.totalPages);
-        
-        int percent = reader.totalPages > 1 ? 
-            (reader.currentPage * 100) / (reader.totalPages - 1) : 100;
-        display.setCursor(70, statusY);
-        display.printf("%d%%", percent);
-        
-        display.setCursor(100, statusY);
-        display.print("W:Prev S:Next");
+        int windows = (count + LIBRARY_VISIBLE_ROWS - 1) / LIBRARY_VISIBLE_ROWS;
+        gfx.setCursor(5, SCREEN_HEIGHT - 22);
+        gfx.printf("%d chapters%s  pg %d/%d", count, readerIndexing() ? " so far" : "",
+                   chapterList.top / LIBRARY_VISIBLE_ROWS + 1, windows);
         
-        display.setCursor(195, statusY);
-        display.print("Q:Exit");
-        
-    } while (display.nextPage());
-    
-    lastDisplayedPage = reader.currentPage;
-    lastDisplayedTotal = reader.totalPages;
+        gfx.drawFastHLine(0, SCREEN_HEIGHT - 12, SCREEN_WIDTH, GxEPD_BLACK);
+        gfx.setCursor(5, SCREEN_HEIGHT - 8);
+        gfx.print("ENT=Go W/S=Move Q=Back");
+    };
     
-    Serial.printf("Displayed page %d/%d\n", reader.currentPage + 1, reader.totalPages);
-}
-
-// Regular page display - uses full refresh since content changes
-void displayPage() {
-    // For e-paper, full refresh is generally better for text content
-    // to avoid ghosting. We use partial refresh only for status bar updates.
-    displayPageFull();
-}
-
-void nextPage() {
-    if (reader.fileOpen && reader.currentPage < reader.totalPages - 1) {
-        reader.currentPage++;
-        Serial.printf("Next page: %d\n", reader.currentPage + 1);
-        displayPage();
-    }
-}
-
-void prevPage() {
-    if (reader.fileOpen && reader.currentPage > 0) {
-        reader.currentPage--;
-        Serial.printf("Previous page: %d\n", reader.currentPage + 1);
-        displayPage();
+    if (partialRefresh) {
+        renderScreenPartial(draw, 0, SCREEN_HEIGHT);
+    } else {
+        renderScreen(draw);
     }
+    
+    unlockSpiBus();
 }
 
-void closeBook() {
-    if (reader.fileOpen) {
-        Serial.println("Closing book");
-        
-        // Save reading position before closing!
-        saveReadingPosition(reader.currentFile, reader.currentPage);
-        
-        // Update the cache too
-        for (int i = 0; i < fileCache.size(); i++) {
-            if (fileCache[i].filename == reader.currentFile) {
-                fileCache[i].lastReadPage = reader.currentPage;
-                break;
+void handleChapterListKey(uint8_t key) {
+    switch (key) {
+        case 'w':
+        case 's': {
+            int delta = coalesceNavigation(navigationDelta(key));
+            int target = constrain(chapterList.selected + delta, 0, pageTableChapterCount(reader.pages) - 1);
+            if (target != chapterList.selected) {
+                chapterList.selected = target;
+                drawChapterList(true);
             }
+            break;
         }
         
-        reader.file.close();
-        reader.fileOpen = false;
-        reader.pagePositions.clear();
-        reader.pagePositions.shrink_to_fit();
+        case '\r':
+        case '\n': {
+            Chapter chapter = pageTableChapter(reader.pages, chapterList.selected);
+            chapterList.active = false;
+            reader.currentPage = pageTableFindPage(reader.pages, chapter.offset, reader.file);
+            LOG_VERBOSE("  Contents: \"%s\" at offset %ld, page %d\n", chapter.title, chapter.offset,
+                        reader.currentPage + 1);
+            displayPageFull();
+            break;
+        }
+        
+        case 'q':
+        case 'c':
+        case '\b':
+        case 0x1B:
+            chapterList.active = false;
+            displayPageFull();
+            break;
     }
 }
 
@@ -1280,100 +5057,372 @@ char getKeyChar(uint8_t keyCode) {
     }
 }
 
+// Symbol layer (Sym or Alt first) - digits as printed on the keycaps
+char getSymKeyChar(uint8_t keyCode) {
+    switch (keyCode) {
+        case 9:  return '1';  // W
+        case 8:  return '2';  // E
+        case 7:  return '3';  // R
+        case 19: return '4';  // S
+        case 18: return '5';  // D
+        case 17: return '6';  // F
+        case 29: return '7';  // Z
+        case 28: return '8';  // X
+        case 27: return '9';  // C
+        case 34: return '0';  // Mic
+        default: return 0;
+    }
+}
+
+bool isSymModifier(uint8_t keyCode) {
+    return keyCode == 32 || keyCode == 30;  // Sym, Alt
+}
+
+// Keys that repeat while held: page turns and list navigation
+bool isRepeatKey(uint8_t key) {
+    return key == 'w' || key == 's' || key == 'a' || key == 'd' || key == ' ';
+}
+
+bool pushKey(uint8_t key) {
+    if (keyboard.count >= KEY_QUEUE_SIZE) {
+        Serial.println("  Key queue full - dropping key");
+        return false;
+    }
+    keyboard.queue[(keyboard.head + keyboard.count) % KEY_QUEUE_SIZE] = key;
+    keyboard.count++;
+    PERF_KEY_QUEUED();
+    return true;
+}
+
+// Move every event in the TCA8418 FIFO into the key queue and clear INT
+void drainKeyboard() {
+    uint8_t pending;
+    while ((pending = readKBReg(TCA8418_REG_KEY_LCK_EC) & 0x0F) != 0) {
+        while (pending-- > 0) {
+            uint8_t keyEvent = readKBReg(TCA8418_REG_KEY_EVENT_A);
+            
+            // Bit 7: 1 = press, 0 = release
+            bool pressed = (keyEvent & 0x80) != 0;
+            uint8_t keyCode = keyEvent & 0x7F;
+            if (keyCode == 0) {
+                continue;
+            }
+            
+            if (isSymModifier(keyCode)) {
+                keyboard.symHeld = pressed;
+                if (pressed) {
+                    keyboard.symArmed = true;
+                }
+                continue;
+            }
+            
+            if (!pressed) {
+                if (keyCode == keyboard.heldCode) {
+                    keyboard.heldKey = 0;
+                    keyboard.heldCode = 0;
+                }
+                continue;
+            }
+            
+            LOG_VERBOSE("Key event: 0x%02X (code=%d, pressed=%d)\n", keyEvent, keyCode, pressed);
+            
+            // Map key code to character
+            char c = keyboard.symArmed ? getSymKeyChar(keyCode) : 0;
+            if (keyboard.symArmed && !keyboard.symHeld) {
+                keyboard.symArmed = false;
+            }
+            if (c == 0) {
+                c = getKeyChar(keyCode);
+            }
+            if (c == 0) {
+                LOG_VERBOSE("  Unmapped key code: %d\n", keyCode);
+                continue;
+            }
+            LOG_VERBOSE("  Mapped to: '%c' (0x%02X)\n", c >= 32 ? c : '?', c);
+            
+            pushKey(c);
+            if (isRepeatKey(c)) {
+                keyboard.heldKey = c;
+                keyboard.heldCode = keyCode;
+                keyboard.nextRepeat = millis() + KEY_REPEAT_DELAY_MS;
+            }
+        }
+    }
+    
+    // Clear interrupt
+    writeKBReg(TCA8418_REG_INT_STAT, 0x1F);
+    keyboard.lastActivity = millis();
+}
+
+// Next key to handle, or 0 if none. Only touches I2C when KB_INT says the
+// FIFO has something; auto-repeat ticks are queued once the queue is empty.
 uint8_t readKeyboard() {
-    // Check for key events in FIFO
-    uint8_t keyCount = readKBReg(TCA8418_REG_KEY_LCK_EC) & 0x0F;
+    if (digitalRead(KB_INT) == LOW) {
+        drainKeyboard();
+    }
+    
+    unsigned long now = millis();
+    if (keyboard.count == 0 && keyboard.heldKey != 0 && (long)(now - keyboard.nextRepeat) >= 0) {
+        pushKey(keyboard.heldKey);
+        keyboard.nextRepeat = now + KEY_REPEAT_INTERVAL_MS;
+        keyboard.lastActivity = now;
+    }
     
-    if (keyCount == 0) {
+    if (keyboard.count == 0) {
+        return 0;
+    }
+    uint8_t key = keyboard.queue[keyboard.head];
+    keyboard.head = (keyboard.head + 1) % KEY_QUEUE_SIZE;
+    keyboard.count--;
+    return key;
+}
+
+// Page or selection step for a navigation key in the current mode, else 0
+int navigationDelta(uint8_t key) {
+    if (gotoInput.active || search.editing) {
         return 0;
     }
+    if (!reader.fileOpen || chapterList.active) {
+        return key == 'w' ? -1 : key == 's' ? 1 : 0;
+    }
+    switch (key) {
+        case 'w':
+        case 'a':
+            return -1;
+        case 's':
+        case 'd':
+        case ' ':
+        case '\r':
+        case '\n':
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Fold the navigation keys queued behind the one being handled into delta,
+// so a burst of presses costs one refresh. Stops at the first other key.
+int coalesceNavigation(int delta) {
+    if (digitalRead(KB_INT) == LOW) {
+        drainKeyboard();
+    }
     
-    // Read key event from FIFO
-    uint8_t keyEvent = readKBReg(TCA8418_REG_KEY_EVENT_A);
+    int folded = 0;
+    while (keyboard.count > 0) {
+        int step = navigationDelta(keyboard.queue[keyboard.head]);
+        if (step == 0) {
+            break;
+        }
+        delta += step;
+        keyboard.head = (keyboard.head + 1) % KEY_QUEUE_SIZE;
+        keyboard.count--;
+        folded++;
+    }
     
-    // Bit 7: 1 = press, 0 = release
-    bool pressed = (keyEvent & 0x80) != 0;
-    uint8_t keyCode = keyEvent & 0x7F;
+    if (folded > 0) {
+        LOG_VERBOSE("  Coalesced %d queued keys, net %+d\n", folded, delta);
+    }
+    return delta;
+}
+
+// True if a navigation key is waiting, i.e. the screen being prepared is
+// already out of date
+bool navigationPending() {
+    if (digitalRead(KB_INT) == LOW) {
+        drainKeyboard();
+    }
+    return keyboard.count > 0 && navigationDelta(keyboard.queue[keyboard.head]) != 0;
+}
+
+// GxEPD2 calls this while it waits on BUSY during a refresh. Pull key events
+// off the TCA8418 meanwhile so a burst can't overflow its 10-event FIFO and
+// the next render can jump straight to the target. The bus is lent out
+// until BUSY lets go, so the card can be read while the panel updates.
+void onDisplayBusy(const void* param) {
+    int busyLevel = digitalRead(EPD_BUSY);  // GxEPD2 has just seen it busy
+    unsigned long start = millis();
+    int holds = lendSpiBus();
+    do {
+        if (digitalRead(KB_INT) == LOW) {
+            drainKeyboard();
+        }
+        delay(1);
+    } while (holds > 0 && digitalRead(EPD_BUSY) == busyLevel && millis() - start < SPI_LEND_MAX_MS);
+    reclaimSpiBus(holds);
+}
+
+// Block until loop() has something to do: a key event, an auto-repeat tick
+// or the indexer finishing. Once idle with the indexer stopped, light-sleep
+// until KB_INT goes low, then deep-sleep after SUSPEND_IDLE_MS.
+void waitForInput() {
+    if (keyboard.count > 0 || indexer.finished || digitalRead(KB_INT) == LOW) {
+        return;
+    }
     
-    // Clear interrupt
-    writeKBReg(TCA8418_REG_INT_STAT, 0x1F);
+    unsigned long now = millis();
+    unsigned long idleMs = now - keyboard.lastActivity;
+    TickType_t timeout;
     
-    // Only act on key press, not release
-    if (!pressed || keyCode == 0) {
-        return 0;
+    if (keyboard.heldKey != 0) {
+        long untilRepeat = (long)(keyboard.nextRepeat - now);
+        timeout = untilRepeat > 0 ? pdMS_TO_TICKS(untilRepeat) : 0;
+    } else if (indexer.running) {
+        timeout = portMAX_DELAY;  // The indexer notifies us when it is done
+    } else if (idleMs < LIGHT_SLEEP_IDLE_MS) {
+        timeout = pdMS_TO_TICKS(LIGHT_SLEEP_IDLE_MS - idleMs);
+    } else {
+#ifdef PERF_STATS
+        timeout = portMAX_DELAY;  // Light sleep would drop the serial console
+#else
+        enterLightSleep();
+        return;
+#endif
+    }
+    
+    if (journal.dirty) {
+        long untilFlush = JOURNAL_IDLE_MS - (long)(now - journal.changedAt);
+        timeout = min(timeout, untilFlush > 0 ? (TickType_t)pdMS_TO_TICKS(untilFlush) : (TickType_t)0);
     }
+#ifdef PERF_STATS
+    timeout = min(timeout, (TickType_t)pdMS_TO_TICKS(PERF_POLL_MS));  // Look for serial commands
+#endif
+    ulTaskNotifyTake(pdTRUE, timeout);
+}
+
+void enterLightSleep() {
+    flushPositionJournal();
     
-    Serial.printf("Key event: 0x%02X (code=%d, pressed=%d)\n", keyEvent, keyCode, pressed);
+#ifndef NO_DEEP_SLEEP
+    unsigned long idleMs = millis() - keyboard.lastActivity;
+    if (idleMs >= SUSPEND_IDLE_MS) {
+        enterDeepSleep();
+    }
+    unsigned long untilSuspend = SUSPEND_IDLE_MS - idleMs;
+#endif
     
-    // Map key code to character
-    char c = getKeyChar(keyCode);
-    if (c != 0) {
-        Serial.printf("  Mapped to: '%c' (0x%02X)\n", c >= 32 ? c : '?', c);
-        return c;
+#ifdef NO_LIGHT_SLEEP
+#ifdef NO_DEEP_SLEEP
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+#else
+    if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(untilSuspend)) == 0 && digitalRead(KB_INT) == HIGH) {
+        enterDeepSleep();
     }
+#endif
+#else
+    Serial.println("Idle - light sleep until key press");
+    Serial.flush();
     
-    // Return raw keycode for unmapped keys
-    Serial.printf("  Unmapped key code: %d\n", keyCode);
-    return 0;
+    unsigned long start = millis();
+    gpio_wakeup_enable((gpio_num_t)KB_INT, GPIO_INTR_LOW_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+#ifndef NO_DEEP_SLEEP
+    esp_sleep_enable_timer_wakeup((uint64_t)untilSuspend * 1000);
+#endif
+    esp_light_sleep_start();
+    gpio_wakeup_disable((gpio_num_t)KB_INT);
+    
+#ifndef NO_DEEP_SLEEP
+    esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_TIMER);
+    if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER && digitalRead(KB_INT) == HIGH) {
+        enterDeepSleep();
+    }
+#endif
+    
+    // Wakeup config replaced the pin's interrupt type - restore the edge handler
+    attachInterrupt(digitalPinToInterrupt(KB_INT), onKeyboardInterrupt, FALLING);
+    
+    keyboard.lastActivity = millis();
+    Serial.printf("Woke after %lu ms\n", keyboard.lastActivity - start);
+#endif
 }
 
 void handleKeyPress(uint8_t key) {
-    Serial.printf("handleKeyPress: key='%c' (0x%02X), fileOpen=%d\n", 
-                  key >= 32 && key < 127 ? key : '?', key, reader.fileOpen);
+    LOG_VERBOSE("handleKeyPress: key='%c' (0x%02X), fileOpen=%d\n", 
+                key >= 32 && key < 127 ? key : '?', key, reader.fileOpen);
     
     if (!reader.fileOpen) {
         // FILE LIST MODE
         switch (key) {
             case 'w':
-                if (selectedFileIndex > 0) {
-                    selectedFileIndex--;
-                    Serial.printf("  Nav UP: selectedFileIndex now %d\n", selectedFileIndex);
-                    displayFileList();
-                } else {
-                    Serial.println("  Nav UP: already at top");
-                }
-                break;
-                
-            case 's':
-                if (selectedFileIndex < (int)fileList.size() - 1) {
-                    selectedFileIndex++;
-                    Serial.printf("  Nav DOWN: selectedFileIndex now %d\n", selectedFileIndex);
-                    displayFileList();
+            case 's': {
+                int delta = coalesceNavigation(navigationDelta(key));
+                int target = constrain(selectedFileIndex + delta, 0, max(0, (int)library.order.size() - 1));
+                if (target != selectedFileIndex) {
+                    LOG_VERBOSE("  Nav %+d: selectedFileIndex now %d\n", delta, target);
+                    moveLibrarySelection(target);
                 } else {
-                    Serial.println("  Nav DOWN: already at bottom");
+                    LOG_VERBOSE("  Nav %+d: selection unchanged\n", delta);
                 }
                 break;
+            }
                 
             case '\r':     // Carriage return (0x0D)
             case '\n':     // Line feed (0x0A)
-                Serial.printf("  ENTER: opening file %d\n", selectedFileIndex);
-                if (fileList.size() > 0) {
-                    openBook(fileList[selectedFileIndex]);
+                LOG_VERBOSE("  ENTER: opening file %d\n", selectedFileIndex);
+                if (library.order.size() > 0) {
+                    openBook(fileCache[library.order[selectedFileIndex]].filename);
                 }
                 break;
+                
+            case 'o':
+                library.sort = (library.sort + 1) % SORT_COUNT;
+                LOG_VERBOSE("  SORT: by %s\n", librarySortNames[library.sort]);
+                sortLibrary();
+                drawFileList(true);
+                break;
         }
+    } else if (gotoInput.active) {
+        handleGotoKey(key);
+    } else if (search.editing) {
+        handleSearchKey(key);
+    } else if (chapterList.active) {
+        handleChapterListKey(key);
+    } else if (searchRunning() && (key == 'q' || key == 0x1B)) {
+        LOG_VERBOSE("  Stopping search\n");
+        indexer.cancel = true;
     } else {
         // READING MODE
         switch (key) {
             case 'w':
             case 'a':
-                prevPage();
-                break;
-                
             case 's':
             case 'd':
             case ' ':      // Space
             case '\r':     // Enter
             case '\n':     // Line feed
-                nextPage();
+                turnPages(coalesceNavigation(navigationDelta(key)));
+                break;
+                
+            case 'g':
+                beginGotoInput();
+                break;
+                
+            case 'f':
+                if (!searchRunning()) {
+                    beginSearchInput();
+                }
+                break;
+                
+            case 'c':
+                if (!searchRunning()) {
+                    openChapterList();
+                }
+                break;
+                
+            case 'n':      // Next match of the last search
+                if (search.length > 0 && !searchRunning()) {
+                    startSearch();
+                }
                 break;
                 
             case 'q':
             case 0x1B:     // Escape
-                Serial.println("  EXIT: closing book and returning to file list");
+                LOG_VERBOSE("  EXIT: closing book and returning to file list\n");
                 closeBook();
                 delay(50);  // Small delay before redrawing
+                sortLibrary();  // Recent order has changed
                 displayFileList();
+                startLibraryIndexing();
                 break;
         }
     }
@@ -0,0 +1,526 @@
+// Pagination engine - see pagination.h
+
+#include "pagination.h"
+
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+
+using std::max;
+using std::min;
+
+// ============================================================================
+// TEXT DECODING
+// Books are read as UTF-8, and bytes that aren't valid UTF-8 are taken as
+// one Windows-1252/Latin-1 character each. Every character maps to one glyph
+// of the built-in CP437 font, or to none. The wrap code and the renderer
+// both go through decodeGlyph(), so a column is a column in both. Lines
+// always start on a character, so a sequence cut off at the end of a chunk
+// only has to be reported - the line is re-read with the next chunk.
+// ============================================================================
+
+// Glyphs for U+00A0..U+00FF, 0 = no glyph. Letters CP437 lacks fall back to
+// the unaccented letter.
+static const uint8_t latin1Glyphs[96] = {
+    0xFF, 0xAD, 0x9B, 0x9C, '*', 0x9D, '|', 0x15, ' ', 'C', 0xA6, 0xAE, 0xAA, 0, 'R', ' ',
+    0xF8, 0xF1, 0xFD, '3', '\'', 0xE6, 0x14, 0xFA, ' ', '1', 0xA7, 0xAF, 0xAC, 0xAB, '3', 0xA8,
+    'A', 'A', 'A', 'A', 0x8E, 0x8F, 0x92, 0x80, 'E', 0x90, 'E', 'E', 'I', 'I', 'I', 'I',
+    'D', 0xA5, 'O', 'O', 'O', 'O', 0x99, 'x', 'O', 'U', 'U', 'U', 0x9A, 'Y', 'P', 0xE1,
+    0x85, 0xA0, 0x83, 'a', 0x84, 0x86, 0x91, 0x87, 0x8A, 0x82, 0x88, 0x89, 0x8D, 0xA1, 0x8C, 0x8B,
+    'd', 0xA4, 0x95, 0xA2, 0x93, 'o', 0x94, 0xF6, 'o', 0x97, 0xA3, 0x96, 0x81, 'y', 'p', 0x98
+};
+
+// Glyphs beyond Latin-1, sorted by code point, 0 = no glyph
+struct GlyphMapEntry {
+    uint16_t codepoint;
+    uint8_t glyph;
+};
+static const GlyphMapEntry unicodeGlyphs[] = {
+    {0x0152, 'O'}, {0x0153, 'o'}, {0x0160, 'S'}, {0x0161, 's'}, {0x0178, 'Y'},
+    {0x017D, 'Z'}, {0x017E, 'z'}, {0x0192, 0x9F}, {0x02C6, '^'}, {0x02DC, '~'}, {0x0393, 0xE2}, {0x0398, 0xE9}, {0x03A3, 0xE4}, {0x03A6, 0xE8}, {0x03A9, 0xEA},
+    {0x03B1, 0xE0}, {0x03B4, 0xEB}, {0x03B5, 0xEE}, {0x03C0, 0xE3}, {0x03C3, 0xE5}, {0x03C4, 0xE7},
+    {0x03C6, 0xED}, {0x2002, ' '}, {0x2003, ' '}, {0x2004, ' '}, {0x2005, ' '}, {0x2006, ' '}, {0x2007, ' '},
+    {0x2008, ' '}, {0x2009, ' '}, {0x200A, ' '}, {0x200B, 0}, {0x200C, 0}, {0x200D, 0}, {0x2010, '-'},
+    {0x2011, '-'}, {0x2012, '-'}, {0x2013, '-'}, {0x2014, '-'}, {0x2015, '-'}, {0x2018, '\''}, {0x2019, '\''},
+    {0x201A, '\''}, {0x201B, '\''}, {0x201C, '"'}, {0x201D, '"'}, {0x201E, '"'}, {0x201F, '"'},
+    {0x2020, '+'}, {0x2022, 0x07}, {0x2026, GLYPH_ELLIPSIS}, {0x2030, '%'}, {0x2032, '\''}, {0x2033, '"'}, {0x2039, '<'}, {0x203A, '>'},
+    {0x2060, 0}, {0x207F, 0xFC}, {0x20A7, 0x9E}, {0x20AC, 'E'}, {0x2122, 'T'}, {0x2190, 0x1B}, {0x2191, 0x18},
+    {0x2192, 0x1A}, {0x2193, 0x19}, {0x2212, '-'}, {0x2219, 0xF9}, {0x221A, 0xFB}, {0x221E, 0xEC},
+    {0x2229, 0xEF}, {0x2248, 0xF7}, {0x2261, 0xF0}, {0x2264, 0xF3}, {0x2265, 0xF2}, {0x2310, 0xA9},
+    {0x2320, 0xF4}, {0x2321, 0xF5}, {0x2500, 0xC4}, {0x2502, 0xB3}, {0x250C, 0xDA}, {0x2510, 0xBF},
+    {0x2514, 0xC0}, {0x2518, 0xD9}, {0x251C, 0xC3}, {0x2524, 0xB4}, {0x252C, 0xC2}, {0x2534, 0xC1},
+    {0x253C, 0xC5}, {0x2550, 0xCD}, {0x2551, 0xBA}, {0x2552, 0xD5}, {0x2553, 0xD6}, {0x2554, 0xC9},
+    {0x2555, 0xB8}, {0x2556, 0xB7}, {0x2557, 0xBB}, {0x2558, 0xD4}, {0x2559, 0xD3}, {0x255A, 0xC8},
+    {0x255B, 0xBE}, {0x255C, 0xBD}, {0x255D, 0xBC}, {0x255E, 0xC6}, {0x255F, 0xC7}, {0x2560, 0xCC},
+    {0x2561, 0xB5}, {0x2562, 0xB6}, {0x2563, 0xB9}, {0x2564, 0xD1}, {0x2565, 0xD2}, {0x2566, 0xCB},
+    {0x2567, 0xCF}, {0x2568, 0xD0}, {0x2569, 0xCA}, {0x256A, 0xD8}, {0x256B, 0xD7}, {0x256C, 0xCE},
+    {0x2580, 0xDF}, {0x2584, 0xDC}, {0x2588, 0xDB}, {0x258C, 0xDD}, {0x2590, 0xDE}, {0x2591, 0xB0},
+    {0x2592, 0xB1}, {0x2593, 0xB2}, {0x25A0, 0xFE}, {0x25B2, 0x1E}, {0x25BC, 0x1F}, {0x263A, 0x01},
+    {0x2660, 0x06}, {0x2663, 0x05}, {0x2665, 0x03}, {0x2666, 0x04}, {0x266A, 0x0D}, {0x266B, 0x0E},
+    {0xFEFF, 0}
+};
+
+// Windows-1252 characters for bytes 0x80..0x9F, 0 = undefined
+static const uint16_t cp1252Codepoints[32] = {
+    0x20AC, 0x0000, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+    0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x0000, 0x017D, 0x0000,
+    0x0000, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+    0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x0000, 0x017E, 0x0178
+};
+
+int decodeGlyphMultibyte(const char* text, int len, int& i) {
+    const uint8_t* p = (const uint8_t*)text + i;
+    uint8_t b = p[0];
+    int n = 1;
+    uint32_t cp = 0;
+    uint8_t low = 0x80;  // Allowed range of the second byte - excludes
+    uint8_t high = 0xBF; // overlong forms, surrogates and > U+10FFFF
+    
+    if (b >= 0xC2 && b <= 0xDF) {
+        n = 2;
+        cp = b & 0x1F;
+    } else if (b >= 0xE0 && b <= 0xEF) {
+        n = 3;
+        cp = b & 0x0F;
+        if (b == 0xE0) low = 0xA0;
+        if (b == 0xED) high = 0x9F;
+    } else if (b >= 0xF0 && b <= 0xF4) {
+        n = 4;
+        cp = b & 0x07;
+        if (b == 0xF0) low = 0x90;
+        if (b == 0xF4) high = 0x8F;
+    }
+    
+    int k = 1;
+    for (; k < n; k++) {
+        if (i + k >= len) {
+            return GLYPH_INCOMPLETE;
+        }
+        uint8_t c = p[k];
+        if (c < (k == 1 ? low : 0x80) || c > (k == 1 ? high : 0xBF)) {
+            break;
+        }
+        cp = (cp << 6) | (c & 0x3F);
+    }
+    
+    if (k < n || n == 1) {
+        // Not UTF-8 - a single Windows-1252/Latin-1 byte
+        i++;
+        return glyphForCodepoint(b < 0xA0 ? cp1252Codepoints[b - 0x80] : b);
+    }
+    i += n;
+    return glyphForCodepoint(cp);
+}
+
+int glyphForCodepoint(uint32_t cp) {
+    if (cp < 0x80) {
+        return cp >= 32 && cp != 0x7F ? (int)cp : GLYPH_SKIP;
+    }
+    if (cp < 0xA0 || (cp >= 0x0300 && cp <= 0x036F)) {
+        return GLYPH_SKIP;  // C1 controls, combining accents
+    }
+    if (cp <= 0xFF) {
+        uint8_t glyph = latin1Glyphs[cp - 0xA0];
+        return glyph != 0 ? glyph : GLYPH_SKIP;
+    }
+    
+    int lo = 0;
+    int hi = sizeof(unicodeGlyphs) / sizeof(unicodeGlyphs[0]) - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (unicodeGlyphs[mid].codepoint == cp) {
+            return unicodeGlyphs[mid].glyph != 0 ? unicodeGlyphs[mid].glyph : GLYPH_SKIP;
+        }
+        if (unicodeGlyphs[mid].codepoint < cp) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return GLYPH_UNKNOWN;
+}
+
+// Pixel advance of each glyph in proportional layout, 1 px gap included.
+// These are part of the layout - page boundaries depend on them - so they
+// are fixed here rather than measured from whatever font the library has.
+// Most of the 5x7 font is five columns wide; these glyphs are narrower.
+constexpr uint8_t proportionalAdvance(int glyph) {
+    return glyph == ' ' ? 3 :
+           glyph == '!' || glyph == '|' ? 2 :
+           glyph == '.' || glyph == ',' || glyph == ':' || glyph == ';' ? 3 :
+           glyph == 'i' || glyph == 'l' || glyph == 'I' || glyph == '1' || glyph == '\'' || glyph == '"' ||
+           glyph == '(' || glyph == ')' || glyph == '[' || glyph == ']' || glyph == '`' ? 4 :
+           glyph == 'j' ? 5 :
+           GLYPH_WIDTH;
+}
+constexpr uint8_t gridAdvance(int) {
+    return 1;
+}
+
+extern constexpr uint8_t proportionalWidths[GLYPH_COUNT] = {GLYPH_TABLE(proportionalAdvance)};
+extern constexpr uint8_t gridWidths[GLYPH_COUNT] = {GLYPH_TABLE(gridAdvance)};
+static_assert(proportionalWidths[' '] == 3 && proportionalWidths['m'] == GLYPH_WIDTH, "width table out of step");
+
+// ============================================================================
+// IMPROVED WORD WRAP LOGIC
+// ============================================================================
+
+// Word-at-a-time helpers for findLineBreak. A word of four bytes that are
+// all plain text - printable ASCII other than '-' - can only bump the
+// width and move the last space break, which is done for all four at once.
+#define SWAR_ONES  0x01010101u
+#define SWAR_HIGHS 0x80808080u
+
+// High bit set in every byte of w that is zero
+static inline uint32_t swarZeroBytes(uint32_t w) {
+    return ~(((w & ~SWAR_HIGHS) + ~SWAR_HIGHS) | w) & SWAR_HIGHS;
+}
+
+// True if every byte is in 0x20..0x7E and none is '-'
+static inline bool swarPlainText(uint32_t w) {
+    return (w & SWAR_HIGHS) == 0 &&                        // ASCII
+           ((w + 0x60 * SWAR_ONES) & SWAR_HIGHS) == SWAR_HIGHS &&  // >= 0x20
+           ((w + SWAR_ONES) & SWAR_HIGHS) == 0 &&          // <= 0x7E
+           swarZeroBytes(w ^ ('-' * SWAR_ONES)) == 0;
+}
+
+// Find the best line break point, handling edge cases. Lines are at most
+// maxWidth wide, in the units of widths[] (see PageLayout).
+WrapResult findLineBreak(const char* buffer, int bufLen, int lineStart, int maxWidth, const uint8_t* widths) {
+    WrapResult result;
+    result.lineEnd = lineStart;
+    result.nextStart = lineStart;
+    
+    if (lineStart >= bufLen) {
+        return result;
+    }
+    
+    int lineWidth = 0;
+    int lastBreakPoint = -1;  // Position of last good break opportunity
+    bool inWord = false;
+    
+    for (int i = lineStart; i < bufLen; i++) {
+        // Fast path: four plain-text bytes that can't reach the line width.
+        // Gives exactly what the per-byte code below would.
+        while (i + 4 <= bufLen) {
+            uint32_t w;
+            memcpy(&w, buffer + i, 4);  // Little-endian: byte 0 is buffer[i]
+            if (!swarPlainText(w)) {
+                break;
+            }
+            int advance = widths[w & 0xFF] + widths[(w >> 8) & 0xFF] + widths[(w >> 16) & 0xFF] + widths[w >> 24];
+            if (lineWidth + advance >= maxWidth) {
+                break;
+            }
+            // A space that follows a word character is a break point
+            uint32_t spaces = swarZeroBytes(w ^ (' ' * SWAR_ONES));
+            uint32_t afterWord = ((~spaces & SWAR_HIGHS) << 8) | (inWord ? 0x80u : 0);
+            uint32_t breaks = spaces & afterWord;
+            if (breaks != 0) {
+                int j = (31 - __builtin_clz(breaks)) / 8;
+                lastBreakPoint = i + j;
+            }
+            inWord = (spaces & 0x80000000u) == 0;
+            lineWidth += advance;
+            i += 4;
+        }
+        if (i >= bufLen) {
+            break;
+        }
+        
+        char c = buffer[i];
+        
+        // Hard line break - always honor
+        if (c == '\n') {
+            result.lineEnd = i;
+            result.nextStart = i + 1;
+            // Skip \r if present after \n (or before)
+            if (result.nextStart < bufLen && buffer[result.nextStart] == '\r') {
+                result.nextStart++;
+            }
+            return result;
+        }
+        
+        if (c == '\r') {
+            result.lineEnd = i;
+            result.nextStart = i + 1;
+            // Skip \n if present after \r
+            if (result.nextStart < bufLen && buffer[result.nextStart] == '\n') {
+                result.nextStart++;
+            }
+            return result;
+        }
+        
+        // Everything else is one character, of one or more bytes
+        int next = i;
+        int glyph = decodeGlyph(buffer, bufLen, next);
+        if (glyph == GLYPH_INCOMPLETE) {
+            break;  // Cut off - the caller reads on if there is more
+        }
+        
+        // Track printable characters for line width
+        if (glyph != GLYPH_SKIP) {
+            lineWidth += widths[glyph];
+            
+            // Track word boundaries for smart wrapping
+            if (c == ' ' || c == '\t') {
+                if (inWord) {
+                    // Just finished a word - this is a good break point
+                    lastBreakPoint = i;
+                    inWord = false;
+                }
+            } else if (glyph == '-') {
+                // Hyphen or dash - can break after it if we're in a word
+                if (inWord) {
+                    lastBreakPoint = next;  // Break AFTER the hyphen
+                }
+            } else {
+                inWord = true;
+            }
+            
+            // Check if we've exceeded line width
+            if (lineWidth >= maxWidth) {
+                if (lastBreakPoint > lineStart) {
+                    // We have a good break point - use it
+                    result.lineEnd = lastBreakPoint;
+                    result.nextStart = lastBreakPoint;
+                    
+                    // Skip whitespace at break point
+                    while (result.nextStart < bufLen && 
+                           (buffer[result.nextStart] == ' ' || buffer[result.nextStart] == '\t')) {
+                        result.nextStart++;
+                    }
+                } else {
+                    // No good break point - force break mid-word
+                    // Back up one character so we don't exceed maxWidth
+                    result.lineEnd = i;
+                    result.nextStart = i;
+                }
+                return result;
+            }
+        }
+        i = next - 1;
+    }
+    
+    // Reached end of buffer
+    result.lineEnd = bufLen;
+    result.nextStart = bufLen;
+    return result;
+}
+
+// ============================================================================
+// WORD-WRAP AWARE PAGE INDEXER
+// Uses the same findLineBreak logic as the display so pages match exactly.
+// Reads raw bytes so buffer positions map 1:1 to file offsets.
+// ============================================================================
+
+int indexPagesWordWrap(TextStream& stream, const PageLayout& layout, long startPos, std::vector<long>& pagePositions,
+                       int maxPages) {
+    const int BUF_SIZE = 2048;
+    char buffer[BUF_SIZE];
+
+    stream.seek(startPos);
+    long size = stream.size();
+    long readPos = startPos;  // file offset just past what has been read
+    int pagesAdded = 0;
+    int lineCount = 0;
+
+    // We read overlapping chunks: after processing a chunk we may have
+    // a partial line at the end.  We keep that remainder and prepend it
+    // to the next read.
+    int leftover = 0;
+    long chunkFileStart = startPos;  // file offset corresponding to buffer[0]
+
+    while (readPos < size && (maxPages <= 0 || pagesAdded < maxPages)) {
+        // Read next chunk (after any leftover bytes already in buffer)
+        int bytesRead = stream.read(buffer + leftover, BUF_SIZE - leftover);
+        if (bytesRead <= 0) break;
+        readPos += bytesRead;
+        int bufLen = leftover + bytesRead;
+
+        int pagesBefore = pagePositions.size();
+        int pos = wrapChunkPages(buffer, bufLen, readPos < size, chunkFileStart, layout, lineCount, pagePositions,
+                                 maxPages > 0 ? maxPages - pagesAdded : 0, nullptr);
+        pagesAdded += pagePositions.size() - pagesBefore;
+
+        // Keep unprocessed bytes for next iteration
+        leftover = bufLen - pos;
+        if (leftover > 0 && leftover < BUF_SIZE) {
+            memmove(buffer, buffer + pos, leftover);
+        } else {
+            leftover = 0;
+        }
+        chunkFileStart = readPos - leftover;
+    }
+
+    return pagesAdded;
+}
+
+// Wrap the lines of one chunk, adding the file offset of each page start to
+// pagePositions, up to maxPages (0 = no limit). A line running into the end
+// of the chunk is left for the next one when moreData is set, so page
+// boundaries don't depend on where a chunk started. Returns the offset in
+// buffer where the next chunk has to continue. With outline, each line
+// counted is also scanned for words and headings.
+int wrapChunkPages(const char* buffer, int bufLen, bool moreData, long chunkFileStart, const PageLayout& layout,
+                   int& lineCount, std::vector<long>& pagePositions, int maxPages, OutlineScan* outline) {
+    const int LINE_WIDTH = layout.lineWidth;
+    const uint8_t* widths = layout.glyphWidths;
+    const int LINES_PER_PAGE = layout.linesPerPage;
+    int pagesAdded = 0;
+    int pos = 0;
+    
+    while (pos < bufLen) {
+        WrapResult wrap = findLineBreak(buffer, bufLen, pos, LINE_WIDTH, widths);
+        
+        // The line may continue in the next chunk - fetch more rather than counting it
+        if (wrap.lineEnd >= bufLen && moreData) break;
+        
+        // If findLineBreak couldn't make progress we need more data
+        if (wrap.nextStart <= pos && wrap.lineEnd >= bufLen) break;
+        
+        if (outline != nullptr) {
+            outlineScanLine(*outline, buffer, pos, wrap, bufLen, chunkFileStart);
+        }
+        lineCount++;
+        pos = wrap.nextStart;
+        
+        if (lineCount >= LINES_PER_PAGE) {
+            pagePositions.push_back(chunkFileStart + pos);
+            if (outline != nullptr) {
+                outline->words.push_back(min(outline->pageWords, (uint32_t)UINT16_MAX));
+                outline->pageWords = 0;
+            }
+            pagesAdded++;
+            lineCount = 0;
+            
+            if (maxPages > 0 && pagesAdded >= maxPages) break;
+        }
+    }
+    return pos;
+}
+
+// ============================================================================
+// BOOK OUTLINE
+// Chapter headings and word counts come out of the pagination pass, so the
+// contents screen and the time left in a chapter cost no extra reading.
+// A heading is a whole source line between blank lines: "Chapter 12",
+// "CHAPTER IV", "Chapter One", or a short line in capitals followed by
+// another blank line ("PART TWO", "EPILOGUE").
+// ============================================================================
+
+enum HeadingKind { HEADING_NONE, HEADING_CHAPTER, HEADING_CAPITALS };
+
+// Set up for a pass starting at startPos. The few bytes before it tell
+// whether a heading could start there.
+void outlineScanBegin(OutlineScan& scan, TextStream& stream, long startPos) {
+    scan.atLineStart = true;
+    scan.afterBlank = true;
+    scan.inWord = false;
+    scan.pageWords = 0;
+    scan.pending = false;
+    scan.words.clear();
+    scan.chapters.clear();
+    if (startPos == 0) {
+        return;
+    }
+    
+    char before[4];
+    int n = min(startPos, (long)sizeof(before));
+    stream.seek(startPos - n);
+    n = max(stream.read(before, n), 0);
+    
+    // Strip one line end ("\n", "\r", "\r\n" or "\n\r"); another one before it is a blank line
+    int end = n;
+    if (end > 0 && (before[end - 1] == '\n' || before[end - 1] == '\r')) {
+        end--;
+        if (end > 0 && (before[end - 1] == '\n' || before[end - 1] == '\r') && before[end - 1] != before[end]) {
+            end--;
+        }
+    }
+    scan.atLineStart = end < n;
+    scan.afterBlank = scan.atLineStart && end > 0 && (before[end - 1] == '\n' || before[end - 1] == '\r');
+}
+
+// Count the words of one wrapped line, starting at start, and look at it
+// as a heading if it is a whole source line
+void outlineScanLine(OutlineScan& scan, const char* buffer, int start, const WrapResult& wrap, int bufLen,
+                     long chunkFileStart) {
+    for (int i = start; i < wrap.nextStart; i++) {
+        bool wordByte = (uint8_t)buffer[i] > ' ';
+        if (wordByte && !scan.inWord) {
+            scan.pageWords++;
+        }
+        scan.inWord = wordByte;
+    }
+    
+    bool startsLine = scan.atLineStart;
+    scan.atLineStart = wrap.lineEnd >= bufLen || buffer[wrap.lineEnd] == '\n' || buffer[wrap.lineEnd] == '\r';
+    if (!startsLine) {
+        return;  // Rest of a wrapped source line
+    }
+    bool wholeLine = scan.atLineStart;
+    
+    int textStart = start;
+    int textEnd = wrap.lineEnd;
+    while (textStart < textEnd && (uint8_t)buffer[textStart] <= ' ') textStart++;
+    while (textEnd > textStart && (uint8_t)buffer[textEnd - 1] <= ' ') textEnd--;
+    bool blank = wholeLine && textStart == textEnd;
+    
+    if (scan.pending && blank) {
+        scan.chapters.push_back(scan.pendingHeading);
+    }
+    scan.pending = false;
+    
+    bool afterBlank = scan.afterBlank;
+    scan.afterBlank = blank;
+    if (!wholeLine || !afterBlank || blank || textEnd - textStart > CHAPTER_HEADING_MAX) {
+        return;
+    }
+    
+    int kind = chapterHeadingKind(buffer + textStart, textEnd - textStart);
+    if (kind == HEADING_NONE) {
+        return;
+    }
+    
+    // Title cut to fit, not in the middle of a UTF-8 sequence
+    Chapter heading;
+    heading.offset = chunkFileStart + textStart;
+    int titleLength = min(textEnd - textStart, CHAPTER_TITLE_CHARS);
+    if (titleLength < textEnd - textStart) {
+        while (titleLength > 0 && ((uint8_t)buffer[textStart + titleLength] & 0xC0) == 0x80) {
+            titleLength--;
+        }
+    }
+    memcpy(heading.title, buffer + textStart, titleLength);
+    heading.title[titleLength] = '\0';
+    
+    if (kind == HEADING_CHAPTER) {
+        scan.chapters.push_back(heading);
+    } else {
+        scan.pending = true;
+        scan.pendingHeading = heading;
+    }
+}
+
+// "Chapter" on its own or followed by a number or a capitalised word, or a
+// line with at least two capitals and no lower case ASCII letters
+int chapterHeadingKind(const char* text, int len) {
+    if (len >= 7 && strncasecmp(text, "chapter", 7) == 0 &&
+        (len == 7 || (len > 8 && text[7] == ' ' && (isdigit((uint8_t)text[8]) || isupper((uint8_t)text[8]))))) {
+        return HEADING_CHAPTER;
+    }
+    
+    int capitals = 0;
+    for (int i = 0; i < len; i++) {
+        uint8_t c = text[i];
+        if (c >= 'a' && c <= 'z') {
+            return HEADING_NONE;
+        }
+        if (c >= 'A' && c <= 'Z') {
+            capitals++;
+        }
+    }
+    return capitals >= 2 ? HEADING_CAPITALS : HEADING_NONE;
+}
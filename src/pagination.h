@@ -0,0 +1,103 @@
+// Pagination engine - text decoding, word wrap, page breaking and the
+// outline scan. Plain C++ with no Arduino, SD or FreeRTOS dependencies, so
+// the same code that lays out pages on the device also builds on a PC for
+// benchmarking and checking page boundaries against known books.
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// Built-in GFX font at text size 1: 5x7 glyphs in a 6x8 cell, CP437 layout
+#define GLYPH_WIDTH      6
+#define GLYPH_HEIGHT     8
+#define GLYPH_COUNT      256
+#define GLYPH_ELLIPSIS   0x7F   // Slot of the unused DEL glyph, drawn as "..." in one cell
+#define GLYPH_UNKNOWN    '?'    // Characters the font has nothing for
+#define GLYPH_SKIP       -1     // decodeGlyph(): takes no column (controls, BOM, zero-width)
+#define GLYPH_INCOMPLETE -2     // decodeGlyph(): UTF-8 sequence runs past the buffer
+
+// Builds a GLYPH_COUNT entry table from a constexpr function of the glyph
+#define GLYPH_TABLE_4(f, g)  f(g), f(g + 1), f(g + 2), f(g + 3)
+#define GLYPH_TABLE_16(f, g) GLYPH_TABLE_4(f, g), GLYPH_TABLE_4(f, g + 4), GLYPH_TABLE_4(f, g + 8), GLYPH_TABLE_4(f, g + 12)
+#define GLYPH_TABLE_64(f, g) GLYPH_TABLE_16(f, g), GLYPH_TABLE_16(f, g + 16), GLYPH_TABLE_16(f, g + 32), GLYPH_TABLE_16(f, g + 48)
+#define GLYPH_TABLE(f)       GLYPH_TABLE_64(f, 0), GLYPH_TABLE_64(f, 64), GLYPH_TABLE_64(f, 128), GLYPH_TABLE_64(f, 192)
+
+// Width of each glyph: its advance in pixels for proportional layout, one
+// column for the grid
+extern const uint8_t proportionalWidths[GLYPH_COUNT];
+extern const uint8_t gridWidths[GLYPH_COUNT];
+
+// Book outline - chapter headings and words per page, picked up by the same
+// pass that paginates
+#define CHAPTER_TITLE_CHARS  32
+#define CHAPTER_HEADING_MAX  40   // Longer lines are never taken for headings
+#define OUTLINE_MAX_CHAPTERS 512
+
+struct Chapter {
+    long offset;                          // Start of the heading text
+    char title[CHAPTER_TITLE_CHARS + 1];
+};
+
+// Carried from line to line, and chunk to chunk, by wrapChunkPages()
+struct OutlineScan {
+    bool atLineStart;               // Next wrapped line starts a source line
+    bool afterBlank;                // ...and the source line before it was blank
+    bool inWord;
+    uint32_t pageWords;             // Words so far on the page being wrapped
+    bool pending;                   // Line in capitals, a heading if a blank line follows
+    Chapter pendingHeading;
+    std::vector<uint16_t> words;    // Out: words on each page finished
+    std::vector<Chapter> chapters;  // Out: headings found
+};
+
+// Everything that decides where pages break
+struct PageLayout {
+    int lineWidth;               // In the units of glyphWidths
+    const uint8_t* glyphWidths;  // proportionalWidths or gridWidths
+    int linesPerPage;
+};
+
+// Word wrap helper
+struct WrapResult {
+    int lineEnd;      // End position for this line
+    int nextStart;    // Start position for next line
+};
+
+// Where the book text comes from. Positions are byte offsets into the raw
+// file, read() returns the bytes read (0 at the end).
+class TextStream {
+public:
+    virtual ~TextStream() {}
+    virtual bool seek(long pos) = 0;
+    virtual int read(char* buffer, int len) = 0;
+    virtual long size() = 0;
+};
+
+// Text decoding
+int decodeGlyphMultibyte(const char* text, int len, int& i);
+int glyphForCodepoint(uint32_t cp);
+
+// Decode the character at text[i] and step i past it. Returns its glyph,
+// GLYPH_SKIP, or GLYPH_INCOMPLETE (leaving i alone) if text ends at len in
+// the middle of a UTF-8 sequence.
+inline int decodeGlyph(const char* text, int len, int& i) {
+    uint8_t b = (uint8_t)text[i];
+    if (b < 0x80) {
+        i++;
+        return b >= 32 && b != 0x7F ? b : GLYPH_SKIP;
+    }
+    return decodeGlyphMultibyte(text, len, i);
+}
+
+// Word wrap and page breaking
+WrapResult findLineBreak(const char* buffer, int bufLen, int lineStart, int maxWidth, const uint8_t* widths);
+int wrapChunkPages(const char* buffer, int bufLen, bool moreData, long chunkFileStart, const PageLayout& layout,
+                   int& lineCount, std::vector<long>& pagePositions, int maxPages, OutlineScan* outline);
+int indexPagesWordWrap(TextStream& stream, const PageLayout& layout, long startPos, std::vector<long>& pagePositions,
+                       int maxPages);
+
+// Book outline
+void outlineScanBegin(OutlineScan& scan, TextStream& stream, long startPos);
+void outlineScanLine(OutlineScan& scan, const char* buffer, int start, const WrapResult& wrap, int bufLen,
+                     long chunkFileStart);
+int chapterHeadingKind(const char* text, int len);
@@ -0,0 +1,230 @@
+// Performance instrumentation - see perf.h
+
+#include "perf.h"
+
+#include <stdarg.h>
+
+void logPrintf(const char* format, ...) {
+    char line[LOG_LINE_MAX];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length < 0) {
+        return;
+    }
+    if (length >= (int)sizeof(line)) {
+        length = sizeof(line) - 1;
+        line[length - 1] = '\n';
+    }
+    Serial.write((const uint8_t*)line, length);
+}
+
+#ifdef PERF_STATS
+
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+
+// Bucket 0 holds 0 us, bucket k durations in [2^(k-1), 2^k) us. The last one
+// is open-ended, from 2^22 us (~4 s) up.
+#define PERF_BUCKETS 24
+
+struct PerfHistogram {
+    uint32_t buckets[PERF_BUCKETS];
+    uint32_t count;
+    uint32_t minUs;
+    uint32_t maxUs;
+    uint64_t totalUs;
+};
+
+static const char* const perfMetricNames[PERF_METRIC_COUNT] = {
+    "sd-open", "sd-read", "index-pass", "paginate", "layout", "draw", "epd-full", "epd-partial", "key-to-pixel",
+    "bus-reclaim"
+};
+static const char* const perfCounterNames[PERF_COUNTER_COUNT] = {
+    "sd-bytes", "lent-sd-bytes", "page-cache-hit", "page-cache-miss", "keys", "turns", "turn-heap-changes"
+};
+
+static PerfHistogram perfHistograms[PERF_METRIC_COUNT];
+static uint32_t perfCounters[PERF_COUNTER_COUNT];
+static uint32_t perfSince;      // millis() of the last reset
+static uint32_t perfKeyStart;   // micros() of the oldest key not yet on screen, 0 = none
+static portMUX_TYPE perfMux = portMUX_INITIALIZER_UNLOCKED;
+
+void perfRecord(PerfMetric metric, uint32_t us) {
+    int bucket = us == 0 ? 0 : min(32 - __builtin_clz(us), PERF_BUCKETS - 1);
+
+    portENTER_CRITICAL(&perfMux);
+    PerfHistogram& h = perfHistograms[metric];
+    h.buckets[bucket]++;
+    if (h.count == 0 || us < h.minUs) {
+        h.minUs = us;
+    }
+    if (us > h.maxUs) {
+        h.maxUs = us;
+    }
+    h.count++;
+    h.totalUs += us;
+    portEXIT_CRITICAL(&perfMux);
+}
+
+void perfCount(PerfCounter counter, uint32_t n) {
+    portENTER_CRITICAL(&perfMux);
+    perfCounters[counter] += n;
+    portEXIT_CRITICAL(&perfMux);
+}
+
+void perfReset() {
+    portENTER_CRITICAL(&perfMux);
+    memset(perfHistograms, 0, sizeof(perfHistograms));
+    memset(perfCounters, 0, sizeof(perfCounters));
+    perfKeyStart = 0;
+    portEXIT_CRITICAL(&perfMux);
+    perfSince = millis();
+}
+
+// Upper bound of the bucket holding the permille'th duration, capped at max
+static uint32_t perfPercentile(const PerfHistogram& h, uint32_t permille) {
+    uint32_t rank = ((uint64_t)h.count * permille + 999) / 1000;
+    uint32_t seen = 0;
+    for (int k = 0; k < PERF_BUCKETS - 1; k++) {
+        seen += h.buckets[k];
+        if (seen >= rank) {
+            return min(k == 0 ? 0 : (1UL << k) - 1, (unsigned long)h.maxUs);
+        }
+    }
+    return h.maxUs;
+}
+
+void perfDump(Print& out) {
+    // Copy out first - printing is slow and the indexer keeps recording
+    PerfHistogram histograms[PERF_METRIC_COUNT];
+    uint32_t counters[PERF_COUNTER_COUNT];
+    portENTER_CRITICAL(&perfMux);
+    memcpy(histograms, perfHistograms, sizeof(histograms));
+    memcpy(counters, perfCounters, sizeof(counters));
+    portEXIT_CRITICAL(&perfMux);
+
+    out.printf("Perf over %lu s (us):\n", (unsigned long)(millis() - perfSince) / 1000);
+    out.printf("  %-13s %7s %9s %9s %9s %9s %9s %9s\n", "", "count", "mean", "min", "p50", "p90", "p99", "max");
+    for (int m = 0; m < PERF_METRIC_COUNT; m++) {
+        const PerfHistogram& h = histograms[m];
+        if (h.count == 0) {
+            out.printf("  %-13s %7d\n", perfMetricNames[m], 0);
+            continue;
+        }
+        out.printf("  %-13s %7lu %9lu %9lu %9lu %9lu %9lu %9lu\n", perfMetricNames[m], (unsigned long)h.count,
+                   (unsigned long)(h.totalUs / h.count), (unsigned long)h.minUs, (unsigned long)perfPercentile(h, 500),
+                   (unsigned long)perfPercentile(h, 900), (unsigned long)perfPercentile(h, 990),
+                   (unsigned long)h.maxUs);
+
+        // Non-empty buckets as "<upper bound:count"
+        out.print("   ");
+        for (int k = 0; k < PERF_BUCKETS; k++) {
+            if (h.buckets[k] == 0) {
+                continue;
+            }
+            if (k == PERF_BUCKETS - 1) {
+                out.printf(" >=%lu:%lu", 1UL << (k - 1), (unsigned long)h.buckets[k]);
+            } else {
+                out.printf(" <%lu:%lu", 1UL << k, (unsigned long)h.buckets[k]);
+            }
+        }
+        out.println();
+    }
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+        out.printf("  %-17s %lu\n", perfCounterNames[c], (unsigned long)counters[c]);
+    }
+
+    // Low water is since boot - perf reset can't move it
+    out.printf("  %-8s %9s %9s %9s\n", "heap", "free", "low", "largest");
+    out.printf("  %-8s %9u %9u %9u\n", "internal", (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+               (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL),
+               (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL));
+#ifdef BOARD_HAS_PSRAM
+    if (psramFound()) {
+        out.printf("  %-8s %9u %9u %9u\n", "psram", (unsigned)heap_caps_get_free_size(MALLOC_CAP_SPIRAM),
+                   (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM),
+                   (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM));
+    }
+#endif
+}
+
+size_t perfHeapFree() {
+    return heap_caps_get_free_size(MALLOC_CAP_8BIT);
+}
+
+void perfTurnEnd(size_t freeBefore, bool measured) {
+    if (!measured) {
+        return;
+    }
+    size_t freeAfter = perfHeapFree();
+    perfCount(PERF_TURNS, 1);
+    if (freeAfter != freeBefore) {
+        perfCount(PERF_TURN_HEAP_CHANGES, 1);
+        LOG_VERBOSE("  Page turn changed the heap by %ld bytes\n", (long)freeAfter - (long)freeBefore);
+    }
+}
+
+// Line commands on the serial console, checked from loop()
+void perfPollSerial() {
+    static char line[16];
+    static int length = 0;
+
+    while (Serial.available() > 0) {
+        int c = Serial.read();
+        if (c != '\r' && c != '\n') {
+            if (length < (int)sizeof(line) - 1) {
+                line[length++] = c;
+            }
+            continue;
+        }
+        if (length == 0) {
+            continue;
+        }
+        line[length] = '\0';
+        length = 0;
+
+        if (strcmp(line, "perf") == 0) {
+            perfDump(Serial);
+        } else if (strcmp(line, "perf reset") == 0) {
+            perfReset();
+            Serial.println("Perf stats reset");
+        } else {
+            Serial.printf("Unknown command \"%s\" - try \"perf\" or \"perf reset\"\n", line);
+        }
+    }
+}
+
+void perfKeyQueued() {
+    portENTER_CRITICAL(&perfMux);
+    perfCounters[PERF_KEYS]++;
+    if (perfKeyStart == 0) {
+        perfKeyStart = max(micros(), 1UL);
+    }
+    portEXIT_CRITICAL(&perfMux);
+}
+
+// Keys that arrive during the refresh (onDisplayBusy drains the keyboard)
+// wait for the next one
+uint32_t perfKeyRefreshBegin() {
+    portENTER_CRITICAL(&perfMux);
+    uint32_t start = perfKeyStart;
+    perfKeyStart = 0;
+    portEXIT_CRITICAL(&perfMux);
+    return start;
+}
+
+void perfKeyRefreshEnd(uint32_t keyStart) {
+    if (keyStart != 0) {
+        perfRecord(PERF_KEY_TO_PIXEL, micros() - keyStart);
+    }
+}
+
+void perfKeyIdle() {
+    portENTER_CRITICAL(&perfMux);
+    perfKeyStart = 0;
+    portEXIT_CRITICAL(&perfMux);
+}
+
+#endif
@@ -0,0 +1,108 @@
+// Performance instrumentation - scoped timers, counters and a verbose log
+// switch. Build with -DPERF_STATS to collect timings; send "perf" over
+// serial for histograms and heap figures, "perf reset" to start over.
+// Without the flag every PERF_ macro compiles to nothing. -DQUIET_LOG strips
+// the per-event logging.
+#pragma once
+
+#include <Arduino.h>
+
+// Timed operations, each with a histogram of durations in microseconds
+enum PerfMetric {
+    PERF_SD_OPEN,        // Opening a book file
+    PERF_SD_READ,        // One seek + read of book text
+    PERF_INDEX_PASS,     // One indexBookIncremental() call
+    PERF_PAGINATE,       // Wrapping one read-ahead chunk into pages
+    PERF_LAYOUT,         // Reading and wrapping one page for the render cache
+    PERF_DRAW,           // Drawing a screen into the frame buffer
+    PERF_EPD_FULL,       // Full refresh, including the BUSY wait
+    PERF_EPD_PARTIAL,    // Partial refresh, including the BUSY wait
+    PERF_KEY_TO_PIXEL,   // Key read off the keyboard to its screen refreshed
+    PERF_BUS_RECLAIM,    // Display waiting to get the SPI bus back after BUSY
+    PERF_METRIC_COUNT
+};
+
+// Plain event counts
+enum PerfCounter {
+    PERF_SD_BYTES,
+    PERF_LENT_SD_BYTES,      // ...of which read ahead during display BUSY waits
+    PERF_PAGE_CACHE_HIT,
+    PERF_PAGE_CACHE_MISS,
+    PERF_KEYS,
+    PERF_TURNS,              // Page turns measured with nothing else allocating
+    PERF_TURN_HEAP_CHANGES,  // ...of which left the heap a different size
+    PERF_COUNTER_COUNT
+};
+
+#define PERF_POLL_MS 100  // How often an idle loop() checks for serial commands
+
+#ifdef PERF_STATS
+// Safe to call from either core
+void perfRecord(PerfMetric metric, uint32_t us);
+void perfCount(PerfCounter counter, uint32_t n);
+void perfDump(Print& out);
+void perfReset();
+void perfPollSerial();
+
+// Key-to-pixel: perfKeyQueued() when a key is read, perfKeyRefreshBegin()
+// as a refresh starts, which takes the oldest key waiting. perfKeyRefreshEnd()
+// records it once the refresh is done. perfKeyIdle() drops a key that
+// didn't lead to a refresh.
+void perfKeyQueued();
+uint32_t perfKeyRefreshBegin();
+void perfKeyRefreshEnd(uint32_t keyStart);
+void perfKeyIdle();
+
+// Heap in use around one page turn. Only turns with the indexer idle count -
+// it allocates from the other core. Anything the turn keeps shows up in
+// PERF_TURN_HEAP_CHANGES; a turn that allocates and frees again only shows in
+// the low-water mark.
+size_t perfHeapFree();
+void perfTurnEnd(size_t freeBefore, bool measured);
+
+class PerfScope {
+public:
+    explicit PerfScope(PerfMetric metric) : metric(metric), start(micros()) {}
+    ~PerfScope() { perfRecord(metric, micros() - start); }
+
+private:
+    PerfMetric metric;
+    uint32_t start;
+};
+
+#define PERF_CONCAT_(a, b) a##b
+#define PERF_CONCAT(a, b)  PERF_CONCAT_(a, b)
+#define PERF_SCOPE(metric)        PerfScope PERF_CONCAT(perfScope, __LINE__)(metric)
+#define PERF_COUNT(counter, n)    perfCount(counter, n)
+#define PERF_KEY_QUEUED()         perfKeyQueued()
+#define PERF_KEY_REFRESH_BEGIN()  uint32_t perfKeyStart = perfKeyRefreshBegin()
+#define PERF_KEY_REFRESH_END()    perfKeyRefreshEnd(perfKeyStart)
+#define PERF_KEY_IDLE()           perfKeyIdle()
+#define PERF_POLL_SERIAL()        perfPollSerial()
+#define PERF_TURN_BEGIN()         size_t perfHeapBefore = perfHeapFree()
+#define PERF_TURN_END(measured)   perfTurnEnd(perfHeapBefore, measured)
+#else
+#define PERF_SCOPE(metric)        do {} while (0)
+#define PERF_COUNT(counter, n)    do {} while (0)
+#define PERF_KEY_QUEUED()         do {} while (0)
+#define PERF_KEY_REFRESH_BEGIN()  do {} while (0)
+#define PERF_KEY_REFRESH_END()    do {} while (0)
+#define PERF_KEY_IDLE()           do {} while (0)
+#define PERF_POLL_SERIAL()        do {} while (0)
+#define PERF_TURN_BEGIN()         do {} while (0)
+#define PERF_TURN_END(measured)   do {} while (0)
+#endif
+
+// Per-page, per-key and per-row chatter. Errors and one-off summaries stay
+// on Serial.printf. Stripped calls are still type-checked, then dropped.
+// logPrintf() formats on the stack - Serial.printf mallocs for anything
+// longer than 64 bytes, and this runs on every page turn.
+#define LOG_LINE_MAX 160  // Longer lines are cut short
+
+void logPrintf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+#ifdef QUIET_LOG
+#define LOG_VERBOSE(...) do { if (0) logPrintf(__VA_ARGS__); } while (0)
+#else
+#define LOG_VERBOSE(...) logPrintf(__VA_ARGS__)
+#endif
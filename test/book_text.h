@@ -0,0 +1,112 @@
+// Book text for the native tests - a TextStream over a string, and the
+// books in PAGINATION_CORPUS
+#pragma once
+
+#include "pagination.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+class StringStream : public TextStream {
+public:
+    explicit StringStream(const std::string& text) : text(text), pos(0) {}
+
+    bool seek(long to) override {
+        pos = std::min(std::max(to, 0L), (long)text.size());
+        return true;
+    }
+
+    int read(char* buffer, int len) override {
+        int n = std::min((long)len, (long)text.size() - pos);
+        memcpy(buffer, text.data() + pos, n);
+        pos += n;
+        return n;
+    }
+
+    long size() override {
+        return text.size();
+    }
+
+private:
+    const std::string& text;
+    long pos;
+};
+
+struct CorpusBook {
+    std::string name;
+    std::string text;
+};
+
+// Every .txt in the folder named by PAGINATION_CORPUS, sorted by name.
+// Empty if it isn't set.
+inline std::vector<CorpusBook> loadCorpus() {
+    std::vector<CorpusBook> books;
+    const char* dirPath = getenv("PAGINATION_CORPUS");
+    DIR* dir = dirPath != nullptr ? opendir(dirPath) : nullptr;
+    if (dir == nullptr) {
+        return books;
+    }
+
+    while (dirent* entry = readdir(dir)) {
+        size_t len = strlen(entry->d_name);
+        if (len < 4 || strcasecmp(entry->d_name + len - 4, ".txt") != 0) {
+            continue;
+        }
+        std::string path = std::string(dirPath) + "/" + entry->d_name;
+        FILE* f = fopen(path.c_str(), "rb");
+        if (f == nullptr) {
+            continue;
+        }
+        CorpusBook book;
+        book.name = entry->d_name;
+        char buf[65536];
+        size_t got;
+        while ((got = fread(buf, 1, sizeof(buf), f)) > 0) {
+            book.text.append(buf, got);
+        }
+        fclose(f);
+        books.push_back(book);
+    }
+    closedir(dir);
+
+    std::sort(books.begin(), books.end(), [](const CorpusBook& a, const CorpusBook& b) { return a.name < b.name; });
+    return books;
+}
+
+// Plain text from a fixed seed: paragraphs of English-like words with
+// chapter headings, curly quotes, dashes, accents and the odd CRLF.
+// Stands in for a real book when there is no corpus.
+inline std::string syntheticBook(size_t size, uint32_t seed) {
+    static const char* const words[] = {
+        "the", "of", "and", "a", "to", "in", "was", "he", "it", "that", "her", "had", "with", "for",
+        "upon", "herself", "countenance", "extraordinary", "well-known", "passage,", "said.", "night;",
+        "\xE2\x80\x9CYes,\xE2\x80\x9D", "caf\xC3\xA9", "na\xC3\xAFve", "\xE2\x80\x94", "Elizabeth", "Mr.", "door",
+        "don\xE2\x80\x99t", "\xE2\x80\xA6", "incomprehensibilities", "up", "on", "so"
+    };
+    const int wordCount = sizeof(words) / sizeof(words[0]);
+    std::string text;
+    text.reserve(size + 256);
+    int chapter = 0;
+
+    while (text.size() < size) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t r = seed >> 8;
+        if (r % 40 == 0) {
+            text += "\r\n\r\nCHAPTER " + std::to_string(++chapter) + "\r\n\r\n";
+            continue;
+        }
+        int paragraphWords = 20 + r % 120;
+        for (int i = 0; i < paragraphWords; i++) {
+            seed = seed * 1103515245 + 12345;
+            text += words[(seed >> 8) % wordCount];
+            text += i + 1 < paragraphWords ? " " : "\n";
+        }
+        text += "\n";
+    }
+    return text;
+}
@@ -0,0 +1,169 @@
+// Pagination benchmark: MB/s, pages and heap allocations for each book in
+// PAGINATION_CORPUS (a synthetic book without one), in the device's grid
+// and proportional layouts. Fails below PAGINATION_MIN_MBPS (default 20),
+// or if paginating again into tables that already have room allocates at
+// all. Run with
+// pio test -e native -f test_benchmark -v to see the table.
+
+#include <unity.h>
+
+#include "../book_text.h"
+
+#include <chrono>
+#include <new>
+
+// Every operator new in the test binary lands here
+static unsigned long allocations = 0;
+
+void* operator new(size_t size) {
+    allocations++;
+    void* p = malloc(size > 0 ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+#define BENCH_RUNS 3
+
+struct BenchLayout {
+    const char* name;
+    PageLayout layout;
+};
+
+// The defaults on the device: 38 columns, or 236 px, by 25 lines
+static const BenchLayout layouts[] = {
+    {"grid", {38, gridWidths, 25}},
+    {"proportional", {236, proportionalWidths, 25}},
+};
+
+struct BenchResult {
+    double seconds;               // Best of BENCH_RUNS
+    size_t pages;
+    size_t chapters;
+    unsigned long allocations;    // First run, growing the tables from empty
+    unsigned long reallocations;  // Last run, into the same tables
+    uint32_t pagesHash;           // FNV-1a of the page starts, to spot drift between runs
+};
+
+// The device indexer: 2 KB chunks through wrapChunkPages, outline on
+static int paginateWithOutline(StringStream& stream, const PageLayout& layout, std::vector<long>& pages,
+                               OutlineScan& scan) {
+    const int BUF_SIZE = 2048;
+    char buffer[BUF_SIZE];
+    outlineScanBegin(scan, stream, 0);
+    stream.seek(0);
+    long size = stream.size();
+    long readPos = 0;
+    int leftover = 0;
+    int lineCount = 0;
+
+    for (;;) {
+        int bytesRead = stream.read(buffer + leftover, BUF_SIZE - leftover);
+        readPos += bytesRead;
+        int bufLen = leftover + bytesRead;
+        if (bufLen == 0) {
+            break;
+        }
+        int pos = wrapChunkPages(buffer, bufLen, readPos < size, readPos - bufLen, layout, lineCount, pages, 0,
+                                 &scan);
+        if (readPos >= size) {
+            break;
+        }
+        leftover = bufLen - pos;
+        if (leftover >= BUF_SIZE) {
+            leftover = 0;
+        }
+        memmove(buffer, buffer + pos, leftover);
+    }
+    return pages.size();
+}
+
+static BenchResult runBenchmark(const std::string& text, const PageLayout& layout, bool outline) {
+    BenchResult result = {1e9, 0, 0, 0, 0, 2166136261u};
+    StringStream stream(text);
+    std::vector<long> pages;
+    OutlineScan scan;
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        pages.clear();
+        unsigned long allocationsBefore = allocations;
+        auto start = std::chrono::steady_clock::now();
+        if (outline) {
+            paginateWithOutline(stream, layout, pages, scan);
+        } else {
+            indexPagesWordWrap(stream, layout, 0, pages, 0);
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        result.seconds = std::min(result.seconds, std::max(elapsed.count(), 1e-9));
+        if (run == 0) {
+            result.allocations = allocations - allocationsBefore;
+        }
+        result.reallocations = allocations - allocationsBefore;
+    }
+
+    result.pages = pages.size() + 1;
+    result.chapters = scan.chapters.size();
+    for (long pos : pages) {
+        result.pagesHash = (result.pagesHash ^ (uint32_t)pos) * 16777619u;
+    }
+    return result;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_pagination_throughput() {
+    std::vector<CorpusBook> books = loadCorpus();
+    if (books.empty()) {
+        books.push_back({"synthetic (set PAGINATION_CORPUS for real books)", syntheticBook(4 * 1024 * 1024, 42)});
+    }
+    const char* minEnv = getenv("PAGINATION_MIN_MBPS");
+    double minMBps = minEnv != nullptr ? atof(minEnv) : 20.0;
+
+    printf("\n%-14s %-8s %9s %9s %7s %9s %6s %6s %8s  %s\n", "layout", "pass", "KB", "MB/s", "pages", "chapters",
+           "allocs", "again", "hash", "book");
+    size_t totalBytes = 0;
+    double totalSeconds = 0;
+    for (const CorpusBook& book : books) {
+        for (const BenchLayout& bench : layouts) {
+            uint32_t plainHash = 0;
+            for (bool outline : {false, true}) {
+                BenchResult r = runBenchmark(book.text, bench.layout, outline);
+                double mbps = book.text.size() / r.seconds / (1024 * 1024);
+                printf("%-14s %-8s %9zu %9.1f %7zu %9zu %6lu %6lu %08x  %s\n", bench.name,
+                       outline ? "outline" : "pages", book.text.size() / 1024, mbps, r.pages, r.chapters,
+                       r.allocations, r.reallocations, (unsigned)r.pagesHash, book.name.c_str());
+                totalBytes += book.text.size();
+                totalSeconds += r.seconds;
+
+                // Once the tables have room, paginating must not touch the heap
+                TEST_ASSERT_EQUAL_INT_MESSAGE(0, (int)r.reallocations, book.name.c_str());
+                // ...and the outline scan must not move a page
+                if (outline) {
+                    TEST_ASSERT_EQUAL_UINT32(plainHash, r.pagesHash);
+                }
+                plainHash = r.pagesHash;
+            }
+        }
+    }
+
+    double overall = totalBytes / totalSeconds / (1024 * 1024);
+    printf("overall %.1f MB/s over %zu KB (floor %.1f MB/s)\n", overall, totalBytes / 1024, minMBps);
+    fflush(stdout);
+    TEST_ASSERT_TRUE_MESSAGE(overall >= minMBps, "pagination throughput below PAGINATION_MIN_MBPS");
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_pagination_throughput);
+    return UNITY_END();
+}
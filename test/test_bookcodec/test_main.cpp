@@ -0,0 +1,113 @@
+// Block-compressed book container and its LZ4 codec
+
+#include <unity.h>
+
+#include "bookcodec.h"
+#include "../book_text.h"
+
+static uint32_t get32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Decompress every block of a packed book, the way the reader does
+static std::string unpackBook(const std::vector<uint8_t>& packed) {
+    BookHeader header;
+    memcpy(&header, packed.data(), sizeof(header));
+    TEST_ASSERT_TRUE(bookHeaderValid(header));
+
+    size_t blockSize = (size_t)1 << header.blockShift;
+    std::string text;
+    std::vector<uint8_t> block(blockSize);
+    for (uint32_t b = 0; b < header.blockCount; b++) {
+        uint32_t start = get32(&packed[sizeof(BookHeader) + b * 4]);
+        uint32_t end = get32(&packed[sizeof(BookHeader) + (b + 1) * 4]);
+        size_t length = std::min(blockSize, (size_t)header.textSize - b * blockSize);
+        TEST_ASSERT_TRUE(start <= end && end <= packed.size());
+        if (end - start == length) {
+            memcpy(block.data(), &packed[start], length);
+        } else {
+            TEST_ASSERT_TRUE(lz4DecompressBlock(&packed[start], end - start, block.data(), length));
+        }
+        text.append((const char*)block.data(), length);
+    }
+    return text;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_book_round_trips() {
+    std::string text = syntheticBook(200 * 1024 + 123, 3);
+    for (int blockShift : {10, BOOK_BLOCK_SHIFT, BOOK_MAX_BLOCK_SHIFT}) {
+        std::vector<uint8_t> packed;
+        packBook((const uint8_t*)text.data(), text.size(), packed, blockShift);
+        TEST_ASSERT_TRUE(packed.size() < text.size());
+        TEST_ASSERT_TRUE(unpackBook(packed) == text);
+    }
+}
+
+void test_incompressible_blocks_are_stored() {
+    std::string noise(3000, '\0');
+    uint32_t seed = 5;
+    for (char& c : noise) {
+        seed = seed * 1103515245 + 12345;
+        c = seed >> 16;
+    }
+    std::vector<uint8_t> packed;
+    packBook((const uint8_t*)noise.data(), noise.size(), packed, 10);
+    TEST_ASSERT_TRUE(unpackBook(packed) == noise);
+}
+
+void test_short_and_empty_blocks() {
+    for (const char* text : {"", "a", "abcabcabcabcabc", "twelve bytes"}) {
+        std::vector<uint8_t> compressed;
+        lz4CompressBlock((const uint8_t*)text, strlen(text), compressed);
+        std::string out(strlen(text), '\0');
+        TEST_ASSERT_TRUE(lz4DecompressBlock(compressed.data(), compressed.size(), (uint8_t*)&out[0], out.size()));
+        TEST_ASSERT_EQUAL_STRING(text, out.c_str());
+    }
+}
+
+void test_corrupt_blocks_are_rejected() {
+    std::string text = syntheticBook(8 * 1024, 9);
+    std::vector<uint8_t> compressed;
+    lz4CompressBlock((const uint8_t*)text.data(), text.size(), compressed);
+    std::vector<uint8_t> out(text.size());
+
+    // Wrong length either way, cut short, and a match reaching before the start
+    TEST_ASSERT_FALSE(lz4DecompressBlock(compressed.data(), compressed.size(), out.data(), out.size() - 1));
+    out.resize(text.size() + 1);
+    TEST_ASSERT_FALSE(lz4DecompressBlock(compressed.data(), compressed.size(), out.data(), out.size()));
+    out.resize(text.size());
+    TEST_ASSERT_FALSE(lz4DecompressBlock(compressed.data(), compressed.size() / 2, out.data(), out.size()));
+    const uint8_t farMatch[] = {0x10, 'a', 0xFF, 0x00, 0x50, 'b', 'c', 'd', 'e', 'f'};
+    TEST_ASSERT_FALSE(lz4DecompressBlock(farMatch, sizeof(farMatch), out.data(), 10));
+}
+
+void test_header_checks() {
+    std::vector<uint8_t> packed;
+    packBook((const uint8_t*)"hello\n", 6, packed);
+    BookHeader header;
+    memcpy(&header, packed.data(), sizeof(header));
+    TEST_ASSERT_TRUE(bookHeaderValid(header));
+
+    BookHeader bad = header;
+    bad.magic ^= 1;
+    TEST_ASSERT_FALSE(bookHeaderValid(bad));
+    bad = header;
+    bad.blockCount = 2;
+    TEST_ASSERT_FALSE(bookHeaderValid(bad));
+    bad = header;
+    bad.blockShift = BOOK_MAX_BLOCK_SHIFT + 1;
+    TEST_ASSERT_FALSE(bookHeaderValid(bad));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_book_round_trips);
+    RUN_TEST(test_incompressible_blocks_are_stored);
+    RUN_TEST(test_short_and_empty_blocks);
+    RUN_TEST(test_corrupt_blocks_are_rejected);
+    RUN_TEST(test_header_checks);
+    return UNITY_END();
+}
@@ -0,0 +1,206 @@
+// findLineBreak against the byte-at-a-time version it replaced. The
+// four-byte fast path must give exactly the same breaks, or pages move in
+// books already indexed on the card.
+
+#include <unity.h>
+
+#include "../book_text.h"
+
+// findLineBreak as it was before the fast path: the same per-byte loop,
+// one character per iteration
+static WrapResult findLineBreakBytewise(const char* buffer, int bufLen, int lineStart, int maxWidth,
+                                        const uint8_t* widths) {
+    WrapResult result;
+    result.lineEnd = lineStart;
+    result.nextStart = lineStart;
+
+    if (lineStart >= bufLen) {
+        return result;
+    }
+
+    int lineWidth = 0;
+    int lastBreakPoint = -1;
+    bool inWord = false;
+
+    for (int i = lineStart; i < bufLen; i++) {
+        char c = buffer[i];
+
+        if (c == '\n') {
+            result.lineEnd = i;
+            result.nextStart = i + 1;
+            if (result.nextStart < bufLen && buffer[result.nextStart] == '\r') {
+                result.nextStart++;
+            }
+            return result;
+        }
+
+        if (c == '\r') {
+            result.lineEnd = i;
+            result.nextStart = i + 1;
+            if (result.nextStart < bufLen && buffer[result.nextStart] == '\n') {
+                result.nextStart++;
+            }
+            return result;
+        }
+
+        int next = i;
+        int glyph = decodeGlyph(buffer, bufLen, next);
+        if (glyph == GLYPH_INCOMPLETE) {
+            break;
+        }
+
+        if (glyph != GLYPH_SKIP) {
+            lineWidth += widths[glyph];
+
+            if (c == ' ' || c == '\t') {
+                if (inWord) {
+                    lastBreakPoint = i;
+                    inWord = false;
+                }
+            } else if (glyph == '-') {
+                if (inWord) {
+                    lastBreakPoint = next;
+                }
+            } else {
+                inWord = true;
+            }
+
+            if (lineWidth >= maxWidth) {
+                if (lastBreakPoint > lineStart) {
+                    result.lineEnd = lastBreakPoint;
+                    result.nextStart = lastBreakPoint;
+                    while (result.nextStart < bufLen &&
+                           (buffer[result.nextStart] == ' ' || buffer[result.nextStart] == '\t')) {
+                        result.nextStart++;
+                    }
+                } else {
+                    result.lineEnd = i;
+                    result.nextStart = i;
+                }
+                return result;
+            }
+        }
+        i = next - 1;
+    }
+
+    result.lineEnd = bufLen;
+    result.nextStart = bufLen;
+    return result;
+}
+
+struct WidthCase {
+    int lineWidth;
+    const uint8_t* widths;
+};
+
+// Grid columns and proportional pixels, from narrower than a word to the
+// device defaults (38 columns, 236 px) and wider
+static const WidthCase widthCases[] = {
+    {1, gridWidths}, {2, gridWidths}, {3, gridWidths}, {5, gridWidths}, {7, gridWidths}, {13, gridWidths},
+    {38, gridWidths}, {60, gridWidths}, {120, gridWidths},
+    {2, proportionalWidths}, {9, proportionalWidths}, {25, proportionalWidths}, {64, proportionalWidths},
+    {236, proportionalWidths}, {255, proportionalWidths},
+};
+
+static int compared = 0;
+
+// Both versions from every start in the buffer, and at every width
+static void assertSameBreaks(const char* name, const char* text, int len) {
+    char message[160];
+    for (const WidthCase& w : widthCases) {
+        for (int start = 0; start <= len; start++) {
+            WrapResult expected = findLineBreakBytewise(text, len, start, w.lineWidth, w.widths);
+            WrapResult actual = findLineBreak(text, len, start, w.lineWidth, w.widths);
+            if (expected.lineEnd != actual.lineEnd || expected.nextStart != actual.nextStart) {
+                snprintf(message, sizeof(message), "%s: width %d%s from %d: %d/%d, was %d/%d", name, w.lineWidth,
+                         w.widths == proportionalWidths ? " px" : "", start, actual.lineEnd, actual.nextStart,
+                         expected.lineEnd, expected.nextStart);
+                TEST_FAIL_MESSAGE(message);
+            }
+            compared++;
+        }
+    }
+}
+
+// Every prefix too, so each break also runs into the end of a chunk
+static void assertSameBreaksAllLengths(const char* name, const std::string& text) {
+    for (size_t len = 0; len <= text.size(); len++) {
+        assertSameBreaks(name, text.data(), len);
+    }
+}
+
+// Pieces the fast path has to step around: space runs, tabs, hyphens,
+// controls, each line ending, multi-byte and malformed UTF-8, CP1252
+static const char* const pieces[] = {
+    "the", "quick", "brown", "fox", " ", "  ", "    ", "\t", "-", "--", "well-known", "a", "I",
+    "\n", "\r\n", "\n\r", "\r", "\n\n", "\x01", "\x7F", "~", ".", ",\"", "'",
+    "supercalifragilisticexpialidocious", "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx",
+    "caf\xC3\xA9", "\xE2\x80\x94", "\xE2\x80\x93", "\xE2\x80\x9Cquoted\xE2\x80\x9D", "\xE2\x80\xA6",
+    "\xF0\x9F\x98\x80", "\xEF\xBB\xBF", "\xE2\x80\x8B", "\xCC\x81", "\xE2\x80\x89",
+    "\xC3", "\xE2\x80", "\xF0\x9F\x98", "\xC0\xAF", "\xED\xA0\x80", "\xFF", "\x93smart\x94", "\x96", "\xA0",
+};
+
+void setUp() {}
+void tearDown() {}
+
+void test_fixed_inputs() {
+    assertSameBreaksAllLengths("ascii", "The quick brown fox jumps over the lazy dog. It was the best of times.");
+    assertSameBreaksAllLengths("long word", "a supercalifragilisticexpialidocious antidisestablishmentarianism b");
+    assertSameBreaksAllLengths("no spaces", std::string(300, 'm'));
+    assertSameBreaksAllLengths("spaces", "word" + std::string(80, ' ') + "word    \t  \t word");
+    assertSameBreaksAllLengths("crlf", "Line one\r\nLine two\r\n\r\nLine four is a little longer than the rest\r\n");
+    assertSameBreaksAllLengths("mixed endings", "a\nb\r\nc\rd\n\re\n\n\r\rf");
+    assertSameBreaksAllLengths("hyphens", "well-known self-evident -leading trailing- -- a-b-c-d-e-f-g-h-i-j");
+    assertSameBreaksAllLengths("utf-8",
+                               "\xE2\x80\x9C" "Caf\xC3\xA9,\xE2\x80\x9D she said\xE2\x80\x94na\xC3\xAFvely\xE2\x80\xA6 "
+                               "\xF0\x9F\x98\x80 \xEF\xBB\xBF" "start \xCE\xB1\xCE\xB2\xCE\xB3 \xE2\x94\x80\xE2\x94\x80");
+    assertSameBreaksAllLengths("cp1252", "\x93Quoted\x94 \x96 dash \xE9t\xE9 \x85 \x80 50");
+}
+
+// Random strings of the pieces above, from fixed seeds
+void test_random_inputs() {
+    const int pieceCount = sizeof(pieces) / sizeof(pieces[0]);
+    uint32_t seed = 12345;
+    for (int round = 0; round < 200; round++) {
+        std::string text;
+        while (text.size() < 160) {
+            seed = seed * 1103515245 + 12345;
+            text += pieces[(seed >> 8) % pieceCount];
+        }
+        assertSameBreaksAllLengths("random", text);
+    }
+}
+
+// Line by line through whole books, the way the indexer goes
+void test_books() {
+    std::vector<CorpusBook> books = loadCorpus();
+    books.push_back({"synthetic", syntheticBook(512 * 1024, 11)});
+
+    for (const CorpusBook& book : books) {
+        const char* text = book.text.data();
+        int len = book.text.size();
+        for (const WidthCase& w : widthCases) {
+            int pos = 0;
+            while (pos < len) {
+                WrapResult expected = findLineBreakBytewise(text, len, pos, w.lineWidth, w.widths);
+                WrapResult actual = findLineBreak(text, len, pos, w.lineWidth, w.widths);
+                if (expected.lineEnd != actual.lineEnd || expected.nextStart != actual.nextStart) {
+                    char message[160];
+                    snprintf(message, sizeof(message), "%s: width %d from %d", book.name.c_str(), w.lineWidth, pos);
+                    TEST_FAIL_MESSAGE(message);
+                }
+                compared++;
+                pos = expected.nextStart > pos ? expected.nextStart : pos + 1;
+            }
+        }
+    }
+    printf("%d line breaks compared, %zu corpus books\n", compared, books.size() - 1);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_fixed_inputs);
+    RUN_TEST(test_random_inputs);
+    RUN_TEST(test_books);
+    return UNITY_END();
+}
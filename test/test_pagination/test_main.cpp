@@ -0,0 +1,251 @@
+// Page boundaries and outline output of the pagination engine for fixed
+// inputs. A change to any of these moves pages in books already indexed on
+// the card, so it has to come with a new layout fingerprint.
+
+#include <unity.h>
+
+#include "../book_text.h"
+
+static PageLayout gridLayout(int charsPerLine, int linesPerPage) {
+    PageLayout layout = {charsPerLine, gridWidths, linesPerPage};
+    return layout;
+}
+
+static void assertLine(const char* text, int lineStart, int width, const uint8_t* widths, int lineEnd,
+                       int nextStart) {
+    WrapResult wrap = findLineBreak(text, strlen(text), lineStart, width, widths);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(lineEnd, wrap.lineEnd, text);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(nextStart, wrap.nextStart, text);
+}
+
+static void assertPages(const std::vector<long>& expected, const std::vector<long>& pages) {
+    TEST_ASSERT_EQUAL_INT_MESSAGE((int)expected.size(), (int)pages.size(), "page count");
+    for (size_t i = 0; i < expected.size(); i++) {
+        TEST_ASSERT_EQUAL_INT_MESSAGE((int)expected[i], (int)pages[i], "page start");
+    }
+}
+
+// The whole text as one chunk, with the outline
+static std::vector<long> paginateWithOutline(const std::string& text, const PageLayout& layout, long startPos,
+                                             OutlineScan& scan) {
+    StringStream stream(text);
+    outlineScanBegin(scan, stream, startPos);
+    std::vector<long> pages;
+    int lineCount = 0;
+    wrapChunkPages(text.data() + startPos, text.size() - startPos, false, startPos, layout, lineCount, pages, 0,
+                   &scan);
+    return pages;
+}
+
+// ============================================================================
+// LINE BREAKS
+// ============================================================================
+
+void setUp() {}
+void tearDown() {}
+
+void test_breaks_after_last_word_that_fits() {
+    // A line is full once it reaches the width, so 9 columns are used
+    assertLine("one two three", 0, 10, gridWidths, 7, 8);
+    assertLine("one two three", 8, 10, gridWidths, 13, 13);
+}
+
+void test_breaks_long_word_mid_word() {
+    assertLine("abcdefghijklmnop", 0, 10, gridWidths, 9, 9);
+    assertLine("abcdefghijklmnop", 9, 10, gridWidths, 16, 16);
+}
+
+void test_breaks_after_hyphen() {
+    assertLine("well-known fact", 0, 8, gridWidths, 5, 5);
+}
+
+void test_skips_spaces_and_tabs_at_break() {
+    assertLine("alpha \t  beta", 0, 8, gridWidths, 5, 9);
+}
+
+void test_honours_every_line_ending() {
+    assertLine("ab\r\ncd\n\rx\ny\rz", 0, 38, gridWidths, 2, 4);
+    assertLine("ab\r\ncd\n\rx\ny\rz", 4, 38, gridWidths, 6, 8);
+    assertLine("ab\r\ncd\n\rx\ny\rz", 8, 38, gridWidths, 9, 10);
+    assertLine("ab\r\ncd\n\rx\ny\rz", 10, 38, gridWidths, 11, 12);
+}
+
+void test_multibyte_character_takes_one_column() {
+    // "café au lait" - the é is two bytes
+    assertLine("caf\xC3\xA9 au lait", 0, 6, gridWidths, 5, 6);
+    // U+2014 em dash is three bytes, and a break point like '-'
+    assertLine("word\xE2\x80\x94word", 0, 7, gridWidths, 7, 7);
+}
+
+void test_leaves_cut_off_sequence_for_next_chunk() {
+    // The buffer ends in the first two bytes of a three-byte character
+    WrapResult wrap = findLineBreak("abc\xE2\x80", 5, 0, 38, gridWidths);
+    TEST_ASSERT_EQUAL_INT(5, wrap.lineEnd);
+    TEST_ASSERT_EQUAL_INT(5, wrap.nextStart);
+}
+
+void test_proportional_widths() {
+    // 'm' advances 6 px and 'i' 4 px: a 30 px line is full at 4 m or 7 i
+    assertLine("mmmmmmmm", 0, 30, proportionalWidths, 4, 4);
+    assertLine("iiiiiiiiii", 0, 30, proportionalWidths, 7, 7);
+    // 3 px spaces: "mm mm" is 27 px
+    assertLine("mm mm mm", 0, 30, proportionalWidths, 5, 6);
+}
+
+// ============================================================================
+// PAGE BOUNDARIES
+// ============================================================================
+
+void test_page_starts_for_fixed_text() {
+    // Lines "one two" / "three" / "four five" / "six", two to a page
+    std::string text = "one two three four five six\n";
+    StringStream stream(text);
+    std::vector<long> pages;
+    int added = indexPagesWordWrap(stream, gridLayout(10, 2), 0, pages, 0);
+    TEST_ASSERT_EQUAL_INT(2, added);
+    assertPages({14, 28}, pages);
+}
+
+void test_blank_lines_count_as_lines() {
+    std::string text = "a\n\n\nb\r\n\r\nc\n";
+    StringStream stream(text);
+    std::vector<long> pages;
+    indexPagesWordWrap(stream, gridLayout(38, 2), 0, pages, 0);
+    assertPages({3, 7, 11}, pages);
+}
+
+void test_max_pages_stops_early() {
+    std::string text = syntheticBook(64 * 1024, 1);
+    StringStream stream(text);
+    std::vector<long> all;
+    indexPagesWordWrap(stream, gridLayout(38, 20), 0, all, 0);
+    std::vector<long> some;
+    TEST_ASSERT_EQUAL_INT(5, indexPagesWordWrap(stream, gridLayout(38, 20), 0, some, 5));
+    assertPages(std::vector<long>(all.begin(), all.begin() + 5), some);
+}
+
+// Pages must not depend on where the 2 KB chunks fall, or on whether a
+// pass started at the beginning or resumed from a page
+void test_chunks_and_resume_give_same_pages() {
+    std::string text = syntheticBook(300 * 1024, 7);
+    const PageLayout layouts[] = {gridLayout(38, 20), gridLayout(13, 3), {236, proportionalWidths, 17}};
+
+    for (const PageLayout& layout : layouts) {
+        std::vector<long> whole;
+        int lineCount = 0;
+        wrapChunkPages(text.data(), text.size(), false, 0, layout, lineCount, whole, 0, nullptr);
+        TEST_ASSERT_TRUE(whole.size() > 20);
+
+        StringStream stream(text);
+        std::vector<long> chunked;
+        indexPagesWordWrap(stream, layout, 0, chunked, 0);
+        assertPages(whole, chunked);
+
+        size_t from = whole.size() / 3;
+        std::vector<long> resumed;
+        indexPagesWordWrap(stream, layout, whole[from - 1], resumed, 0);
+        assertPages(std::vector<long>(whole.begin() + from, whole.end()), resumed);
+    }
+}
+
+// ============================================================================
+// OUTLINE
+// ============================================================================
+
+static const char* const OUTLINE_TEXT =
+    "Chapter 1\n"              //  0  page 1
+    "\n"                       // 10
+    "It was a dark night.\n"   // 11
+    "\n"                       // 32
+    "CHAPTER IV\n"             // 33  page 2
+    "\n"                       // 44
+    "PART TWO\n"               // 45  capitals, but no blank line after
+    "Text follows.\n"          // 54
+    "\n"                       // 68  page 3
+    "EPILOGUE\n"               // 69
+    "\n"                       // 78
+    "The end.\n"               // 79
+    "THE END\n";               // 88  page 4, not after a blank line
+
+void test_outline_headings_and_words() {
+    OutlineScan scan;
+    std::vector<long> pages = paginateWithOutline(OUTLINE_TEXT, gridLayout(38, 4), 0, scan);
+    assertPages({33, 68, 88}, pages);
+
+    TEST_ASSERT_EQUAL_INT(3, (int)scan.chapters.size());
+    TEST_ASSERT_EQUAL_INT(0, (int)scan.chapters[0].offset);
+    TEST_ASSERT_EQUAL_STRING("Chapter 1", scan.chapters[0].title);
+    TEST_ASSERT_EQUAL_INT(33, (int)scan.chapters[1].offset);
+    TEST_ASSERT_EQUAL_STRING("CHAPTER IV", scan.chapters[1].title);
+    TEST_ASSERT_EQUAL_INT(69, (int)scan.chapters[2].offset);
+    TEST_ASSERT_EQUAL_STRING("EPILOGUE", scan.chapters[2].title);
+
+    // Words on each finished page, and on the last one so far
+    TEST_ASSERT_EQUAL_INT(3, (int)scan.words.size());
+    TEST_ASSERT_EQUAL_INT(7, (int)scan.words[0]);
+    TEST_ASSERT_EQUAL_INT(6, (int)scan.words[1]);
+    TEST_ASSERT_EQUAL_INT(3, (int)scan.words[2]);
+    TEST_ASSERT_EQUAL_INT(2, (int)scan.pageWords);
+}
+
+void test_outline_resumes_mid_book() {
+    // Resuming on the blank line before EPILOGUE, and on EPILOGUE itself
+    for (long startPos : {68L, 69L}) {
+        OutlineScan scan;
+        paginateWithOutline(OUTLINE_TEXT, gridLayout(38, 4), startPos, scan);
+        TEST_ASSERT_EQUAL_INT(1, (int)scan.chapters.size());
+        TEST_ASSERT_EQUAL_INT(69, (int)scan.chapters[0].offset);
+    }
+    // A heading has to follow a blank line
+    OutlineScan scan;
+    paginateWithOutline(OUTLINE_TEXT, gridLayout(38, 4), 88, scan);
+    TEST_ASSERT_EQUAL_INT(0, (int)scan.chapters.size());
+}
+
+void test_outline_ignores_wrapped_and_long_lines() {
+    std::string text =
+        "\n"
+        "Chapter Twenty-Three: The Long Rain\n"            // Title cut to 32 characters
+        "\n"
+        "CHAPTER NINE, WHICH WRAPS ONTO TWO LINES\n"       // Not a whole line on screen
+        "\n"
+        "Chapter 9 of a line far too long to be any kind of heading\n"
+        "\n";
+    OutlineScan scan;
+    paginateWithOutline(text, gridLayout(38, 20), 0, scan);
+    TEST_ASSERT_EQUAL_INT(1, (int)scan.chapters.size());
+    TEST_ASSERT_EQUAL_INT(1, (int)scan.chapters[0].offset);
+    TEST_ASSERT_EQUAL_STRING("Chapter Twenty-Three: The Long R", scan.chapters[0].title);
+}
+
+void test_heading_kinds() {
+    TEST_ASSERT_NOT_EQUAL(0, chapterHeadingKind("Chapter", 7));
+    TEST_ASSERT_NOT_EQUAL(0, chapterHeadingKind("CHAPTER 12", 10));
+    TEST_ASSERT_NOT_EQUAL(0, chapterHeadingKind("Chapter One", 11));
+    TEST_ASSERT_EQUAL_INT(0, chapterHeadingKind("Chapters of life", 16));
+    TEST_ASSERT_EQUAL_INT(0, chapterHeadingKind("chapter two", 11));
+    TEST_ASSERT_NOT_EQUAL(0, chapterHeadingKind("PART II", 7));
+    TEST_ASSERT_EQUAL_INT(0, chapterHeadingKind("I", 1));
+    TEST_ASSERT_EQUAL_INT(0, chapterHeadingKind("Part Two", 8));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_breaks_after_last_word_that_fits);
+    RUN_TEST(test_breaks_long_word_mid_word);
+    RUN_TEST(test_breaks_after_hyphen);
+    RUN_TEST(test_skips_spaces_and_tabs_at_break);
+    RUN_TEST(test_honours_every_line_ending);
+    RUN_TEST(test_multibyte_character_takes_one_column);
+    RUN_TEST(test_leaves_cut_off_sequence_for_next_chunk);
+    RUN_TEST(test_proportional_widths);
+    RUN_TEST(test_page_starts_for_fixed_text);
+    RUN_TEST(test_blank_lines_count_as_lines);
+    RUN_TEST(test_max_pages_stops_early);
+    RUN_TEST(test_chunks_and_resume_give_same_pages);
+    RUN_TEST(test_outline_headings_and_words);
+    RUN_TEST(test_outline_resumes_mid_book);
+    RUN_TEST(test_outline_ignores_wrapped_and_long_lines);
+    RUN_TEST(test_heading_kinds);
+    return UNITY_END();
+}
@@ -0,0 +1,111 @@
+// Pack .txt books into block-compressed .txtz for the reader (see
+// src/bookcodec.h). Builds on a PC:
+//   g++ -O2 -Isrc tools/packbook.cpp src/bookcodec.cpp -o packbook
+//   ./packbook book.txt [more.txt ...]
+// Each book.txt is written next to it as book.txtz and checked by
+// decompressing every block again.
+
+#include "bookcodec.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+static bool readFile(const char* path, std::vector<uint8_t>& data) {
+    FILE* f = fopen(path, "rb");
+    if (f == nullptr) {
+        return false;
+    }
+    uint8_t buf[65536];
+    size_t got;
+    while ((got = fread(buf, 1, sizeof(buf), f)) > 0) {
+        data.insert(data.end(), buf, buf + got);
+    }
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Read the container back the way the reader does
+static bool verify(const std::vector<uint8_t>& packed, const std::vector<uint8_t>& text) {
+    BookHeader header;
+    header.magic = get32(&packed[0]);
+    header.version = packed[4];
+    header.blockShift = packed[5];
+    header.textSize = get32(&packed[8]);
+    header.blockCount = get32(&packed[12]);
+    if (!bookHeaderValid(header) || header.textSize != text.size()) {
+        return false;
+    }
+
+    size_t blockSize = (size_t)1 << header.blockShift;
+    std::vector<uint8_t> block(blockSize);
+    for (uint32_t b = 0; b < header.blockCount; b++) {
+        uint32_t start = get32(&packed[sizeof(BookHeader) + b * 4]);
+        uint32_t end = get32(&packed[sizeof(BookHeader) + (b + 1) * 4]);
+        size_t length = std::min(blockSize, text.size() - b * blockSize);
+        if (end < start || end > packed.size()) {
+            return false;
+        }
+        if (end - start == length) {
+            memcpy(block.data(), &packed[start], length);
+        } else if (!lz4DecompressBlock(&packed[start], end - start, block.data(), length)) {
+            return false;
+        }
+        if (memcmp(block.data(), &text[b * blockSize], length) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s book.txt [more.txt ...]\n", argv[0]);
+        return 2;
+    }
+
+    int failed = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string in = argv[i];
+        std::string out = in;
+        size_t dot = out.find_last_of("./");
+        if (dot != std::string::npos && out[dot] == '.') {
+            out.erase(dot);
+        }
+        out += BOOK_COMPRESSED_EXT;
+
+        std::vector<uint8_t> text;
+        if (!readFile(in.c_str(), text)) {
+            fprintf(stderr, "%s: cannot read\n", in.c_str());
+            failed++;
+            continue;
+        }
+
+        std::vector<uint8_t> packed;
+        packBook(text.data(), text.size(), packed);
+        if (!verify(packed, text)) {
+            fprintf(stderr, "%s: packed copy does not read back - please report\n", in.c_str());
+            failed++;
+            continue;
+        }
+
+        FILE* f = fopen(out.c_str(), "wb");
+        if (f == nullptr || fwrite(packed.data(), 1, packed.size(), f) != packed.size()) {
+            fprintf(stderr, "%s: cannot write\n", out.c_str());
+            if (f) fclose(f);
+            failed++;
+            continue;
+        }
+        fclose(f);
+        printf("%s: %zu -> %zu bytes (%.0f%%)\n", out.c_str(), text.size(), packed.size(),
+               text.empty() ? 100.0 : 100.0 * packed.size() / text.size());
+    }
+    return failed == 0 ? 0 : 1;
+}